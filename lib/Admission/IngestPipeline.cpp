@@ -0,0 +1,142 @@
+#include "IngestPipeline.h"
+
+#include <Log.h>
+#include <stdio.h>
+#include <string.h>
+
+uint32_t ingestParseDate(const char *value)
+{
+  if (strlen(value) < 19)
+  {
+    return 0;
+  }
+  CsvSpan date = {value, 19};
+  uint32_t epoch;
+  return parseDateTime(date, &epoch) ? epoch : 0;
+}
+
+IngestPipeline::IngestPipeline(IngestQueue &queue, RateLimiter *limiter, SampleFilter &filter, int32_t timeOffset)
+    : _queue(queue), _limiter(limiter), _filter(filter), _timeOffset(timeOffset)
+{
+  memset(&_counters, 0, sizeof(_counters));
+}
+
+IngestPipeline::~IngestPipeline(void)
+{
+}
+
+IngestCounters &IngestPipeline::counters(void)
+{
+  return _counters;
+}
+
+int IngestPipeline::station(HttpMux &)
+{
+  return 0;
+}
+
+int IngestPipeline::stationShare(void)
+{
+  return INGEST_QUEUE_DEPTH;
+}
+
+void IngestPipeline::sampleSeen(uint32_t, unsigned long)
+{
+}
+
+void IngestPipeline::queued(int, const Observation &, const char *, size_t, bool)
+{
+}
+
+void IngestPipeline::handle(HttpMux &request, unsigned long now)
+{
+  // Admission control comes first so a flood costs as little as possible
+  uint32_t waitMs = _limiter ? _limiter->take(request.remoteIP(), now) : 0;
+  if (waitMs > 0)
+  {
+    _counters.rateLimited++;
+    char retryAfter[12];
+    snprintf(retryAfter, sizeof(retryAfter), "%lu", (unsigned long)(waitMs + 999) / 1000);
+    request.sendHeader("Retry-After", retryAfter);
+    request.send(429, "text/plain", "Too many requests.");
+    return;
+  }
+
+  // No station may take more than its share of the queue
+  int slot = station(request);
+  if (slot < 0)
+  {
+    _counters.unknownStation++;
+    request.send(403, "text/plain", "Unknown station.");
+    return;
+  }
+  if (_queue.isFull() || _queue.depthOf(slot) >= stationShare())
+  {
+    _counters.shed++;
+    char retryAfter[12];
+    snprintf(retryAfter, sizeof(retryAfter), "%d", INGEST_RETRY_AFTER);
+    request.sendHeader("Retry-After", retryAfter);
+    request.send(503, "text/plain", "Ingest queue full.");
+    return;
+  }
+
+  const char *dateutc = request.argValue("dateutc");
+
+  LOGD("DATEUTC: %s", dateutc);
+
+  // Consoles resend on timeout; a sample already seen is acknowledged but not stored twice
+  const char *console = request.argValue("PASSKEY");
+  char consoleAddress[64];
+  if (!request.hasArg("PASSKEY"))
+  {
+    snprintf(consoleAddress, sizeof(consoleAddress), "%s@%lu", request.argValue("stationtype"), (unsigned long)request.remoteIP());
+    console = consoleAddress;
+  }
+  uint32_t sampleEpoch = ingestParseDate(dateutc);
+  bool outOfOrder = false;
+  if (sampleEpoch != 0)
+  {
+    SampleVerdict verdict = _filter.check(sampleStationKey(console), sampleEpoch);
+    if (verdict == SAMPLE_NEW)
+    {
+      sampleSeen(sampleEpoch, now);
+    }
+    if (verdict == SAMPLE_DUPLICATE)
+    {
+      _counters.duplicates++;
+      LOGI("DUPLICATE: %s", dateutc);
+      request.send(200, "text/plain", "Duplicate sample ignored.");
+      return;
+    }
+    if (verdict == SAMPLE_OUT_OF_ORDER)
+    {
+      _counters.outOfOrder++;
+      outOfOrder = true;
+      LOGW("OUT OF ORDER: %s", dateutc);
+    }
+  }
+
+  // Every reading is parsed and converted as described in observationFields
+  Observation observation;
+  observation.time = sampleEpoch != 0 ? sampleEpoch + _timeOffset : 0;
+  observationParse(request, observation);
+  char data[OBSERVATION_CSV_SIZE];
+  size_t dataLength = observationToCsv(observation, data);
+
+  LOGD("QUEUED DATA: %s", data);
+
+  if (!_queue.push(data, dataLength, slot))
+  {
+    _counters.shed++;
+    request.send(413, "text/plain", "Record too long.");
+    return;
+  }
+  _counters.accepted++;
+  if (_queue.depth() > _counters.maxDepth)
+  {
+    _counters.maxDepth = _queue.depth();
+  }
+  queued(slot, observation, data, dataLength, outOfOrder);
+
+  request.send(200, "text/plain", "Data queued for SD card.");
+}
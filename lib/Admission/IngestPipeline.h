@@ -0,0 +1,69 @@
+#ifndef IngestPipeline_h
+#define IngestPipeline_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <HttpMux.h>
+#include <Observation.h>
+#include <SampleFilter.h>
+
+#include "IngestQueue.h"
+#include "RateLimiter.h"
+
+#define INGEST_RETRY_AFTER 10 // seconds suggested when the queue is full
+
+struct IngestCounters
+{
+  uint32_t accepted;
+  uint32_t shed;        // turned away with 503, queue full
+  uint32_t rateLimited; // turned away with 429, source over its rate
+  uint32_t written;
+  uint32_t writeErrors;
+  uint32_t duplicates; // retransmissions acknowledged but not stored again
+  uint32_t outOfOrder; // stored, older than the newest sample from the same station
+  uint32_t unknownStation; // gateway mode: turned away with 403, no mapping matched
+  uint16_t maxDepth;
+};
+
+// dateutc as posted, "YYYY-MM-DD HH:MM:SS" with anything after it ignored; 0 if missing or invalid
+uint32_t ingestParseDate(const char *value);
+
+/**
+ * The /post path: rate limit per source, station lookup, queue admission,
+ * then the duplicate check on (station, dateutc), and parse, convert and
+ * queue. The firmware's handlePost() and the in-process target of
+ * tools/loadgen both answer through it, so the load test measures the code
+ * the device runs.
+ *
+ * Which station a post belongs to and what happens to an accepted sample
+ * besides queueing it are supplied by a subclass; the defaults serve a single
+ * station with the whole queue.
+ */
+class IngestPipeline
+{
+
+public:
+  // limiter may be null for no rate limit; timeOffset is added to dateutc for the stored time
+  IngestPipeline(IngestQueue &queue, RateLimiter *limiter, SampleFilter &filter, int32_t timeOffset);
+  virtual ~IngestPipeline(void);
+
+  void handle(HttpMux &request, unsigned long now); // answers the post
+  IngestCounters &counters(void);
+
+protected:
+  // Station and sample hooks
+  virtual int station(HttpMux &request);  // slot the post belongs to, -1 to turn it away with 403
+  virtual int stationShare(void);         // queue slots one station may hold
+  virtual void sampleSeen(uint32_t epoch, unsigned long now); // a dateutc not seen before
+  virtual void queued(int slot, const Observation &observation, const char *line, size_t length, bool outOfOrder);
+
+  IngestQueue &_queue;
+  RateLimiter *_limiter;
+  SampleFilter &_filter;
+  int32_t _timeOffset;
+  IngestCounters _counters;
+
+};
+
+#endif
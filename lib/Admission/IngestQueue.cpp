@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include "IngestQueue.h"
+
+IngestQueue::IngestQueue(void)
+{
+  _head = 0;
+  _count = 0;
+}
+
+bool IngestQueue::push(const char *record, size_t length, uint8_t station)
+{
+  if (_count >= INGEST_QUEUE_DEPTH || length >= INGEST_RECORD_SIZE)
+  {
+    return false;
+  }
+  int tail = (_head + _count) % INGEST_QUEUE_DEPTH;
+  memcpy(_records[tail], record, length);
+  _records[tail][length] = '\0';
+  _lengths[tail] = length;
+  _stations[tail] = station;
+  _count++;
+  return true;
+}
+
+const char *IngestQueue::front(void) const
+{
+  return _count > 0 ? _records[_head] : nullptr;
+}
+
+size_t IngestQueue::frontLength(void) const
+{
+  return _count > 0 ? _lengths[_head] : 0;
+}
+
+uint8_t IngestQueue::frontStation(void) const
+{
+  return _count > 0 ? _stations[_head] : 0;
+}
+
+void IngestQueue::pop(void)
+{
+  if (_count > 0)
+  {
+    _head = (_head + 1) % INGEST_QUEUE_DEPTH;
+    _count--;
+  }
+}
+
+int IngestQueue::depth(void) const
+{
+  return _count;
+}
+
+int IngestQueue::depthOf(uint8_t station) const
+{
+  int count = 0;
+  for (int i = 0; i < _count; i++)
+  {
+    if (_stations[(_head + i) % INGEST_QUEUE_DEPTH] == station)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+int IngestQueue::capacity(void) const
+{
+  return INGEST_QUEUE_DEPTH;
+}
+
+bool IngestQueue::isFull(void) const
+{
+  return _count >= INGEST_QUEUE_DEPTH;
+}
@@ -0,0 +1,42 @@
+#ifndef IngestQueue_h
+#define IngestQueue_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define INGEST_QUEUE_DEPTH 16
+#define INGEST_RECORD_SIZE 320
+
+/**
+ * Bounded FIFO of ingested records held in RAM between the /post handler and
+ * the SD card. Storage is fixed at compile time; a full queue rejects new
+ * records instead of growing. Each record carries the station slot it belongs
+ * to, so admission can cap how much of the queue one station may hold.
+ */
+class IngestQueue
+{
+
+public:
+  IngestQueue(void);
+
+  bool push(const char *record, size_t length, uint8_t station = 0); // false when full or the record is too long
+  const char *front(void) const;                                    // NUL terminated, nullptr when empty
+  size_t frontLength(void) const;
+  uint8_t frontStation(void) const;
+  void pop(void);
+
+  int depth(void) const;
+  int depthOf(uint8_t station) const; // records queued for one station
+  int capacity(void) const;
+  bool isFull(void) const;
+
+protected:
+  char _records[INGEST_QUEUE_DEPTH][INGEST_RECORD_SIZE];
+  uint16_t _lengths[INGEST_QUEUE_DEPTH];
+  uint8_t _stations[INGEST_QUEUE_DEPTH];
+  int _head;
+  int _count;
+
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include "RateLimiter.h"
+
+RateLimiter::RateLimiter(uint16_t burst, uint32_t refillMs)
+{
+  _burst = burst;
+  _refillMs = refillMs;
+  for (int i = 0; i < RATE_LIMIT_SOURCES; i++)
+  {
+    _buckets[i].used = false;
+  }
+}
+
+RateLimiter::Bucket &RateLimiter::bucketFor(uint32_t source, unsigned long now)
+{
+  int oldest = 0;
+  for (int i = 0; i < RATE_LIMIT_SOURCES; i++)
+  {
+    if (_buckets[i].used && _buckets[i].source == source)
+    {
+      return _buckets[i];
+    }
+    if (!_buckets[i].used)
+    {
+      oldest = i;
+      break;
+    }
+    if (now - _buckets[i].updated > now - _buckets[oldest].updated)
+    {
+      oldest = i;
+    }
+  }
+
+  Bucket &bucket = _buckets[oldest];
+  bucket.source = source;
+  bucket.tokens = _burst;
+  bucket.updated = now;
+  bucket.used = true;
+  return bucket;
+}
+
+uint32_t RateLimiter::take(uint32_t source, unsigned long now)
+{
+  Bucket &bucket = bucketFor(source, now);
+
+  // Credit whole tokens only and carry the remainder in updated
+  unsigned long elapsed = now - bucket.updated;
+  uint32_t earned = elapsed / _refillMs;
+  if (earned > 0)
+  {
+    if (bucket.tokens + earned >= _burst)
+    {
+      bucket.tokens = _burst;
+      bucket.updated = now;
+    }
+    else
+    {
+      bucket.tokens += earned;
+      bucket.updated += earned * _refillMs;
+    }
+  }
+
+  if (bucket.tokens > 0)
+  {
+    bucket.tokens--;
+    if (bucket.tokens + 1 == _burst)
+    {
+      bucket.updated = now; // refill starts counting from the first token spent
+    }
+    return 0;
+  }
+  return _refillMs - (now - bucket.updated);
+}
@@ -0,0 +1,40 @@
+#ifndef RateLimiter_h
+#define RateLimiter_h
+
+#include <inttypes.h>
+
+#define RATE_LIMIT_SOURCES 8
+
+/**
+ * Token bucket per source address. Each source may burst up to `burst`
+ * requests and then gets one more every `refillMs`. When more sources show up
+ * than the table holds, the one idle longest is forgotten.
+ */
+class RateLimiter
+{
+
+public:
+  RateLimiter(uint16_t burst, uint32_t refillMs);
+
+  // Takes a token for source. Returns 0 when the request may proceed,
+  // otherwise the number of milliseconds until a token becomes available.
+  uint32_t take(uint32_t source, unsigned long now);
+
+protected:
+  struct Bucket
+  {
+    uint32_t source;
+    uint16_t tokens;
+    unsigned long updated;
+    bool used;
+  };
+
+  Bucket _buckets[RATE_LIMIT_SOURCES];
+  uint16_t _burst;
+  uint32_t _refillMs;
+
+  Bucket &bucketFor(uint32_t source, unsigned long now);
+
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "Arena.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each block is preceded by its rounded size and the header offset of the block before it
+struct ArenaHeader
+{
+  uint32_t size;
+  uint32_t previous;
+};
+
+static uint32_t roundUp(size_t size)
+{
+  return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+Arena::Arena(uint8_t *buffer, size_t size)
+    : _buffer(buffer), _size(size & ~(size_t)(ARENA_ALIGN - 1)), _used(0), _newest(ARENA_NONE), _highWater(0),
+      _fallbacks(0), _pins(0), _floor(0), _heldRewind(ARENA_NONE), _heldNewest(ARENA_NONE)
+{
+}
+
+bool Arena::owns(const void *block) const
+{
+  return (const uint8_t *)block >= _buffer && (const uint8_t *)block < _buffer + _size;
+}
+
+uint32_t Arena::blockSize(const void *block) const
+{
+  return ((const ArenaHeader *)((const uint8_t *)block - sizeof(ArenaHeader)))->size;
+}
+
+void *Arena::allocate(size_t size)
+{
+  uint32_t rounded = roundUp(size ? size : 1);
+  if (size > _size || sizeof(ArenaHeader) + rounded > _size - _used)
+  {
+    _fallbacks++;
+    return malloc(size);
+  }
+  ArenaHeader *header = (ArenaHeader *)(_buffer + _used);
+  header->size = rounded;
+  header->previous = _newest;
+  _newest = _used;
+  _used += sizeof(ArenaHeader) + rounded;
+  if (_used > _highWater)
+  {
+    _highWater = _used;
+  }
+  return header + 1;
+}
+
+void *Arena::reallocate(void *block, size_t size)
+{
+  if (!block)
+  {
+    return allocate(size);
+  }
+  if (!owns(block))
+  {
+    return realloc(block, size);
+  }
+  uint32_t offset = (uint8_t *)block - _buffer - sizeof(ArenaHeader);
+  uint32_t rounded = roundUp(size ? size : 1);
+  if (offset == _newest && offset >= _floor && size <= _size && sizeof(ArenaHeader) + rounded <= _size - offset)
+  {
+    // The newest block grows or shrinks where it is
+    ((ArenaHeader *)(_buffer + offset))->size = rounded;
+    _used = offset + sizeof(ArenaHeader) + rounded;
+    if (_used > _highWater)
+    {
+      _highWater = _used;
+    }
+    return block;
+  }
+  uint32_t oldSize = blockSize(block);
+  void *moved = allocate(size);
+  if (moved)
+  {
+    memcpy(moved, block, oldSize < size ? oldSize : size);
+    deallocate(block);
+  }
+  return moved;
+}
+
+void Arena::deallocate(void *block)
+{
+  if (!block)
+  {
+    return;
+  }
+  if (!owns(block))
+  {
+    free(block);
+    return;
+  }
+  uint32_t offset = (uint8_t *)block - _buffer - sizeof(ArenaHeader);
+  if (offset == _newest && offset >= _floor)
+  {
+    _used = offset;
+    _newest = ((ArenaHeader *)(_buffer + offset))->previous;
+  }
+  // Older blocks are reclaimed by rewind()
+}
+
+ArenaMark Arena::mark(void) const
+{
+  ArenaMark mark = {_used, _newest};
+  return mark;
+}
+
+void Arena::rewind(const ArenaMark &mark)
+{
+  if (_pins > 0 && mark.used < _floor)
+  {
+    if (_heldRewind == ARENA_NONE || mark.used < _heldRewind)
+    {
+      _heldRewind = mark.used;
+      _heldNewest = mark.newest;
+    }
+    _used = _floor;
+    _newest = ARENA_NONE; // the pinned blocks must not grow or be given back
+    return;
+  }
+  if (mark.used < _used)
+  {
+    _used = mark.used;
+    _newest = mark.newest;
+  }
+}
+
+void Arena::pin(void)
+{
+  _pins++;
+  _floor = _used;
+}
+
+void Arena::unpin(void)
+{
+  if (_pins == 0 || --_pins > 0)
+  {
+    return;
+  }
+  _floor = 0;
+  if (_heldRewind != ARENA_NONE)
+  {
+    ArenaMark mark = {_heldRewind, _heldNewest};
+    _heldRewind = ARENA_NONE;
+    rewind(mark);
+  }
+}
+
+size_t Arena::capacity(void) const
+{
+  return _size;
+}
+
+size_t Arena::used(void) const
+{
+  return _used;
+}
+
+size_t Arena::highWater(void) const
+{
+  return _highWater;
+}
+
+uint32_t Arena::fallbacks(void) const
+{
+  return _fallbacks;
+}
+
+ArenaText::ArenaText(Arena &arena) : _arena(arena), _data(nullptr), _length(0), _capacity(0)
+{
+}
+
+ArenaText::~ArenaText(void)
+{
+  _arena.deallocate(_data);
+}
+
+bool ArenaText::reserve(size_t length)
+{
+  if (length < _capacity)
+  {
+    return true;
+  }
+  size_t capacity = _capacity ? _capacity * 2 : 64;
+  if (capacity < length + 1)
+  {
+    capacity = length + 1;
+  }
+  char *data = (char *)_arena.reallocate(_data, capacity);
+  if (!data)
+  {
+    return false;
+  }
+  _data = data;
+  _capacity = capacity;
+  return true;
+}
+
+void ArenaText::append(const char *text, size_t length)
+{
+  if (!reserve(_length + length))
+  {
+    return;
+  }
+  memcpy(_data + _length, text, length);
+  _length += length;
+  _data[_length] = '\0';
+}
+
+ArenaText &ArenaText::operator+=(const char *text)
+{
+  append(text, strlen(text));
+  return *this;
+}
+
+ArenaText &ArenaText::operator+=(char c)
+{
+  append(&c, 1);
+  return *this;
+}
+
+void ArenaText::appendf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  va_list again;
+  va_copy(again, args);
+  size_t room = _capacity > _length ? _capacity - _length : 0;
+  int written = vsnprintf(room ? _data + _length : nullptr, room, format, args);
+  if (written > 0 && (size_t)written >= room && reserve(_length + written))
+  {
+    vsnprintf(_data + _length, _capacity - _length, format, again);
+  }
+  if (written > 0 && _length + written < _capacity)
+  {
+    _length += written;
+  }
+  else if (_data)
+  {
+    _data[_length] = '\0'; // could not grow: drop the partial output
+  }
+  va_end(again);
+  va_end(args);
+}
+
+const char *ArenaText::c_str(void) const
+{
+  return _data ? _data : "";
+}
+
+size_t ArenaText::length(void) const
+{
+  return _length;
+}
@@ -0,0 +1,122 @@
+#ifndef Arena_h
+#define Arena_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+#define ARENA_ALIGN 8 // block alignment, also the size of a block header
+#define ARENA_NONE ((uint32_t)-1)
+
+struct ArenaMark
+{
+  uint32_t used;
+  uint32_t newest;
+};
+
+/**
+ * Bump allocator over a fixed buffer for memory that lives only as long as
+ * one request. Allocation moves a pointer; the newest block can grow or
+ * shrink in place and is given back when freed, anything else is reclaimed
+ * all at once by rewind(). Nothing here touches the heap until the buffer is
+ * full: then blocks fall back to malloc() and are counted, so the arena size
+ * can be tuned from the numbers in /api/metrics. Such heap blocks are only
+ * released by deallocate(), never by rewind(), so owners must still free what
+ * they allocate (JsonDocument and ArenaText do).
+ *
+ * pin() keeps everything allocated so far for a response that is still
+ * being sent after its handler returned: rewind() and deallocate() stop at
+ * the pinned end until the last unpin(), which then performs the rewind that
+ * was held back. Later requests allocate above the pinned part.
+ *
+ * The buffer must be aligned to ARENA_ALIGN.
+ */
+class Arena
+{
+
+public:
+  Arena(uint8_t *buffer, size_t size);
+
+  void *allocate(size_t size);
+  void *reallocate(void *block, size_t size);
+  void deallocate(void *block);
+
+  ArenaMark mark(void) const;
+  void rewind(const ArenaMark &mark);
+
+  void pin(void);
+  void unpin(void); // call outside any ArenaScope, e.g. when a response completes
+  bool owns(const void *block) const;
+
+  size_t capacity(void) const;
+  size_t used(void) const;
+  size_t highWater(void) const; // most bytes in use at once since boot
+  uint32_t fallbacks(void) const; // allocations that went to the heap
+
+protected:
+  uint8_t *_buffer;
+  uint32_t _size;
+  uint32_t _used;
+  uint32_t _newest; // header offset of the newest block, ARENA_NONE if none
+  uint32_t _highWater;
+  uint32_t _fallbacks;
+  uint16_t _pins;
+  uint32_t _floor;      // end of the pinned part, 0 when nothing is pinned
+  uint32_t _heldRewind; // lowest rewind held back by a pin, ARENA_NONE if none
+  uint32_t _heldNewest;
+
+  uint32_t blockSize(const void *block) const;
+
+};
+
+// Rewinds the arena when it goes out of scope, e.g. at the end of a handler
+class ArenaScope
+{
+
+public:
+  explicit ArenaScope(Arena &arena) : _arena(arena), _mark(arena.mark()) {}
+  ~ArenaScope(void) { _arena.rewind(_mark); }
+
+protected:
+  Arena &_arena;
+  ArenaMark _mark;
+
+};
+
+/**
+ * Growing text buffer in an arena, used in place of String concatenation.
+ * While it is the newest block it grows in place without copying.
+ */
+class ArenaText
+{
+
+public:
+  explicit ArenaText(Arena &arena);
+  ~ArenaText(void);
+
+  ArenaText &operator+=(const char *text);
+  ArenaText &operator+=(char c);
+  void append(const char *text, size_t length);
+  void appendf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#if defined(ARDUINO)
+  ArenaText &operator+=(const String &text) { append(text.c_str(), text.length()); return *this; }
+#endif
+
+  const char *c_str(void) const; // "" while empty
+  size_t length(void) const;
+
+protected:
+  Arena &_arena;
+  char *_data;
+  size_t _length;
+  size_t _capacity;
+
+  bool reserve(size_t length);
+
+};
+
+#endif
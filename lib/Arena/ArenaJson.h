@@ -0,0 +1,24 @@
+#ifndef ArenaJson_h
+#define ArenaJson_h
+
+#include <ArduinoJson.h>
+
+#include "Arena.h"
+
+// Lets a JsonDocument keep its pools and strings in an arena
+class ArenaJsonAllocator : public ArduinoJson::Allocator
+{
+
+public:
+  explicit ArenaJsonAllocator(Arena &arena) : _arena(arena) {}
+
+  void *allocate(size_t size) override { return _arena.allocate(size); }
+  void deallocate(void *block) override { _arena.deallocate(block); }
+  void *reallocate(void *block, size_t size) override { return _arena.reallocate(block, size); }
+
+protected:
+  Arena &_arena;
+
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "Backfill.h"
+
+#include <CsvRecord.h>
+#include <string.h>
+
+Backfill::Backfill(void) : _active(false), _lineLength(0)
+{
+  memset(&_progress, 0, sizeof(_progress));
+}
+
+Backfill::~Backfill(void)
+{
+}
+
+void Backfill::start(uint32_t size, uint32_t offset, unsigned long now)
+{
+  memset(&_progress, 0, sizeof(_progress));
+  _progress.size = size;
+  _progress.offset = offset < size ? offset : size;
+  _progress.startedAt = now;
+  _active = true;
+}
+
+void Backfill::stop(void)
+{
+  _active = false;
+}
+
+bool Backfill::convert(const char *line, size_t length)
+{
+  if (length == 0 || length > BACKFILL_MAX_LINE)
+  {
+    return false;
+  }
+  CsvSpan columns[OBSERVATION_COLUMN_COUNT + 1]; // one spare to catch extra columns
+  if (csvSplit(line, length, columns, OBSERVATION_COLUMN_COUNT + 1) != OBSERVATION_COLUMN_COUNT)
+  {
+    return false;
+  }
+  if (!observationFromCsv(columns, _observation) || _observation.time == 0)
+  {
+    return false;
+  }
+  _lineLength = observationToCsv(_observation, _line);
+  return true;
+}
+
+int Backfill::step(void)
+{
+  if (!_active || done())
+  {
+    return 0;
+  }
+  uint32_t left = _progress.size - _progress.offset;
+  size_t want = left < BACKFILL_BLOCK_SIZE ? left : BACKFILL_BLOCK_SIZE;
+  int got = readAt(_progress.offset, (uint8_t *)_block, want);
+  if (got <= 0)
+  {
+    return -1;
+  }
+
+  // Only whole lines are taken; the last block of the file may end without a newline
+  size_t end = got;
+  if ((uint32_t)got < left)
+  {
+    while (end > 0 && _block[end - 1] != '\n')
+    {
+      end--;
+    }
+    if (end == 0)
+    {
+      _progress.offset += got; // a block without a newline is too long to be a record
+      _progress.bytes += got;
+      _progress.rejected++;
+      return 0;
+    }
+  }
+
+  int accepted = 0;
+  size_t at = 0;
+  while (at < end)
+  {
+    const char *newline = (const char *)memchr(_block + at, '\n', end - at);
+    size_t next = newline ? newline - _block + 1 : end;
+    size_t length = next - at;
+    while (length > 0 && (_block[at + length - 1] == '\n' || _block[at + length - 1] == '\r'))
+    {
+      length--;
+    }
+    if (convert(_block + at, length))
+    {
+      if (!accept(_observation, _line, _lineLength))
+      {
+        return -1; // this line is offered again on the next step
+      }
+      _progress.records++;
+      accepted++;
+    }
+    else if (length > 0)
+    {
+      _progress.rejected++;
+    }
+    _progress.offset += next - at;
+    _progress.bytes += next - at;
+    at = next;
+  }
+  return accepted;
+}
+
+bool Backfill::active(void) const
+{
+  return _active;
+}
+
+bool Backfill::done(void) const
+{
+  return _progress.offset >= _progress.size;
+}
+
+uint32_t Backfill::bytesPerSecond(unsigned long now) const
+{
+  unsigned long elapsed = now - _progress.startedAt;
+  return elapsed == 0 ? 0 : (uint32_t)((uint64_t)_progress.bytes * 1000 / elapsed);
+}
+
+const BackfillProgress &Backfill::progress(void) const
+{
+  return _progress;
+}
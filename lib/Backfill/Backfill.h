@@ -0,0 +1,66 @@
+#ifndef Backfill_h
+#define Backfill_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <Observation.h>
+
+#define BACKFILL_BLOCK_SIZE 4096 // bytes per read, a whole number of card sectors
+#define BACKFILL_MAX_LINE 320    // longer lines are rejected; matches JOURNAL_MAX_RECORD
+
+struct BackfillProgress
+{
+  uint32_t size;     // of the file being imported
+  uint32_t offset;   // bytes consumed, always at a line boundary
+  uint32_t records;  // accepted this run
+  uint32_t rejected; // headers, damaged, overlong and wrongly sized lines
+  uint32_t bytes;    // consumed this run, for the rate
+  unsigned long startedAt;
+};
+
+/**
+ * Streams a file of stored CSV lines into a sink in large sequential reads.
+ * Each step() reads one block from the last line boundary and parses every
+ * whole line in it as an observation: a valid date, one column per field and
+ * a number or nothing in each. Good lines reach accept() re-emitted by
+ * observationToCsv(), so the sink stores exactly what live ingest would; a
+ * header or damaged line is only counted. The line
+ * cut by the end of the block is read again at the start of the next one, so
+ * no carry buffer is needed and the offset is always safe to resume from.
+ *
+ * Storage and the sink are supplied by a subclass.
+ */
+class Backfill
+{
+
+public:
+  Backfill(void);
+  virtual ~Backfill(void);
+
+  void start(uint32_t size, uint32_t offset, unsigned long now);
+  int step(void); // records accepted, -1 if the sink or the read failed
+  void stop(void);
+
+  bool active(void) const;
+  bool done(void) const; // the whole file has been consumed
+  uint32_t bytesPerSecond(unsigned long now) const;
+  const BackfillProgress &progress(void) const;
+
+protected:
+  // Storage and sink hooks
+  virtual int readAt(uint32_t offset, uint8_t *buffer, size_t size) = 0; // bytes read, -1 on failure
+  virtual bool accept(const Observation &observation, const char *line, size_t length) = 0; // false stops the step for a retry
+
+  bool _active;
+  BackfillProgress _progress;
+  char _block[BACKFILL_BLOCK_SIZE];
+  Observation _observation;
+  char _line[OBSERVATION_CSV_SIZE]; // the accepted line as re-emitted
+  size_t _lineLength;
+
+  bool convert(const char *line, size_t length);
+
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "Crc32.h"
+
+static uint32_t crcTable[256];
+static bool crcTableReady = false;
+
+static void buildCrcTable(void)
+{
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+    {
+      c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+    }
+    crcTable[i] = c;
+  }
+  crcTableReady = true;
+}
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t length)
+{
+  if (!crcTableReady)
+  {
+    buildCrcTable();
+  }
+  const uint8_t *p = (const uint8_t *)data;
+  crc = ~crc;
+  while (length--)
+  {
+    crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
@@ -0,0 +1,11 @@
+#ifndef Crc32_h
+#define Crc32_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Standard CRC-32 (IEEE 802.3, as used by zlib). Chain calls by passing the
+// previous result as crc; start with 0.
+uint32_t crc32Update(uint32_t crc, const void *data, size_t length);
+
+#endif
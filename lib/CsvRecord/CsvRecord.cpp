@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "CsvRecord.h"
+
+static bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool isDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+int csvSplit(const char *line, size_t length, CsvSpan *fields, int maxFields)
+{
+  int count = 0;
+  size_t start = 0;
+  while (count < maxFields && start <= length)
+  {
+    const char *comma = (const char *)memchr(line + start, ',', length - start);
+    size_t end = comma ? comma - line : length;
+
+    size_t first = start;
+    size_t last = end;
+    while (first < last && isSpace(line[first]))
+    {
+      first++;
+    }
+    while (last > first && isSpace(line[last - 1]))
+    {
+      last--;
+    }
+    fields[count].data = line + first;
+    fields[count].length = last - first;
+    count++;
+
+    if (!comma)
+    {
+      break;
+    }
+    start = end + 1;
+  }
+  for (int i = count; i < maxFields; i++)
+  {
+    fields[i].data = line + length;
+    fields[i].length = 0;
+  }
+  return count;
+}
+
+bool csvEquals(CsvSpan span, const char *text)
+{
+  return strlen(text) == span.length && memcmp(span.data, text, span.length) == 0;
+}
+
+bool csvIsNull(CsvSpan span)
+{
+  return span.length == 0 || csvEquals(span, "NULL") || csvEquals(span, "null");
+}
+
+bool csvIsDateTime(CsvSpan span)
+{
+  static const char pattern[] = "dddd-dd-dd dd:dd:dd";
+  if (span.length != sizeof(pattern) - 1)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < span.length; i++)
+  {
+    if (pattern[i] == 'd' ? !isDigit(span.data[i]) : span.data[i] != pattern[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// -?(0|[1-9]d*)(.d+)?([eE][+-]?d+)?
+bool csvIsNumber(CsvSpan span)
+{
+  const char *p = span.data;
+  const char *end = p + span.length;
+  if (p < end && *p == '-')
+  {
+    p++;
+  }
+  if (p == end || !isDigit(*p))
+  {
+    return false;
+  }
+  if (*p == '0')
+  {
+    p++;
+  }
+  else
+  {
+    while (p < end && isDigit(*p))
+    {
+      p++;
+    }
+  }
+  if (p < end && *p == '.')
+  {
+    p++;
+    if (p == end || !isDigit(*p))
+    {
+      return false;
+    }
+    while (p < end && isDigit(*p))
+    {
+      p++;
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    p++;
+    if (p < end && (*p == '+' || *p == '-'))
+    {
+      p++;
+    }
+    if (p == end || !isDigit(*p))
+    {
+      return false;
+    }
+    while (p < end && isDigit(*p))
+    {
+      p++;
+    }
+  }
+  return p == end;
+}
+
+bool csvParseFloat(CsvSpan span, float *value)
+{
+  const char *p = span.data;
+  const char *end = p + span.length;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+  float result = 0;
+  bool digits = false;
+  while (p < end && isDigit(*p))
+  {
+    result = result * 10 + (*p++ - '0');
+    digits = true;
+  }
+  if (p < end && *p == '.')
+  {
+    p++;
+    float scale = 0.1f;
+    while (p < end && isDigit(*p))
+    {
+      result += (*p++ - '0') * scale;
+      scale *= 0.1f;
+      digits = true;
+    }
+  }
+  if (!digits || p != end)
+  {
+    return false;
+  }
+  *value = negative ? -result : result;
+  return true;
+}
+
+bool csvParseLong(CsvSpan span, long *value)
+{
+  const char *p = span.data;
+  const char *end = p + span.length;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+  if (p == end)
+  {
+    return false;
+  }
+  long result = 0;
+  while (p < end)
+  {
+    if (!isDigit(*p))
+    {
+      return false;
+    }
+    result = result * 10 + (*p++ - '0');
+  }
+  *value = negative ? -result : result;
+  return true;
+}
+
+JsonWriter::JsonWriter(char *buffer, size_t size)
+{
+  _buffer = buffer;
+  _size = size;
+  _length = 0;
+  _overflowed = size == 0;
+  _needComma = false;
+  if (size > 0)
+  {
+    buffer[0] = '\0';
+  }
+}
+
+void JsonWriter::put(char c)
+{
+  if (_overflowed || _length + 1 >= _size)
+  {
+    _overflowed = true;
+    return;
+  }
+  _buffer[_length++] = c;
+  _buffer[_length] = '\0';
+}
+
+void JsonWriter::put(const char *text, size_t length)
+{
+  if (_overflowed || _length + length >= _size)
+  {
+    _overflowed = true;
+    return;
+  }
+  memcpy(_buffer + _length, text, length);
+  _length += length;
+  _buffer[_length] = '\0';
+}
+
+void JsonWriter::beginObject(void)
+{
+  put('{');
+  _needComma = false;
+}
+
+void JsonWriter::endObject(void)
+{
+  put('}');
+  _needComma = true;
+}
+
+void JsonWriter::key(const char *name)
+{
+  if (_needComma)
+  {
+    put(',');
+  }
+  put('"');
+  put(name, strlen(name));
+  put("\":", 2);
+  _needComma = false;
+}
+
+void JsonWriter::valueNull(void)
+{
+  put("null", 4);
+  _needComma = true;
+}
+
+void JsonWriter::valueLong(long value)
+{
+  char text[24];
+  int n = snprintf(text, sizeof(text), "%ld", value);
+  put(text, n);
+  _needComma = true;
+}
+
+void JsonWriter::valueFloat(float value, int decimals)
+{
+  char text[32];
+  int n = snprintf(text, sizeof(text), "%.*f", decimals, (double)value);
+  put(text, n);
+  _needComma = true;
+}
+
+void JsonWriter::valueRaw(CsvSpan text)
+{
+  put(text.data, text.length);
+  _needComma = true;
+}
+
+void JsonWriter::valueString(CsvSpan text)
+{
+  put('"');
+  for (size_t i = 0; i < text.length; i++)
+  {
+    char c = text.data[i];
+    if (c == '"' || c == '\\')
+    {
+      put('\\');
+      put(c);
+    }
+    else if ((uint8_t)c < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      put(escaped, 6);
+    }
+    else
+    {
+      put(c);
+    }
+  }
+  put('"');
+  _needComma = true;
+}
+
+size_t JsonWriter::length(void) const
+{
+  return _length;
+}
+
+bool JsonWriter::overflowed(void) const
+{
+  return _overflowed;
+}
@@ -0,0 +1,63 @@
+#ifndef CsvRecord_h
+#define CsvRecord_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// A field of a stored CSV line, pointing into the line itself
+struct CsvSpan
+{
+  const char *data;
+  size_t length;
+};
+
+/**
+ * Splits line at commas into up to maxFields spans, each trimmed of
+ * surrounding whitespace. Nothing is copied or allocated; the spans stay
+ * valid as long as line does. Returns the number of fields found; fields past
+ * that are set to empty spans.
+ */
+int csvSplit(const char *line, size_t length, CsvSpan *fields, int maxFields);
+
+bool csvEquals(CsvSpan span, const char *text);
+bool csvIsNull(CsvSpan span);     // empty, NULL or null
+bool csvIsDateTime(CsvSpan span); // YYYY-MM-DD HH:MM:SS, digits checked
+bool csvIsNumber(CsvSpan span);   // valid as a JSON number as written
+bool csvParseFloat(CsvSpan span, float *value); // whole span must be a decimal number
+bool csvParseLong(CsvSpan span, long *value);
+
+/**
+ * Appends JSON text to a fixed buffer. The output is always NUL terminated;
+ * once it runs out of room the writer stops and overflowed() turns true.
+ */
+class JsonWriter
+{
+
+public:
+  JsonWriter(char *buffer, size_t size);
+
+  void beginObject(void);
+  void endObject(void);
+  void key(const char *name);
+  void valueNull(void);
+  void valueLong(long value);
+  void valueFloat(float value, int decimals);
+  void valueRaw(CsvSpan text);    // must already be valid JSON
+  void valueString(CsvSpan text); // quoted and escaped
+
+  size_t length(void) const;
+  bool overflowed(void) const;
+
+protected:
+  char *_buffer;
+  size_t _size;
+  size_t _length;
+  bool _overflowed;
+  bool _needComma;
+
+  void put(char c);
+  void put(const char *text, size_t length);
+
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include <string.h>
+#include <algorithm>
+
+#include "FileIndex.h"
+
+FileIndex::FileIndex(void)
+{
+  clear();
+  _valid = false;
+}
+
+void FileIndex::clear(void)
+{
+  _count = 0;
+  _truncated = false;
+  _ordersDirty = true;
+}
+
+int FileIndex::lowerBound(const char *name) const
+{
+  int low = 0;
+  int high = _count;
+  while (low < high)
+  {
+    int mid = (low + high) / 2;
+    if (strcmp(_entries[mid].name, name) < 0)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+bool FileIndex::put(const char *name, uint32_t size, uint32_t mtime)
+{
+  if (strlen(name) >= FILE_INDEX_NAME_SIZE)
+  {
+    _truncated = true;
+    return false;
+  }
+
+  int i = lowerBound(name);
+  if (i < _count && strcmp(_entries[i].name, name) == 0)
+  {
+    if (_entries[i].size != size || _entries[i].mtime != mtime)
+    {
+      _entries[i].size = size;
+      _entries[i].mtime = mtime;
+      _ordersDirty = true;
+    }
+    return true;
+  }
+
+  if (_count >= FILE_INDEX_MAX_ENTRIES)
+  {
+    _truncated = true;
+    return false;
+  }
+
+  memmove(&_entries[i + 1], &_entries[i], (_count - i) * sizeof(FileIndexEntry));
+  strcpy(_entries[i].name, name);
+  _entries[i].size = size;
+  _entries[i].mtime = mtime;
+  _count++;
+  _ordersDirty = true;
+  return true;
+}
+
+bool FileIndex::remove(const char *name)
+{
+  int i = lowerBound(name);
+  if (i >= _count || strcmp(_entries[i].name, name) != 0)
+  {
+    return false;
+  }
+  memmove(&_entries[i], &_entries[i + 1], (_count - i - 1) * sizeof(FileIndexEntry));
+  _count--;
+  _ordersDirty = true;
+  return true;
+}
+
+const FileIndexEntry *FileIndex::find(const char *name) const
+{
+  int i = lowerBound(name);
+  if (i < _count && strcmp(_entries[i].name, name) == 0)
+  {
+    return &_entries[i];
+  }
+  return nullptr;
+}
+
+int FileIndex::count(void) const
+{
+  return _count;
+}
+
+bool FileIndex::isValid(void) const
+{
+  return _valid;
+}
+
+void FileIndex::setValid(bool valid)
+{
+  _valid = valid;
+}
+
+bool FileIndex::isTruncated(void) const
+{
+  return _truncated;
+}
+
+void FileIndex::rebuildOrders(void)
+{
+  for (int i = 0; i < _count; i++)
+  {
+    _sizeOrder[i] = i;
+    _mtimeOrder[i] = i;
+  }
+  // Stable sorts keep name order between entries with equal keys
+  std::stable_sort(_sizeOrder, _sizeOrder + _count, [this](uint8_t a, uint8_t b)
+                   { return _entries[a].size < _entries[b].size; });
+  std::stable_sort(_mtimeOrder, _mtimeOrder + _count, [this](uint8_t a, uint8_t b)
+                   { return _entries[a].mtime < _entries[b].mtime; });
+  _ordersDirty = false;
+}
+
+int FileIndex::page(FileIndexSort sort, bool descending, int offset, int limit, const FileIndexEntry **out)
+{
+  if (offset < 0 || offset >= _count || limit <= 0)
+  {
+    return 0;
+  }
+  if (sort != FILE_INDEX_SORT_NAME && _ordersDirty)
+  {
+    rebuildOrders();
+  }
+
+  int copied = 0;
+  for (int n = offset; n < _count && copied < limit; n++)
+  {
+    int position = descending ? _count - 1 - n : n;
+    int i = position;
+    if (sort == FILE_INDEX_SORT_SIZE)
+    {
+      i = _sizeOrder[position];
+    }
+    else if (sort == FILE_INDEX_SORT_MTIME)
+    {
+      i = _mtimeOrder[position];
+    }
+    out[copied++] = &_entries[i];
+  }
+  return copied;
+}
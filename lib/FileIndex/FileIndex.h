@@ -0,0 +1,66 @@
+#ifndef FileIndex_h
+#define FileIndex_h
+
+#include <inttypes.h>
+
+#define FILE_INDEX_MAX_ENTRIES 128
+#define FILE_INDEX_NAME_SIZE 64
+
+enum FileIndexSort
+{
+  FILE_INDEX_SORT_NAME,
+  FILE_INDEX_SORT_SIZE,
+  FILE_INDEX_SORT_MTIME
+};
+
+struct FileIndexEntry
+{
+  char name[FILE_INDEX_NAME_SIZE];
+  uint32_t size;
+  uint32_t mtime;
+};
+
+/**
+ * In-RAM listing of the card root. Entries are kept ordered by name; the
+ * size and mtime orders are rebuilt in RAM only after the listing changed,
+ * so serving a page never touches the card.
+ */
+class FileIndex
+{
+
+public:
+  FileIndex(void);
+
+  void clear(void);
+  bool put(const char *name, uint32_t size, uint32_t mtime); // insert or update
+  bool remove(const char *name);
+  const FileIndexEntry *find(const char *name) const;
+  int count(void) const;
+
+  // An index starts out invalid and must be rebuilt from the card before use.
+  bool isValid(void) const;
+  void setValid(bool valid);
+  // True when the card holds more files than the index can track.
+  bool isTruncated(void) const;
+
+  /**
+   * Copies pointers to up to limit entries, starting at offset in the given
+   * order, into out. Returns the number of entries copied.
+   */
+  int page(FileIndexSort sort, bool descending, int offset, int limit, const FileIndexEntry **out);
+
+protected:
+  FileIndexEntry _entries[FILE_INDEX_MAX_ENTRIES];
+  uint8_t _sizeOrder[FILE_INDEX_MAX_ENTRIES];
+  uint8_t _mtimeOrder[FILE_INDEX_MAX_ENTRIES];
+  int _count;
+  bool _valid;
+  bool _truncated;
+  bool _ordersDirty;
+
+  int lowerBound(const char *name) const;
+  void rebuildOrders(void);
+
+};
+
+#endif
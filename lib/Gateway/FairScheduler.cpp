@@ -0,0 +1,48 @@
+#include "FairScheduler.h"
+
+FairScheduler::FairScheduler(void)
+{
+  for (int i = 0; i < GATEWAY_MAX_STATIONS; i++)
+  {
+    _weights[i] = 1;
+    _credit[i] = 0;
+  }
+}
+
+void FairScheduler::setWeight(int station, uint8_t weight)
+{
+  if (station >= 0 && station < GATEWAY_MAX_STATIONS)
+  {
+    _weights[station] = weight > 0 ? weight : 1;
+  }
+}
+
+uint8_t FairScheduler::weight(int station) const
+{
+  return station >= 0 && station < GATEWAY_MAX_STATIONS ? _weights[station] : 0;
+}
+
+int FairScheduler::next(uint32_t ready)
+{
+  int32_t total = 0;
+  int best = -1;
+  for (int i = 0; i < GATEWAY_MAX_STATIONS; i++)
+  {
+    if (!(ready & (1UL << i)))
+    {
+      _credit[i] = 0;
+      continue;
+    }
+    _credit[i] += _weights[i];
+    total += _weights[i];
+    if (best < 0 || _credit[i] > _credit[best])
+    {
+      best = i;
+    }
+  }
+  if (best >= 0)
+  {
+    _credit[best] -= total;
+  }
+  return best;
+}
@@ -0,0 +1,35 @@
+#ifndef FairScheduler_h
+#define FairScheduler_h
+
+#include <inttypes.h>
+
+#include "StationMap.h"
+
+/**
+ * Picks which station uploads next, by smooth weighted round robin. On each
+ * call every station with work gains its weight in credit, the one with the
+ * most credit is picked and pays back the total weight of the stations with
+ * work. Over a run of calls each busy station is picked in proportion to its
+ * weight, and picks are interleaved rather than bunched, so a station with a
+ * long backlog delays every other station by at most its own share. Stations
+ * without work neither gain nor keep credit.
+ */
+class FairScheduler
+{
+
+public:
+  FairScheduler(void);
+
+  void setWeight(int station, uint8_t weight); // 1 by default; 0 is treated as 1
+  uint8_t weight(int station) const;
+
+  // ready has bit n set when station n has work; returns the station to serve, -1 if none
+  int next(uint32_t ready);
+
+protected:
+  uint8_t _weights[GATEWAY_MAX_STATIONS];
+  int32_t _credit[GATEWAY_MAX_STATIONS];
+
+};
+
+#endif
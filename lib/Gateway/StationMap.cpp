@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "StationMap.h"
+
+StationMap::StationMap(void)
+{
+  _count = 0;
+}
+
+void StationMap::clear(void)
+{
+  _count = 0;
+}
+
+bool StationMap::add(uint8_t match, const char *key, int32_t id)
+{
+  size_t length = key ? strlen(key) : 0;
+  if (_count >= GATEWAY_MAX_MAPPINGS || length == 0 || length >= GATEWAY_KEY_SIZE || match > STATION_MATCH_TYPE)
+  {
+    return false;
+  }
+  StationMapping &mapping = _mappings[_count++];
+  mapping.match = match;
+  memcpy(mapping.key, key, length + 1);
+  mapping.id = id;
+  return true;
+}
+
+int StationMap::count(void) const
+{
+  return _count;
+}
+
+const StationMapping &StationMap::mapping(int i) const
+{
+  return _mappings[i];
+}
+
+bool StationMap::lookup(const char *passkey, const char *stationType, uint32_t address, int32_t &id) const
+{
+  // Addresses are kept in network order, first octet in the low byte
+  char dotted[16];
+  snprintf(dotted, sizeof(dotted), "%u.%u.%u.%u", (unsigned)(address & 0xff), (unsigned)((address >> 8) & 0xff),
+           (unsigned)((address >> 16) & 0xff), (unsigned)(address >> 24));
+  const char *values[] = {passkey, dotted, stationType};
+
+  for (uint8_t match = STATION_MATCH_PASSKEY; match <= STATION_MATCH_TYPE; match++)
+  {
+    if (!values[match] || !values[match][0])
+    {
+      continue;
+    }
+    for (int i = 0; i < _count; i++)
+    {
+      if (_mappings[i].match == match && strcmp(_mappings[i].key, values[match]) == 0)
+      {
+        id = _mappings[i].id;
+        return true;
+      }
+    }
+  }
+  return false;
+}
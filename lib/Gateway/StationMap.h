@@ -0,0 +1,51 @@
+#ifndef StationMap_h
+#define StationMap_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define GATEWAY_MAX_STATIONS 8  // upload slots, the device's own station included
+#define GATEWAY_MAX_MAPPINGS 16 // a station may be matched several ways
+#define GATEWAY_KEY_SIZE 48
+
+enum StationMatch
+{
+  STATION_MATCH_PASSKEY, // the console's PASSKEY argument
+  STATION_MATCH_ADDRESS, // the source address, dotted
+  STATION_MATCH_TYPE     // the stationtype argument, e.g. a firmware version
+};
+
+struct StationMapping
+{
+  uint8_t match;
+  char key[GATEWAY_KEY_SIZE];
+  int32_t id;
+};
+
+/**
+ * Maps consoles posting to /post onto configured station IDs. A PASSKEY
+ * mapping wins over an address mapping, which wins over a stationtype
+ * mapping, so a console can be pinned precisely even when several of the same
+ * model share the access point. An empty map means gateway mode is off.
+ */
+class StationMap
+{
+
+public:
+  StationMap(void);
+
+  void clear(void);
+  bool add(uint8_t match, const char *key, int32_t id); // false when full, or the key is empty or too long
+  int count(void) const;
+  const StationMapping &mapping(int i) const;
+
+  // Station ID for a request; false when no mapping matches
+  bool lookup(const char *passkey, const char *stationType, uint32_t address, int32_t &id) const;
+
+protected:
+  StationMapping _mappings[GATEWAY_MAX_MAPPINGS];
+  int _count;
+
+};
+
+#endif
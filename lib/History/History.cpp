@@ -0,0 +1,103 @@
+#include "History.h"
+
+#include <string.h>
+
+// Drops the extra decimals, rounding half away from zero, and clamps
+static inline int16_t historyValue(int32_t value, int32_t divisor)
+{
+  int32_t rounded = (value >= 0 ? value + divisor / 2 : value - divisor / 2) / divisor;
+  if (rounded > INT16_MAX)
+  {
+    return INT16_MAX;
+  }
+  if (rounded <= HISTORY_MISSING)
+  {
+    return HISTORY_MISSING + 1;
+  }
+  return rounded;
+}
+
+struct HistoryWriter
+{
+  const Observation &observation;
+  int16_t (*columns)[HISTORY_SLOTS];
+  size_t slot;
+
+  template <int I>
+  inline void apply(void)
+  {
+    int16_t value = HISTORY_MISSING;
+    if (observation.present & (1UL << I))
+    {
+      value = historyValue(observation.values[I],
+                           fieldScale(observationFields[I].decimals - observationFields[I].historyDecimals));
+    }
+    columns[I][slot] = value;
+  }
+};
+
+History::History(void) : _newest(0)
+{
+  memset(_slotNumbers, 0, sizeof(_slotNumbers));
+}
+
+void History::add(const Observation &observation)
+{
+  if (observation.time == 0)
+  {
+    return;
+  }
+  uint32_t number = observation.time / HISTORY_INTERVAL;
+  if (number + HISTORY_SLOTS <= _newest)
+  {
+    return;
+  }
+  size_t slot = number % HISTORY_SLOTS;
+  _slotNumbers[slot] = number;
+  HistoryWriter writer = {observation, _columns, slot};
+  forEachField(writer);
+  if (number > _newest)
+  {
+    _newest = number;
+  }
+}
+
+size_t History::copyColumn(int field, uint32_t since, int16_t *out, size_t max, uint32_t *start) const
+{
+  *start = 0;
+  if (_newest == 0 || field < 0 || field >= OBSERVATION_FIELD_COUNT || max == 0)
+  {
+    return 0;
+  }
+  uint32_t first = _newest >= HISTORY_SLOTS ? _newest - HISTORY_SLOTS + 1 : 1;
+  uint32_t from = since / HISTORY_INTERVAL;
+  if (from < first)
+  {
+    from = first;
+  }
+  if (from > _newest)
+  {
+    return 0;
+  }
+  size_t count = _newest - from + 1;
+  if (count > max)
+  {
+    from = _newest - max + 1;
+    count = max;
+  }
+  *start = from * HISTORY_INTERVAL;
+
+  const int16_t *column = _columns[field];
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t number = from + i;
+    size_t slot = number % HISTORY_SLOTS;
+    out[i] = _slotNumbers[slot] == number ? column[slot] : HISTORY_MISSING;
+  }
+  return count;
+}
+
+uint32_t History::newest(void) const
+{
+  return _newest * HISTORY_INTERVAL;
+}
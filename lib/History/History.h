@@ -0,0 +1,58 @@
+#ifndef History_h
+#define History_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <Observation.h>
+
+#define HISTORY_INTERVAL 120 // seconds per slot; the newest sample in a slot wins
+#define HISTORY_SLOTS 720    // 24 hours
+#define HISTORY_MISSING INT16_MIN
+#define HISTORY_BYTES (HISTORY_SLOTS * (sizeof(uint32_t) + OBSERVATION_FIELD_COUNT * sizeof(int16_t)))
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "History columns are served as little-endian arrays straight from memory"
+#endif
+
+constexpr bool historyDecimalsValid(int i)
+{
+  return i == OBSERVATION_FIELD_COUNT ||
+         (observationFields[i].historyDecimals <= observationFields[i].decimals && historyDecimalsValid(i + 1));
+}
+
+static_assert(historyDecimalsValid(0), "a field keeps more history decimals than it stores");
+
+/**
+ * The last 24 hours of every field in fixed time slots, laid out as one
+ * contiguous int16 column per field so a column can be sent as a typed array
+ * without conversion. Values are kept with the field's historyDecimals,
+ * clamped to the int16 range; HISTORY_MISSING marks no reading. Memory use is
+ * HISTORY_BYTES, fixed at compile time.
+ */
+class History
+{
+
+public:
+  History(void);
+
+  void add(const Observation &observation); // ignored without a time or when older than the window
+
+  /**
+   * Copies the field's values from the slot holding since up to the newest
+   * slot, oldest first, one element per slot, into out. Slots without a sample
+   * hold HISTORY_MISSING. At most max elements are copied, keeping the newest.
+   * Returns the count and sets start to the time of the first element.
+   */
+  size_t copyColumn(int field, uint32_t since, int16_t *out, size_t max, uint32_t *start) const;
+
+  uint32_t newest(void) const; // start of the newest slot, 0 while empty
+
+protected:
+  uint32_t _slotNumbers[HISTORY_SLOTS]; // time / HISTORY_INTERVAL of the sample in each slot
+  int16_t _columns[OBSERVATION_FIELD_COUNT][HISTORY_SLOTS];
+  uint32_t _newest; // slot number of the newest sample
+
+};
+
+#endif
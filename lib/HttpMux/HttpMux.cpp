@@ -0,0 +1,803 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "HttpMux.h"
+
+// Owns a copy of a response body that did not fit in the output buffer and
+// that the body keeper could not hold
+class BufferStream : public HttpStream
+{
+
+public:
+  BufferStream(const char *content, size_t length) : _data((char *)malloc(length)), _length(_data ? length : 0), _offset(0)
+  {
+    if (_data)
+    {
+      memcpy(_data, content, length);
+    }
+  }
+
+  ~BufferStream(void)
+  {
+    free(_data);
+  }
+
+  size_t read(uint8_t *buffer, size_t size)
+  {
+    size_t n = _length - _offset < size ? _length - _offset : size;
+    memcpy(buffer, _data + _offset, n);
+    _offset += n;
+    return n;
+  }
+
+private:
+  char *_data;
+  size_t _length;
+  size_t _offset;
+
+};
+
+static const char *statusText(int code)
+{
+  switch (code)
+  {
+  case 100:
+    return "Continue";
+  case 200:
+    return "OK";
+  case 204:
+    return "No Content";
+  case 206:
+    return "Partial Content";
+  case 303:
+    return "See Other";
+  case 304:
+    return "Not Modified";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 408:
+    return "Request Timeout";
+  case 413:
+    return "Payload Too Large";
+  case 429:
+    return "Too Many Requests";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 500:
+    return "Internal Server Error";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "";
+  }
+}
+
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Decodes application/x-www-form-urlencoded text in place
+static char *urlDecode(char *text)
+{
+  char *out = text;
+  for (char *in = text; *in; in++)
+  {
+    if (*in == '+')
+    {
+      *out++ = ' ';
+    }
+    else if (*in == '%' && hexValue(in[1]) >= 0 && hexValue(in[2]) >= 0)
+    {
+      *out++ = (char)(hexValue(in[1]) * 16 + hexValue(in[2]));
+      in += 2;
+    }
+    else
+    {
+      *out++ = *in;
+    }
+  }
+  *out = '\0';
+  return text;
+}
+
+HttpMux::HttpMux(void)
+{
+  memset(_slots, 0, sizeof(_slots));
+  _routeCount = 0;
+  _notFound = nullptr;
+  _keeper = nullptr;
+  _nextStream = 0;
+  _current = -1;
+  _responded = false;
+  _argCount = 0;
+  _headersLength = 0;
+}
+
+HttpMux::~HttpMux(void)
+{
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    delete _slots[i].stream;
+    if (_slots[i].kept != nullptr)
+    {
+      _keeper->release(_slots[i].kept);
+    }
+  }
+}
+
+void HttpMux::on(const char *uri, Handler handler)
+{
+  on(uri, HTTP_METHOD_ANY, handler, 0);
+}
+
+void HttpMux::on(const char *uri, HttpMethod method, Handler handler, uint8_t flags)
+{
+  if (_routeCount >= HTTP_MAX_ROUTES)
+  {
+    return;
+  }
+  _routes[_routeCount].uri = uri;
+  _routes[_routeCount].method = method;
+  _routes[_routeCount].handler = handler;
+  _routes[_routeCount].flags = flags;
+  _routeCount++;
+}
+
+void HttpMux::onNotFound(Handler handler)
+{
+  _notFound = handler;
+}
+
+void HttpMux::setBodyKeeper(HttpBodyKeeper *keeper)
+{
+  _keeper = keeper;
+}
+
+void HttpMux::handleClient(void)
+{
+  acceptConnections();
+
+  bool requestPending = false;
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    if (_slots[i].state == SLOT_READING)
+    {
+      readSlot(i);
+    }
+    requestPending |= _slots[i].state == SLOT_READY || (_slots[i].state == SLOT_READING && _slots[i].received > 0);
+  }
+
+  // Priority routes are all served now; ordinary requests one per pass, since
+  // their handlers may walk the card
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    if (_slots[i].state == SLOT_READY && _slots[i].priority)
+    {
+      dispatch(i);
+    }
+  }
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    if (_slots[i].state == SLOT_READY)
+    {
+      dispatch(i);
+      break;
+    }
+  }
+
+  // Small responses go out in full, streamed bodies get a bounded slice each,
+  // shrunk to one segment while another request is still arriving
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    if (_slots[i].state == SLOT_WRITING && _slots[i].stream == nullptr)
+    {
+      pumpSlot(i, HTTP_OUT_BUFFER_SIZE);
+    }
+  }
+  size_t slice = requestPending ? HTTP_OUT_BUFFER_SIZE : HTTP_SLICE_BYTES;
+  unsigned long sliceStart = clockMillis();
+  for (int k = 0; k < HTTP_MAX_CONNECTIONS; k++)
+  {
+    int i = (_nextStream + k) % HTTP_MAX_CONNECTIONS;
+    if (_slots[i].state == SLOT_WRITING && _slots[i].stream != nullptr)
+    {
+      pumpSlot(i, slice);
+      if (clockMillis() - sliceStart >= HTTP_SLICE_MS)
+      {
+        break;
+      }
+    }
+  }
+  _nextStream = (_nextStream + 1) % HTTP_MAX_CONNECTIONS;
+
+  unsigned long now = clockMillis();
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    Slot &slot = _slots[i];
+    if ((slot.state == SLOT_READING && now - slot.lastActivity > HTTP_READ_TIMEOUT) ||
+        (slot.state == SLOT_WRITING && now - slot.lastActivity > HTTP_WRITE_TIMEOUT))
+    {
+      releaseSlot(i);
+    }
+  }
+}
+
+void HttpMux::acceptConnections(void)
+{
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    if (_slots[i].state != SLOT_FREE)
+    {
+      continue;
+    }
+    if (!acceptConnection(i))
+    {
+      return;
+    }
+    Slot &slot = _slots[i];
+    slot.state = SLOT_READING;
+    slot.received = 0;
+    slot.headLength = 0;
+    slot.bodyLength = 0;
+    slot.method = HTTP_METHOD_OTHER;
+    slot.path = "";
+    slot.query = nullptr;
+    slot.priority = 0;
+    slot.bulk = 0;
+    slot.outLength = 0;
+    slot.outSent = 0;
+    slot.stream = nullptr;
+    slot.kept = nullptr;
+    slot.lastActivity = clockMillis();
+  }
+}
+
+void HttpMux::readSlot(int i)
+{
+  Slot &slot = _slots[i];
+  size_t space = HTTP_REQUEST_BUFFER_SIZE - slot.received;
+  if (space == 0)
+  {
+    reject(i, slot.headLength == 0 ? 431 : 413);
+    return;
+  }
+
+  int n = readConnection(i, (uint8_t *)slot.request + slot.received, space);
+  if (n < 0)
+  {
+    releaseSlot(i);
+    return;
+  }
+  if (n == 0)
+  {
+    return;
+  }
+  size_t searchFrom = slot.received > 3 ? slot.received - 3 : 0;
+  slot.received += n;
+  slot.lastActivity = clockMillis();
+
+  if (slot.headLength == 0)
+  {
+    slot.request[slot.received] = '\0';
+    char *blank = strstr(slot.request + searchFrom, "\r\n\r\n");
+    if (blank == nullptr)
+    {
+      return;
+    }
+    slot.headLength = blank - slot.request + 4;
+    if (!parseHead(slot))
+    {
+      reject(i, 400);
+      return;
+    }
+    if (slot.headLength + slot.bodyLength > HTTP_REQUEST_BUFFER_SIZE)
+    {
+      reject(i, 413);
+      return;
+    }
+    const char *expect = findHeader(slot, "Expect");
+    if (expect && strncasecmp(expect, "100-continue", 12) == 0 && slot.received < slot.headLength + slot.bodyLength)
+    {
+      static const char continueLine[] = "HTTP/1.1 100 Continue\r\n\r\n";
+      writeConnection(i, (const uint8_t *)continueLine, sizeof(continueLine) - 1);
+    }
+  }
+
+  if (slot.received >= slot.headLength + slot.bodyLength)
+  {
+    slot.request[slot.headLength + slot.bodyLength] = '\0';
+    slot.state = SLOT_READY;
+  }
+}
+
+bool HttpMux::parseHead(Slot &slot)
+{
+  char *lineEnd = strstr(slot.request, "\r\n");
+  slot.headersStart = lineEnd - slot.request + 2;
+
+  // Terminate every line in place so headers can be walked as
+  // "Name: value\0\n" records up to the blank line
+  for (uint16_t p = 0; p + 1 < slot.headLength; p++)
+  {
+    if (slot.request[p] == '\r' && slot.request[p + 1] == '\n')
+    {
+      slot.request[p] = '\0';
+    }
+  }
+
+  char *target = strchr(slot.request, ' ');
+  if (target == nullptr)
+  {
+    return false;
+  }
+  *target++ = '\0';
+  char *version = strchr(target, ' ');
+  if (version == nullptr || *target != '/')
+  {
+    return false;
+  }
+  *version = '\0';
+
+  if (strcmp(slot.request, "GET") == 0)
+  {
+    slot.method = HTTP_METHOD_GET;
+  }
+  else if (strcmp(slot.request, "HEAD") == 0)
+  {
+    slot.method = HTTP_METHOD_HEAD;
+  }
+  else if (strcmp(slot.request, "POST") == 0)
+  {
+    slot.method = HTTP_METHOD_POST;
+  }
+  else
+  {
+    slot.method = HTTP_METHOD_OTHER;
+  }
+
+  char *query = strchr(target, '?');
+  if (query != nullptr)
+  {
+    *query++ = '\0';
+  }
+  slot.path = target;
+  slot.query = query;
+
+  const char *contentLength = findHeader(slot, "Content-Length");
+  slot.bodyLength = 0;
+  if (contentLength != nullptr)
+  {
+    unsigned long length = strtoul(contentLength, nullptr, 10);
+    slot.bodyLength = length > HTTP_REQUEST_BUFFER_SIZE ? HTTP_REQUEST_BUFFER_SIZE + 1 : length;
+  }
+
+  for (int r = 0; r < _routeCount; r++)
+  {
+    if (strcmp(_routes[r].uri, slot.path) == 0 && (_routes[r].flags & HTTP_ROUTE_PRIORITY))
+    {
+      slot.priority = 1;
+    }
+  }
+  return true;
+}
+
+const char *HttpMux::findHeader(const Slot &slot, const char *name) const
+{
+  size_t nameLength = strlen(name);
+  const char *p = slot.request + slot.headersStart;
+  const char *end = slot.request + slot.headLength - 2;
+  while (p < end && *p != '\0')
+  {
+    size_t lineLength = strlen(p);
+    if (lineLength > nameLength && p[nameLength] == ':' && strncasecmp(p, name, nameLength) == 0)
+    {
+      const char *value = p + nameLength + 1;
+      while (*value == ' ' || *value == '\t')
+      {
+        value++;
+      }
+      return value;
+    }
+    p += lineLength + 2;
+  }
+  return nullptr;
+}
+
+void HttpMux::reject(int i, int code)
+{
+  _current = i;
+  _responded = false;
+  _headersLength = 0;
+  const char *text = statusText(code);
+  send(code, "text/plain", text, strlen(text));
+  _current = -1;
+}
+
+void HttpMux::parseArgs(char *text)
+{
+  while (text != nullptr && *text != '\0' && _argCount < HTTP_MAX_ARGS)
+  {
+    char *next = strchr(text, '&');
+    if (next != nullptr)
+    {
+      *next++ = '\0';
+    }
+    char *value = strchr(text, '=');
+    if (value != nullptr)
+    {
+      *value++ = '\0';
+    }
+    if (*text != '\0')
+    {
+      _argNames[_argCount] = urlDecode(text);
+      _argValues[_argCount] = value != nullptr ? urlDecode(value) : "";
+      _argCount++;
+    }
+    text = next;
+  }
+}
+
+const HttpMux::Route *HttpMux::findRoute(const Slot &slot, bool *pathMatched) const
+{
+  *pathMatched = false;
+  HttpMethod method = slot.method == HTTP_METHOD_HEAD ? HTTP_METHOD_GET : slot.method;
+  for (int r = 0; r < _routeCount; r++)
+  {
+    if (strcmp(_routes[r].uri, slot.path) != 0)
+    {
+      continue;
+    }
+    *pathMatched = true;
+    if (_routes[r].method == HTTP_METHOD_ANY || _routes[r].method == method)
+    {
+      return &_routes[r];
+    }
+  }
+  return nullptr;
+}
+
+void HttpMux::dispatch(int i)
+{
+  Slot &slot = _slots[i];
+  _current = i;
+  _responded = false;
+  _headersLength = 0;
+  _argCount = 0;
+
+  if (slot.query != nullptr)
+  {
+    parseArgs(slot.query);
+  }
+  const char *contentType = findHeader(slot, "Content-Type");
+  if (slot.bodyLength > 0 && (contentType == nullptr || strncasecmp(contentType, "application/x-www-form-urlencoded", 33) == 0))
+  {
+    // Consoles may leave out the Content-Type, so a body without one is read
+    // as a form too; it is decoded in a copy so a JSON body reaches body() intact
+    memcpy(_form, slot.request + slot.headLength, slot.bodyLength);
+    _form[slot.bodyLength] = '\0';
+    parseArgs(_form);
+  }
+
+  bool pathMatched;
+  const Route *route = findRoute(slot, &pathMatched);
+  if (route != nullptr)
+  {
+    route->handler();
+  }
+  else if (pathMatched)
+  {
+    send(405, "text/plain", "Method Not Allowed");
+  }
+  else if (_notFound != nullptr)
+  {
+    _notFound();
+  }
+  else
+  {
+    send(404, "text/plain", "Not found");
+  }
+
+  if (!_responded)
+  {
+    send(500, "text/plain", "No response");
+  }
+  _current = -1;
+}
+
+HttpMethod HttpMux::method(void) const
+{
+  return _current >= 0 ? (HttpMethod)_slots[_current].method : HTTP_METHOD_OTHER;
+}
+
+const char *HttpMux::uri(void) const
+{
+  return _current >= 0 ? _slots[_current].path : "";
+}
+
+const char *HttpMux::argValue(const char *name) const
+{
+  for (int i = 0; i < _argCount; i++)
+  {
+    if (strcmp(_argNames[i], name) == 0)
+    {
+      return _argValues[i];
+    }
+  }
+  return "";
+}
+
+bool HttpMux::hasArg(const char *name) const
+{
+  for (int i = 0; i < _argCount; i++)
+  {
+    if (strcmp(_argNames[i], name) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+int HttpMux::args(void) const
+{
+  return _argCount;
+}
+
+const char *HttpMux::argName(int i) const
+{
+  return i >= 0 && i < _argCount ? _argNames[i] : "";
+}
+
+const char *HttpMux::argValue(int i) const
+{
+  return i >= 0 && i < _argCount ? _argValues[i] : "";
+}
+
+const char *HttpMux::headerValue(const char *name) const
+{
+  if (_current < 0)
+  {
+    return "";
+  }
+  const char *value = findHeader(_slots[_current], name);
+  return value != nullptr ? value : "";
+}
+
+uint32_t HttpMux::remoteIP(void) const
+{
+  return _current >= 0 ? const_cast<HttpMux *>(this)->connectionIP(_current) : 0;
+}
+
+const uint8_t *HttpMux::body(void) const
+{
+  return _current >= 0 ? (const uint8_t *)_slots[_current].request + _slots[_current].headLength : nullptr;
+}
+
+size_t HttpMux::bodyLength(void) const
+{
+  return _current >= 0 ? _slots[_current].bodyLength : 0;
+}
+
+void HttpMux::sendHeader(const char *name, const char *value)
+{
+  int n = snprintf(_headers + _headersLength, sizeof(_headers) - _headersLength, "%s: %s\r\n", name, value);
+  if (n > 0 && _headersLength + n < sizeof(_headers))
+  {
+    _headersLength += n;
+  }
+  else
+  {
+    _headers[_headersLength] = '\0'; // drop a header that does not fit rather than send half of it
+  }
+}
+
+bool HttpMux::beginResponse(int code, const char *contentType, uint32_t length)
+{
+  if (_current < 0 || _responded)
+  {
+    return false;
+  }
+  Slot &slot = _slots[_current];
+  _headers[_headersLength] = '\0';
+
+  int n;
+  if (length == HTTP_LENGTH_UNKNOWN)
+  {
+    n = snprintf((char *)slot.out, HTTP_OUT_BUFFER_SIZE, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n%sConnection: close\r\n\r\n",
+                 code, statusText(code), contentType, _headers);
+  }
+  else
+  {
+    n = snprintf((char *)slot.out, HTTP_OUT_BUFFER_SIZE, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\n%sConnection: close\r\n\r\n",
+                 code, statusText(code), contentType, (unsigned long)length, _headers);
+  }
+  if (n < 0 || n >= HTTP_OUT_BUFFER_SIZE)
+  {
+    n = snprintf((char *)slot.out, HTTP_OUT_BUFFER_SIZE, "HTTP/1.1 500 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", statusText(500));
+  }
+
+  slot.state = SLOT_WRITING;
+  slot.outLength = n;
+  slot.outSent = 0;
+  slot.lastActivity = clockMillis();
+  _responded = true;
+  _headersLength = 0;
+  return true;
+}
+
+void HttpMux::send(int code)
+{
+  send(code, "text/plain", "", 0);
+}
+
+void HttpMux::send(int code, const char *contentType, const char *content)
+{
+  send(code, contentType, content, content != nullptr ? strlen(content) : 0);
+}
+
+void HttpMux::send(int code, const char *contentType, const char *content, size_t length)
+{
+  if (!beginResponse(code, contentType, length))
+  {
+    return;
+  }
+  Slot &slot = _slots[_current];
+  if (slot.method == HTTP_METHOD_HEAD || length == 0)
+  {
+    return;
+  }
+  if (slot.outLength + length <= HTTP_OUT_BUFFER_SIZE)
+  {
+    memcpy(slot.out + slot.outLength, content, length);
+    slot.outLength += length;
+  }
+  else if (_keeper != nullptr && _keeper->keep(content))
+  {
+    slot.kept = (const uint8_t *)content;
+    slot.keptLength = length;
+    slot.keptSent = 0;
+  }
+  else
+  {
+    slot.stream = new BufferStream(content, length);
+  }
+}
+
+bool HttpMux::sendStream(int code, const char *contentType, uint32_t length, HttpStream *stream)
+{
+  if (_current < 0 || _responded)
+  {
+    delete stream;
+    return false;
+  }
+  if (activeStreams() >= HTTP_MAX_STREAMS)
+  {
+    delete stream;
+    char retryAfter[12];
+    snprintf(retryAfter, sizeof(retryAfter), "%d", HTTP_RETRY_AFTER);
+    sendHeader("Retry-After", retryAfter);
+    send(503, "text/plain", "Too many downloads in progress");
+    return false;
+  }
+
+  beginResponse(code, contentType, length);
+  Slot &slot = _slots[_current];
+  if (slot.method == HTTP_METHOD_HEAD)
+  {
+    delete stream;
+    return true;
+  }
+  slot.stream = stream;
+  slot.bulk = 1;
+  return true;
+}
+
+void HttpMux::flush(unsigned long timeout)
+{
+  if (_current < 0)
+  {
+    return;
+  }
+  unsigned long start = clockMillis();
+  while (_slots[_current].state == SLOT_WRITING && clockMillis() - start < timeout)
+  {
+    pumpSlot(_current, HTTP_SLICE_BYTES);
+  }
+}
+
+int HttpMux::activeConnections(void) const
+{
+  int count = 0;
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    count += _slots[i].state != SLOT_FREE;
+  }
+  return count;
+}
+
+int HttpMux::activeStreams(void) const
+{
+  int count = 0;
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    count += _slots[i].state == SLOT_WRITING && _slots[i].bulk;
+  }
+  return count;
+}
+
+size_t HttpMux::pumpSlot(int i, size_t budget)
+{
+  Slot &slot = _slots[i];
+  size_t sent = 0;
+  while (sent < budget)
+  {
+    if (slot.outSent == slot.outLength)
+    {
+      size_t n = 0;
+      if (slot.stream != nullptr)
+      {
+        n = slot.stream->read(slot.out, HTTP_OUT_BUFFER_SIZE);
+      }
+      else if (slot.kept != nullptr)
+      {
+        n = slot.keptLength - slot.keptSent < HTTP_OUT_BUFFER_SIZE ? slot.keptLength - slot.keptSent : HTTP_OUT_BUFFER_SIZE;
+        memcpy(slot.out, slot.kept + slot.keptSent, n);
+        slot.keptSent += n;
+      }
+      if (n == 0)
+      {
+        releaseSlot(i); // response complete
+        break;
+      }
+      slot.outLength = n;
+      slot.outSent = 0;
+    }
+    int n = writeConnection(i, slot.out + slot.outSent, slot.outLength - slot.outSent);
+    if (n < 0)
+    {
+      releaseSlot(i);
+      break;
+    }
+    if (n == 0)
+    {
+      break; // socket buffer full, continue on a later pass
+    }
+    slot.outSent += n;
+    sent += n;
+    slot.lastActivity = clockMillis();
+  }
+  return sent;
+}
+
+void HttpMux::releaseSlot(int i)
+{
+  Slot &slot = _slots[i];
+  delete slot.stream;
+  slot.stream = nullptr;
+  if (slot.kept != nullptr)
+  {
+    _keeper->release(slot.kept);
+    slot.kept = nullptr;
+  }
+  closeConnection(i);
+  slot.state = SLOT_FREE;
+}
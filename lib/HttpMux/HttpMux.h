@@ -0,0 +1,213 @@
+#ifndef HttpMux_h
+#define HttpMux_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+#define HTTP_MAX_CONNECTIONS 6
+#define HTTP_MAX_STREAMS 2 // bulk transfers in flight; the other slots stay free for ingest
+#define HTTP_MAX_ROUTES 24
+#define HTTP_MAX_ARGS 40
+#define HTTP_REQUEST_BUFFER_SIZE 2048 // request line, headers and form body
+#define HTTP_OUT_BUFFER_SIZE 2048     // whole SD sectors, so streamed file reads stay aligned
+#define HTTP_HEADER_BUFFER_SIZE 512   // extra response headers set by a handler
+#define HTTP_SLICE_BYTES (4 * HTTP_OUT_BUFFER_SIZE)
+#define HTTP_SLICE_MS 10
+#define HTTP_READ_TIMEOUT 5000
+#define HTTP_WRITE_TIMEOUT 20000
+#define HTTP_RETRY_AFTER 5 // seconds suggested to clients turned away with 503
+
+#define HTTP_LENGTH_UNKNOWN ((uint32_t)-1)
+
+enum HttpMethod
+{
+  HTTP_METHOD_ANY,
+  HTTP_METHOD_GET,
+  HTTP_METHOD_HEAD,
+  HTTP_METHOD_POST,
+  HTTP_METHOD_OTHER
+};
+
+// Route flags
+#define HTTP_ROUTE_PRIORITY 0x01 // dispatched ahead of other requests, never waits behind bulk transfers
+
+/**
+ * Source of a response body that is produced while the connection drains,
+ * e.g. a file on the SD card. The multiplexer owns the stream once it is
+ * handed over and deletes it when the response completes or the client
+ * goes away.
+ */
+class HttpStream
+{
+
+public:
+  virtual ~HttpStream(void) {}
+  // Copies up to size bytes of the body into buffer and returns how many
+  // were copied. Returning 0 ends the body.
+  virtual size_t read(uint8_t *buffer, size_t size) = 0;
+
+};
+
+/**
+ * Keeps the memory a response body is sent from valid after its handler
+ * returns, so a body larger than the output buffer is sent from where the
+ * handler built it. keep() returns false for memory it does not look after;
+ * such bodies are copied to the heap instead.
+ */
+class HttpBodyKeeper
+{
+
+public:
+  virtual ~HttpBodyKeeper(void) {}
+  virtual bool keep(const void *content) = 0;
+  virtual void release(const void *content) = 0; // the response is complete or abandoned
+
+};
+
+/**
+ * Event-driven HTTP/1.1 server that multiplexes several connections from
+ * loop(). Every connection has its own state and fixed buffers; requests are
+ * read incrementally, handlers run to completion, and response bodies are
+ * written in bounded slices so one large download cannot hold up /post.
+ *
+ * The socket layer is supplied by a subclass (WiFiHttpMux on the ESP32, a
+ * POSIX implementation for host tests).
+ */
+class HttpMux
+{
+
+public:
+  typedef void (*Handler)(void);
+
+  HttpMux(void);
+  virtual ~HttpMux(void);
+
+  void on(const char *uri, Handler handler);
+  void on(const char *uri, HttpMethod method, Handler handler, uint8_t flags = 0);
+  void onNotFound(Handler handler);
+  void setBodyKeeper(HttpBodyKeeper *keeper);
+
+  // Accepts, reads, dispatches and writes; call from every loop() pass.
+  void handleClient(void);
+
+  // Request accessors, valid while a handler runs
+  HttpMethod method(void) const;
+  const char *uri(void) const;
+  const char *argValue(const char *name) const; // "" when absent
+  bool hasArg(const char *name) const;
+  int args(void) const;
+  const char *argName(int i) const;
+  const char *argValue(int i) const;
+  const char *headerValue(const char *name) const; // "" when absent, looked up in the raw request
+  uint32_t remoteIP(void) const;
+  const uint8_t *body(void) const; // as received, never decoded
+  size_t bodyLength(void) const;
+
+  // Responses
+  void sendHeader(const char *name, const char *value);
+  void send(int code);
+  void send(int code, const char *contentType, const char *content);
+  void send(int code, const char *contentType, const char *content, size_t length);
+  // Streams a body. length may be HTTP_LENGTH_UNKNOWN, in which case the end of
+  // the body is marked by closing the connection. Returns false, after
+  // answering 503, when too many bulk transfers are in flight.
+  bool sendStream(int code, const char *contentType, uint32_t length, HttpStream *stream);
+  // Pushes the current response out before returning, e.g. ahead of a restart.
+  void flush(unsigned long timeout);
+
+  int activeConnections(void) const;
+  int activeStreams(void) const;
+
+#if defined(ARDUINO)
+  // WebServer style String overloads, so handlers read the same as before
+  String arg(const String &name) const { return String(argValue(name.c_str())); }
+  bool hasArg(const String &name) const { return hasArg(name.c_str()); }
+  String header(const String &name) const { return String(headerValue(name.c_str())); }
+  void sendHeader(const String &name, const String &value) { sendHeader(name.c_str(), value.c_str()); }
+  void send(int code, const char *contentType, const String &content) { send(code, contentType, content.c_str(), content.length()); }
+#endif
+
+protected:
+  enum SlotState
+  {
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_READY,
+    SLOT_WRITING
+  };
+
+  struct Slot
+  {
+    uint8_t state;
+    uint16_t received;
+    uint16_t headersStart; // first header line, after the request line
+    uint16_t headLength;   // 0 until the blank line after the headers arrived
+    uint16_t bodyLength;
+    HttpMethod method;
+    const char *path;
+    char *query;
+    uint8_t priority;
+    uint8_t bulk;
+    uint8_t out[HTTP_OUT_BUFFER_SIZE];
+    uint16_t outLength;
+    uint16_t outSent;
+    HttpStream *stream;
+    const uint8_t *kept; // body sent in place, held by the body keeper
+    uint32_t keptLength;
+    uint32_t keptSent;
+    unsigned long lastActivity;
+    char request[HTTP_REQUEST_BUFFER_SIZE + 1];
+  };
+
+  struct Route
+  {
+    const char *uri;
+    HttpMethod method;
+    Handler handler;
+    uint8_t flags;
+  };
+
+  // Transport hooks
+  virtual bool acceptConnection(int slot) = 0;                                 // true if a new client now occupies slot
+  virtual int readConnection(int slot, uint8_t *buffer, size_t size) = 0;      // bytes read, 0 if none yet, -1 once closed
+  virtual int writeConnection(int slot, const uint8_t *buffer, size_t size) = 0; // bytes accepted without blocking, -1 on error
+  virtual void closeConnection(int slot) = 0;
+  virtual uint32_t connectionIP(int slot) = 0;
+  virtual unsigned long clockMillis(void) = 0;
+
+  Slot _slots[HTTP_MAX_CONNECTIONS];
+  Route _routes[HTTP_MAX_ROUTES];
+  int _routeCount;
+  Handler _notFound;
+  HttpBodyKeeper *_keeper;
+  int _nextStream;
+
+  // State of the request being handled
+  int _current;
+  bool _responded;
+  const char *_argNames[HTTP_MAX_ARGS];
+  const char *_argValues[HTTP_MAX_ARGS];
+  int _argCount;
+  char _form[HTTP_REQUEST_BUFFER_SIZE + 1]; // body fields of the request being dispatched, decoded apart so body() stays raw
+  char _headers[HTTP_HEADER_BUFFER_SIZE];
+  size_t _headersLength;
+
+  void acceptConnections(void);
+  void readSlot(int i);
+  bool parseHead(Slot &slot);
+  const char *findHeader(const Slot &slot, const char *name) const;
+  void reject(int i, int code);
+  void dispatch(int i);
+  void parseArgs(char *text);
+  const Route *findRoute(const Slot &slot, bool *pathMatched) const;
+  bool beginResponse(int code, const char *contentType, uint32_t length);
+  size_t pumpSlot(int i, size_t budget);
+  void releaseSlot(int i);
+
+};
+
+#endif
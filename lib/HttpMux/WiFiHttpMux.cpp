@@ -0,0 +1,70 @@
+#if defined(ESP32)
+
+#include <errno.h>
+#include <lwip/sockets.h>
+
+#include "WiFiHttpMux.h"
+
+WiFiHttpMux::WiFiHttpMux(uint16_t port) : _server(port, HTTP_MAX_CONNECTIONS)
+{
+}
+
+void WiFiHttpMux::begin(void)
+{
+  _server.begin();
+  _server.setNoDelay(true);
+}
+
+bool WiFiHttpMux::acceptConnection(int slot)
+{
+  WiFiClient client = _server.available(); // non-blocking accept
+  if (!client)
+  {
+    return false;
+  }
+  _clients[slot] = client;
+  return true;
+}
+
+int WiFiHttpMux::readConnection(int slot, uint8_t *buffer, size_t size)
+{
+  WiFiClient &client = _clients[slot];
+  int available = client.available();
+  if (available > 0)
+  {
+    return client.read(buffer, (size_t)available < size ? available : size);
+  }
+  return client.connected() ? 0 : -1;
+}
+
+int WiFiHttpMux::writeConnection(int slot, const uint8_t *buffer, size_t size)
+{
+  int fd = _clients[slot].fd();
+  if (fd < 0)
+  {
+    return -1;
+  }
+  int n = ::send(fd, buffer, size, MSG_DONTWAIT);
+  if (n < 0)
+  {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  return n;
+}
+
+void WiFiHttpMux::closeConnection(int slot)
+{
+  _clients[slot].stop();
+}
+
+uint32_t WiFiHttpMux::connectionIP(int slot)
+{
+  return (uint32_t)_clients[slot].remoteIP();
+}
+
+unsigned long WiFiHttpMux::clockMillis(void)
+{
+  return millis();
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WiFiHttpMux_h
+#define WiFiHttpMux_h
+
+#if defined(ESP32)
+
+#include <WiFi.h>
+
+#include "HttpMux.h"
+
+// HttpMux on top of the ESP32 WiFiServer. Writes bypass WiFiClient::write(),
+// which retries until everything is sent, and go to the lwIP socket with
+// MSG_DONTWAIT so a slow client never blocks loop().
+class WiFiHttpMux : public HttpMux
+{
+
+public:
+  WiFiHttpMux(uint16_t port);
+  void begin(void);
+
+protected:
+  bool acceptConnection(int slot);
+  int readConnection(int slot, uint8_t *buffer, size_t size);
+  int writeConnection(int slot, const uint8_t *buffer, size_t size);
+  void closeConnection(int slot);
+  uint32_t connectionIP(int slot);
+  unsigned long clockMillis(void);
+
+  WiFiServer _server;
+  WiFiClient _clients[HTTP_MAX_CONNECTIONS];
+
+};
+
+#endif
+
+#endif
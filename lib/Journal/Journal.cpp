@@ -0,0 +1,657 @@
+#include <string.h>
+
+#include <Crc32.h>
+
+#include "Journal.h"
+
+static void putLE16(uint8_t *p, uint16_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static void putLE32(uint8_t *p, uint32_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+static uint16_t getLE16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t getLE32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+Journal::Journal(size_t groupBytes, unsigned long maxDelayMs) : _buffer(groupBytes, maxDelayMs)
+{
+  memset(&_state, 0, sizeof(_state));
+  memset(&_stats, 0, sizeof(_stats));
+  _nextSlot = 0;
+  _durable = 0;
+  _appendEnd = 0;
+  _headSkip = 0;
+  _nextSeq = 1;
+  memset(_peeked, 0, sizeof(_peeked));
+  _unnamed = false;
+  _removeFrom = 0;
+  _unsavedAcks = 0;
+  _firstUnsavedAck = 0;
+  memset(&_pendingMark, 0, sizeof(_pendingMark));
+  _pendingMarkSeq = 0;
+  _markPending = false;
+}
+
+Journal::~Journal(void)
+{
+}
+
+void Journal::encodeHeader(uint8_t *header, const char *record, size_t length, uint32_t seq)
+{
+  header[0] = JOURNAL_FRAME_MARKER;
+  header[1] = 0;
+  putLE16(header + 2, length);
+  putLE32(header + 4, seq);
+  uint32_t crc = crc32Update(0, header, 8);
+  crc = crc32Update(crc, record, length);
+  putLE32(header + 8, crc);
+}
+
+bool Journal::saveState(void)
+{
+  _state.magic = JOURNAL_STATE_MAGIC;
+  _state.version = JOURNAL_STATE_VERSION;
+  _state.generation++;
+  if (_markPending && (int32_t)(_state.write.seq - _pendingMarkSeq) >= 0)
+  {
+    _state.mark = _pendingMark;
+    _markPending = false;
+  }
+  _state.crc = crc32Update(0, &_state, offsetof(State, crc));
+  bool ok = writeState(_nextSlot, (const uint8_t *)&_state, sizeof(_state));
+  _nextSlot ^= 1;
+  if (ok)
+  {
+    _unsavedAcks = 0;
+    removeBehind(); // what the saved cursors have all passed
+  }
+  return ok;
+}
+
+bool Journal::loadState(void)
+{
+  bool found = false;
+  for (int slot = 0; slot < 2; slot++)
+  {
+    State candidate;
+    if (!readState(slot, (uint8_t *)&candidate, sizeof(candidate)) ||
+        candidate.magic != JOURNAL_STATE_MAGIC || candidate.version != JOURNAL_STATE_VERSION ||
+        candidate.crc != crc32Update(0, &candidate, offsetof(State, crc)))
+    {
+      continue;
+    }
+    if (!found || candidate.generation > _state.generation)
+    {
+      _state = candidate;
+      _nextSlot = slot ^ 1; // overwrite the older slot next
+      found = true;
+    }
+  }
+  return found || loadStateV3() || loadStateV2() || loadStateV1();
+}
+
+// Carries the cursors and their ids over; the mark starts empty
+bool Journal::loadStateV3(void)
+{
+  bool found = false;
+  for (int slot = 0; slot < 2; slot++)
+  {
+    StateV3 candidate;
+    if (!readState(slot, (uint8_t *)&candidate, sizeof(candidate)) ||
+        candidate.magic != JOURNAL_STATE_MAGIC || candidate.version != 3 ||
+        candidate.crc != crc32Update(0, &candidate, offsetof(StateV3, crc)))
+    {
+      continue;
+    }
+    if (!found || candidate.generation > _state.generation)
+    {
+      memset(&_state, 0, sizeof(_state));
+      _state.generation = candidate.generation;
+      _state.write = candidate.write;
+      memcpy(_state.read, candidate.read, sizeof(_state.read));
+      memcpy(_state.cursorId, candidate.cursorId, sizeof(_state.cursorId));
+      _state.cursorMask = candidate.cursorMask;
+      _nextSlot = slot ^ 1;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Carries the cursors over; they take the ids of the destinations at their
+// index in begin(), which is how version 2 assigned them
+bool Journal::loadStateV2(void)
+{
+  bool found = false;
+  for (int slot = 0; slot < 2; slot++)
+  {
+    StateV2 candidate;
+    if (!readState(slot, (uint8_t *)&candidate, sizeof(candidate)) ||
+        candidate.magic != JOURNAL_STATE_MAGIC || candidate.version != 2 ||
+        candidate.crc != crc32Update(0, &candidate, offsetof(StateV2, crc)))
+    {
+      continue;
+    }
+    if (!found || candidate.generation > _state.generation)
+    {
+      memset(&_state, 0, sizeof(_state));
+      _state.generation = candidate.generation;
+      _state.write = candidate.write;
+      memcpy(_state.read, candidate.read, sizeof(_state.read));
+      _state.cursorMask = candidate.cursorMask;
+      _nextSlot = slot ^ 1;
+      found = true;
+    }
+  }
+  _unnamed = found;
+  return found;
+}
+
+// Carries a single cursor journal over; cursor 0 keeps its place
+bool Journal::loadStateV1(void)
+{
+  bool found = false;
+  for (int slot = 0; slot < 2; slot++)
+  {
+    StateV1 candidate;
+    if (!readState(slot, (uint8_t *)&candidate, sizeof(candidate)) ||
+        candidate.magic != JOURNAL_STATE_MAGIC || candidate.version != 1 ||
+        candidate.crc != crc32Update(0, &candidate, offsetof(StateV1, crc)))
+    {
+      continue;
+    }
+    if (!found || candidate.generation > _state.generation)
+    {
+      memset(&_state, 0, sizeof(_state));
+      _state.generation = candidate.generation;
+      _state.write = candidate.write;
+      _state.read[0] = candidate.read;
+      _state.cursorMask = 1;
+      _nextSlot = slot ^ 1;
+      found = true;
+    }
+  }
+  _unnamed = found;
+  return found;
+}
+
+bool Journal::readFrame(uint32_t segment, uint32_t offset, uint32_t end, uint8_t *frame, size_t *length, uint32_t *seq)
+{
+  if (offset + JOURNAL_FRAME_HEADER > end ||
+      readSegment(segment, offset, frame, JOURNAL_FRAME_HEADER) != JOURNAL_FRAME_HEADER ||
+      frame[0] != JOURNAL_FRAME_MARKER)
+  {
+    return false;
+  }
+  size_t payload = getLE16(frame + 2);
+  if (payload > JOURNAL_MAX_RECORD || offset + JOURNAL_FRAME_HEADER + payload > end ||
+      readSegment(segment, offset + JOURNAL_FRAME_HEADER, frame + JOURNAL_FRAME_HEADER, payload) != payload)
+  {
+    return false;
+  }
+  uint32_t crc = crc32Update(0, frame, 8);
+  crc = crc32Update(crc, frame + JOURNAL_FRAME_HEADER, payload);
+  if (crc != getLE32(frame + 8))
+  {
+    return false;
+  }
+  *length = payload;
+  *seq = getLE32(frame + 4);
+  return true;
+}
+
+// Offset of the first frame at or after offset that validates and is not
+// older than seq, or end if there is none. Candidates are found by their
+// marker a block at a time, so a damaged stretch costs one read per block.
+uint32_t Journal::resync(uint32_t segment, uint32_t offset, uint32_t end, uint32_t seq)
+{
+  uint8_t block[JOURNAL_RESYNC_BLOCK];
+  uint8_t frame[JOURNAL_FRAME_HEADER + JOURNAL_MAX_RECORD];
+  while (offset + JOURNAL_FRAME_HEADER <= end)
+  {
+    size_t want = end - offset < sizeof(block) ? end - offset : sizeof(block);
+    size_t got = readSegment(segment, offset, block, want);
+    if (got == 0)
+    {
+      break;
+    }
+    for (size_t i = 0; i < got; i++)
+    {
+      size_t length;
+      uint32_t found;
+      if (block[i] == JOURNAL_FRAME_MARKER && readFrame(segment, offset + i, end, frame, &length, &found) &&
+          (int32_t)(found - seq) >= 0)
+      {
+        return offset + i;
+      }
+    }
+    offset += got;
+  }
+  return end;
+}
+
+void Journal::recover(void)
+{
+  uint8_t frame[JOURNAL_FRAME_HEADER + JOURNAL_MAX_RECORD];
+  JournalPosition pos = _state.write;
+  bool resync = false;
+
+  for (;;)
+  {
+    long size = segmentSize(pos.segment);
+    if (size < 0)
+    {
+      size = 0;
+    }
+    if ((uint32_t)size < pos.offset)
+    {
+      // The card lost data the checkpoint vouched for; validate the whole segment
+      pos.offset = 0;
+      resync = true;
+    }
+
+    while (pos.offset < (uint32_t)size)
+    {
+      size_t length;
+      uint32_t seq;
+      if (!readFrame(pos.segment, pos.offset, size, frame, &length, &seq) || (!resync && seq != pos.seq))
+      {
+        _stats.truncatedBytes += size - pos.offset;
+        truncateSegment(pos.segment, pos.offset);
+        break;
+      }
+      resync = false;
+      _stats.scannedBytes += JOURNAL_FRAME_HEADER + length;
+      pos.offset += JOURNAL_FRAME_HEADER + length;
+      pos.seq = seq + 1;
+    }
+
+    // A crash right after starting a new segment leaves one past the checkpoint
+    if (pos.offset >= (uint32_t)size && segmentSize(pos.segment + 1) >= 0)
+    {
+      pos.segment++;
+      pos.offset = 0;
+      continue;
+    }
+    break;
+  }
+
+  if (memcmp(&pos, &_state.write, sizeof(pos)) != 0)
+  {
+    _state.write = pos;
+    saveState();
+  }
+}
+
+bool Journal::begin(const uint32_t *ids, uint8_t cursors)
+{
+  memset(&_stats, 0, sizeof(_stats));
+  _unnamed = false;
+  _markPending = false;
+  if (!loadState())
+  {
+    memset(&_state, 0, sizeof(_state));
+    _state.write.segment = 1;
+    _state.write.seq = 1;
+    _state.read[0] = _state.write;
+    _state.cursorMask = 1;
+    _nextSlot = 0;
+  }
+  _removeFrom = oldestSegment();
+  recover();
+
+  if (cursors < 1)
+  {
+    cursors = 1;
+  }
+  if (cursors > JOURNAL_MAX_CURSORS)
+  {
+    cursors = JOURNAL_MAX_CURSORS;
+  }
+  State saved = _state;
+  if (_unnamed)
+  {
+    for (uint8_t c = 0; c < cursors; c++)
+    {
+      saved.cursorId[c] = ids ? ids[c] : c;
+    }
+  }
+  for (uint8_t c = 0; c < JOURNAL_MAX_CURSORS; c++)
+  {
+    JournalPosition &read = _state.read[c];
+    _state.cursorId[c] = c < cursors && ids ? ids[c] : c;
+    read = _state.write; // a new cursor starts at the checkpoint
+    for (uint8_t s = 0; c < cursors && s < JOURNAL_MAX_CURSORS; s++)
+    {
+      if ((saved.cursorMask & (1UL << s)) && saved.cursorId[s] == _state.cursorId[c])
+      {
+        read = saved.read[s];
+        break;
+      }
+    }
+    // None can be ahead of the checkpoint
+    if (read.segment > _state.write.segment ||
+        (read.segment == _state.write.segment && read.offset > _state.write.offset))
+    {
+      read = _state.write;
+    }
+    _peeked[c] = read;
+  }
+  _state.cursorMask = (1UL << cursors) - 1; // the save below removes segments only a removed destination held
+
+  _durable = _state.write.offset;
+  _appendEnd = _durable;
+  _headSkip = 0;
+  _nextSeq = _state.write.seq;
+  return saveState();
+}
+
+uint32_t Journal::oldestSegment(void) const
+{
+  uint32_t oldest = _state.write.segment;
+  for (uint8_t c = 0; c < JOURNAL_MAX_CURSORS; c++)
+  {
+    if ((_state.cursorMask & (1UL << c)) && _state.read[c].segment < oldest)
+    {
+      oldest = _state.read[c].segment;
+    }
+  }
+  return oldest;
+}
+
+// Removes the segments left behind since the last call, up to the oldest one
+// a cursor still needs
+void Journal::removeBehind(void)
+{
+  uint32_t oldest = oldestSegment();
+  for (; _removeFrom < oldest; _removeFrom++)
+  {
+    removeSegment(_removeFrom);
+  }
+}
+
+// Moves cursors other than 0 that lag too far to the oldest segment kept
+void Journal::enforceRetention(void)
+{
+  if (_state.write.segment <= JOURNAL_RETAIN_SEGMENTS)
+  {
+    return;
+  }
+  uint32_t keep = _state.write.segment - JOURNAL_RETAIN_SEGMENTS + 1;
+  for (uint8_t c = 1; c < JOURNAL_MAX_CURSORS; c++)
+  {
+    JournalPosition &read = _state.read[c];
+    if (!(_state.cursorMask & (1UL << c)) || read.segment >= keep)
+    {
+      continue;
+    }
+    JournalPosition next = {keep, 0, read.seq};
+    uint8_t frame[JOURNAL_FRAME_HEADER + JOURNAL_MAX_RECORD];
+    size_t length;
+    long size = segmentSize(keep);
+    if (size > 0 && readFrame(keep, 0, size, frame, &length, &next.seq))
+    {
+      _stats.dropped[c] += next.seq - read.seq;
+    }
+    read = next;
+    _peeked[c] = next;
+  }
+}
+
+bool Journal::append(const char *record, size_t length, unsigned long now)
+{
+  if (length > JOURNAL_MAX_RECORD)
+  {
+    return false;
+  }
+  size_t frameLength = JOURNAL_FRAME_HEADER + length;
+
+  if (_appendEnd > 0 && _appendEnd + frameLength > JOURNAL_SEGMENT_BYTES)
+  {
+    // Segments end on a record boundary: finish this one, then start the next
+    if (!commit(true, now))
+    {
+      return false;
+    }
+    _state.write.segment++;
+    _state.write.offset = 0;
+    removeSegment(_state.write.segment); // leftover from an older run
+    _durable = 0;
+    _appendEnd = 0;
+    _headSkip = 0;
+    enforceRetention();
+    saveState();
+  }
+  if (_buffer.room() < frameLength && !commit(true, now))
+  {
+    return false;
+  }
+
+  uint8_t header[JOURNAL_FRAME_HEADER];
+  encodeHeader(header, record, length, _nextSeq);
+  _buffer.append(header, sizeof(header), now);
+  _buffer.append(record, length, now);
+  _appendEnd += frameLength;
+  _nextSeq++;
+  return true;
+}
+
+bool Journal::commit(bool force, unsigned long now)
+{
+  bool markDue = _markPending && (int32_t)(_state.write.seq - _pendingMarkSeq) >= 0;
+  if (markDue || (_unsavedAcks > 0 && (force || now - _firstUnsavedAck >= JOURNAL_ACK_DELAY_MS)))
+  {
+    saveState();
+  }
+  size_t length = _buffer.pending(_durable, now, force);
+  if (length == 0)
+  {
+    return true;
+  }
+  size_t written = appendSegment(_state.write.segment, _buffer.data(), length);
+
+  // Walk the record boundaries in what was written to move the checkpoint to
+  // the last record that is now complete on the card
+  const uint8_t *data = _buffer.data();
+  size_t boundary = _headSkip;
+  size_t lastComplete = 0;
+  uint32_t completed = 0;
+  if (_headSkip > 0 && _headSkip <= written)
+  {
+    lastComplete = _headSkip;
+    completed++;
+  }
+  while (boundary + JOURNAL_FRAME_HEADER <= _buffer.buffered())
+  {
+    size_t next = boundary + JOURNAL_FRAME_HEADER + getLE16(data + boundary + 2);
+    if (next > written)
+    {
+      break;
+    }
+    boundary = next;
+    lastComplete = next;
+    completed++;
+  }
+  while (boundary < written)
+  {
+    boundary += JOURNAL_FRAME_HEADER + getLE16(data + boundary + 2); // first boundary past what was written
+  }
+
+  _buffer.consume(written);
+  _durable += written;
+  _headSkip = _buffer.buffered() > 0 ? boundary - written : 0;
+  if (completed > 0)
+  {
+    _state.write.offset = _durable - written + lastComplete;
+    _state.write.seq += completed;
+    saveState();
+  }
+  return written == length;
+}
+
+int Journal::read(JournalPosition &pos, char *buffer, size_t size)
+{
+  uint8_t frame[JOURNAL_FRAME_HEADER + JOURNAL_MAX_RECORD];
+  for (;;)
+  {
+    uint32_t end;
+    if (pos.segment == _state.write.segment)
+    {
+      end = _state.write.offset;
+    }
+    else if (pos.segment < _state.write.segment)
+    {
+      long size = segmentSize(pos.segment);
+      end = size < 0 ? 0 : size;
+    }
+    else
+    {
+      return -1;
+    }
+
+    if (pos.offset >= end)
+    {
+      if (pos.segment == _state.write.segment)
+      {
+        return -1;
+      }
+      pos.segment++;
+      pos.offset = 0;
+      continue;
+    }
+
+    size_t length;
+    uint32_t seq;
+    if (!readFrame(pos.segment, pos.offset, end, frame, &length, &seq))
+    {
+      // The length of a bad record cannot be trusted; look for the next good frame instead
+      _stats.corruptSkips++;
+      pos.offset = resync(pos.segment, pos.offset + 1, end, pos.seq);
+      continue;
+    }
+    if (length >= size)
+    {
+      _stats.corruptSkips++;
+      pos.offset += JOURNAL_FRAME_HEADER + length;
+      pos.seq = seq + 1;
+      continue;
+    }
+    memcpy(buffer, frame + JOURNAL_FRAME_HEADER, length);
+    buffer[length] = '\0';
+    pos.offset += JOURNAL_FRAME_HEADER + length;
+    pos.seq = seq + 1;
+    return length;
+  }
+}
+
+int Journal::peek(uint8_t cursor, char *buffer, size_t size)
+{
+  if (cursor >= JOURNAL_MAX_CURSORS || !(_state.cursorMask & (1UL << cursor)))
+  {
+    return -1;
+  }
+  _peeked[cursor] = _state.read[cursor];
+  return read(_peeked[cursor], buffer, size);
+}
+
+bool Journal::advance(uint8_t cursor, unsigned long now)
+{
+  if (cursor >= JOURNAL_MAX_CURSORS || !(_state.cursorMask & (1UL << cursor)))
+  {
+    return false;
+  }
+  _state.read[cursor] = _peeked[cursor];
+  if (_unsavedAcks++ == 0)
+  {
+    _firstUnsavedAck = now;
+  }
+  return _unsavedAcks < JOURNAL_ACK_BATCH || saveState();
+}
+
+void Journal::setMark(const JournalMark &mark)
+{
+  _pendingMark = mark;
+  _pendingMarkSeq = _nextSeq;
+  _markPending = true;
+}
+
+bool Journal::markPending(void) const
+{
+  return _markPending;
+}
+
+const JournalMark &Journal::mark(void) const
+{
+  return _state.mark;
+}
+
+uint8_t Journal::cursors(void) const
+{
+  uint8_t count = 0;
+  while (count < JOURNAL_MAX_CURSORS && (_state.cursorMask & (1UL << count)))
+  {
+    count++;
+  }
+  return count;
+}
+
+uint32_t Journal::pendingRecords(uint8_t cursor) const
+{
+  return cursor < JOURNAL_MAX_CURSORS ? _nextSeq - _state.read[cursor].seq : 0;
+}
+
+bool Journal::hasCommitted(uint8_t cursor) const
+{
+  return cursor < JOURNAL_MAX_CURSORS && (_state.cursorMask & (1UL << cursor)) &&
+         _state.read[cursor].seq != _state.write.seq;
+}
+
+size_t Journal::bufferedBytes(void) const
+{
+  return _buffer.buffered();
+}
+
+JournalPosition Journal::checkpoint(void) const
+{
+  return _state.write;
+}
+
+JournalPosition Journal::cursor(uint8_t cursor) const
+{
+  return _state.read[cursor < JOURNAL_MAX_CURSORS ? cursor : 0];
+}
+
+// The slowest cursor, moved to the start of its segment
+JournalPosition Journal::oldest(void) const
+{
+  JournalPosition pos = _state.read[0];
+  for (uint8_t c = 1; c < JOURNAL_MAX_CURSORS; c++)
+  {
+    if ((_state.cursorMask & (1UL << c)) && (int32_t)(_state.read[c].seq - pos.seq) < 0)
+    {
+      pos = _state.read[c];
+    }
+  }
+  pos.offset = 0;
+  return pos;
+}
+
+const JournalStats &Journal::stats(void) const
+{
+  return _stats;
+}
@@ -0,0 +1,215 @@
+#ifndef Journal_h
+#define Journal_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <WriteBehind.h>
+
+#define JOURNAL_SEGMENT_BYTES 262144UL // a new segment file is started past this size
+#define JOURNAL_MAX_RECORD 320         // payload bytes per record
+#define JOURNAL_FRAME_HEADER 12
+#define JOURNAL_FRAME_MARKER 0xa5
+#define JOURNAL_RESYNC_BLOCK 256       // bytes searched per read for the next good frame after a damaged one
+#define JOURNAL_STATE_MAGIC 0x4c4e524a // "JRNL"
+#define JOURNAL_STATE_VERSION 4        // bump whenever the state layout changes
+#define JOURNAL_MAX_CURSORS 4          // independent upload cursors, one per destination
+#define JOURNAL_RETAIN_SEGMENTS 64     // most segments a lagging cursor other than 0 can hold on the card
+#define JOURNAL_ACK_BATCH 32           // acknowledgements kept in RAM before the cursors are saved
+#define JOURNAL_ACK_DELAY_MS 30000     // longest an acknowledgement waits to be saved
+
+struct JournalPosition
+{
+  uint32_t segment;
+  uint32_t offset; // always on a record boundary
+  uint32_t seq;    // sequence number of the record at offset
+};
+
+// A caller's bookmark, saved with the checkpoint
+struct JournalMark
+{
+  uint32_t tag;   // what the value refers to, 0 for nothing
+  uint32_t value;
+};
+
+struct JournalStats
+{
+  uint32_t scannedBytes;   // validated by the last recovery
+  uint32_t truncatedBytes; // torn tail cut off by the last recovery
+  uint32_t corruptSkips;   // unreadable records skipped by readers
+  uint32_t dropped[JOURNAL_MAX_CURSORS]; // records a cursor lost to JOURNAL_RETAIN_SEGMENTS since boot
+};
+
+/**
+ * Append-only record log split over numbered segment files. Every record is
+ * framed as
+ *
+ *   marker (1) | flags (1) | length (2) | seq (4) | crc32 (4) | payload
+ *
+ * with the CRC over the first eight header bytes and the payload. Records go
+ * through a write-behind buffer and reach the card in sector aligned groups.
+ *
+ * The end of the durable log (the checkpoint) and the upload cursors are kept
+ * in a small state record written alternately to two slots, each with a
+ * generation number and a CRC, so a torn state write leaves the previous one
+ * intact. Recovery starts from the checkpoint and validates only what was
+ * appended after it, cutting off a torn record at the end.
+ *
+ * Each upload destination has its own cursor over the same records. A
+ * segment is removed once every cursor in use has passed it, so records are
+ * stored once and kept until the slowest destination has them. Cursor 0 is
+ * never hurried; any other cursor that falls JOURNAL_RETAIN_SEGMENTS segments
+ * behind is moved forward and the records it skipped are counted as dropped.
+ * Acknowledgements move the cursors in RAM; they are saved with the next
+ * state write, after JOURNAL_ACK_BATCH of them or JOURNAL_ACK_DELAY_MS at the
+ * latest, so a reset can only make a destination receive a few records again.
+ * Segments are removed only once a saved state no longer needs them.
+ *
+ * Cursors are saved under a stable id chosen by the caller (a hash of the
+ * destination), not under their index. begin() hands each requested id the
+ * position it had before, whatever its index is now; an id seen for the
+ * first time starts at the checkpoint, and the cursor of an id no longer
+ * requested is freed along with the segments only it held.
+ *
+ * A caller can keep a bookmark in the state. setMark() takes effect with the
+ * first state write whose checkpoint covers every record appended before the
+ * call, so after a reset mark() describes the records that are on the card;
+ * an importer keeps its file and offset there.
+ *
+ * Storage is supplied by a subclass (SdJournal on the ESP32).
+ */
+class Journal
+{
+
+public:
+  Journal(size_t groupBytes, unsigned long maxDelayMs);
+  virtual ~Journal(void);
+
+  // Loads the state and recovers the tail. Call once storage is mounted.
+  // Cursor i is the one saved under ids[i] (under i when ids is null); a
+  // cursor that was not in use before starts at the checkpoint.
+  bool begin(const uint32_t *ids = nullptr, uint8_t cursors = 1);
+
+  bool append(const char *record, size_t length, unsigned long now); // false if too long or the card failed
+  // Writes out what is due; force writes everything buffered.
+  bool commit(bool force, unsigned long now);
+
+  /**
+   * Reads the record at pos into buffer (NUL terminated) and moves pos past it,
+   * crossing into later segments as needed. Returns the record length, or -1
+   * once pos reaches the checkpoint. A damaged record is skipped and reading
+   * resumes at the next frame whose header and CRC check out.
+   */
+  int read(JournalPosition &pos, char *buffer, size_t size);
+
+  // Upload cursors: peek() returns the oldest record not yet acknowledged on
+  // a cursor (as read()), advance() acknowledges it. commit() saves the
+  // acknowledgements when they are due.
+  int peek(uint8_t cursor, char *buffer, size_t size);
+  bool advance(uint8_t cursor, unsigned long now);
+
+  void setMark(const JournalMark &mark);
+  bool markPending(void) const;        // set but not yet saved
+  const JournalMark &mark(void) const; // as last saved
+
+  uint8_t cursors(void) const;
+  uint32_t pendingRecords(uint8_t cursor = 0) const; // appended but not acknowledged, buffered ones included
+  bool hasCommitted(uint8_t cursor) const;         // whether peek() would find a record
+  size_t bufferedBytes(void) const;
+  JournalPosition checkpoint(void) const;
+  JournalPosition cursor(uint8_t cursor = 0) const;
+  JournalPosition oldest(void) const; // start of the oldest segment still on the card
+  const JournalStats &stats(void) const;
+
+protected:
+  struct State
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;
+    JournalPosition write; // checkpoint
+    JournalPosition read[JOURNAL_MAX_CURSORS];
+    uint32_t cursorId[JOURNAL_MAX_CURSORS];
+    uint32_t cursorMask; // cursors in use, the only ones that hold segments
+    JournalMark mark;
+    uint32_t crc;
+  };
+
+  // Layout of version 3, before the mark
+  struct StateV3
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;
+    JournalPosition write;
+    JournalPosition read[JOURNAL_MAX_CURSORS];
+    uint32_t cursorId[JOURNAL_MAX_CURSORS];
+    uint32_t cursorMask;
+    uint32_t crc;
+  };
+
+  // Layout of version 2, whose cursors were known only by their index
+  struct StateV2
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;
+    JournalPosition write;
+    JournalPosition read[JOURNAL_MAX_CURSORS];
+    uint32_t cursorMask;
+    uint32_t crc;
+  };
+
+  // Layout of version 1, which had a single cursor
+  struct StateV1
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;
+    JournalPosition write;
+    JournalPosition read;
+    uint32_t crc;
+  };
+
+  // Storage hooks
+  virtual bool readState(int slot, uint8_t *buffer, size_t size) = 0; // false if the slot is missing
+  virtual bool writeState(int slot, const uint8_t *buffer, size_t size) = 0;
+  virtual long segmentSize(uint32_t segment) = 0; // -1 if the segment does not exist
+  virtual size_t readSegment(uint32_t segment, uint32_t offset, uint8_t *buffer, size_t size) = 0;
+  virtual size_t appendSegment(uint32_t segment, const uint8_t *data, size_t length) = 0;
+  virtual bool truncateSegment(uint32_t segment, uint32_t length) = 0;
+  virtual void removeSegment(uint32_t segment) = 0;
+
+  State _state;
+  int _nextSlot;
+  WriteBehind _buffer;
+  uint32_t _durable;     // bytes of the current segment on the card, may end inside a record
+  uint32_t _appendEnd;   // logical end of the current segment, buffered bytes included
+  size_t _headSkip;      // bytes at the front of the buffer that finish a record already started on the card
+  uint32_t _nextSeq;
+  JournalPosition _peeked[JOURNAL_MAX_CURSORS];
+  JournalStats _stats;
+  bool _unnamed; // cursors loaded from a layout without ids, named by index at begin()
+  uint32_t _removeFrom;     // oldest segment that may still be on the card
+  uint32_t _unsavedAcks;    // acknowledgements since the state was last saved
+  unsigned long _firstUnsavedAck;
+  JournalMark _pendingMark;
+  uint32_t _pendingMarkSeq; // the mark is saved once the checkpoint reaches this record
+  bool _markPending;
+
+  bool saveState(void);
+  bool loadState(void);
+  bool loadStateV3(void);
+  bool loadStateV2(void);
+  bool loadStateV1(void);
+  uint32_t oldestSegment(void) const;
+  void removeBehind(void);
+  void enforceRetention(void);
+  void recover(void);
+  bool readFrame(uint32_t segment, uint32_t offset, uint32_t end, uint8_t *frame, size_t *length, uint32_t *seq);
+  uint32_t resync(uint32_t segment, uint32_t offset, uint32_t end, uint32_t seq);
+  static void encodeHeader(uint8_t *header, const char *record, size_t length, uint32_t seq);
+
+};
+
+#endif
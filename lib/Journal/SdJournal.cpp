@@ -0,0 +1,158 @@
+#if defined(ESP32)
+
+#include <unistd.h>
+
+#include "SdJournal.h"
+
+SdJournal::SdJournal(size_t groupBytes, unsigned long maxDelayMs, const char *dir) : Journal(groupBytes, maxDelayMs)
+{
+  _appendSegment = 0;
+  _readSegment = 0;
+  snprintf(_dir, sizeof(_dir), "%s", dir);
+}
+
+bool SdJournal::begin(const uint32_t *ids, uint8_t cursors)
+{
+  if (!SD.exists(_dir))
+  {
+    SD.mkdir(_dir);
+  }
+  return Journal::begin(ids, cursors);
+}
+
+String SdJournal::segmentPath(uint32_t segment) const
+{
+  char path[48];
+  snprintf(path, sizeof(path), "%s/%08lu.log", _dir, (unsigned long)segment);
+  return String(path);
+}
+
+String SdJournal::statePath(int slot) const
+{
+  char path[40];
+  snprintf(path, sizeof(path), "%s/state%d", _dir, slot);
+  return String(path);
+}
+
+void SdJournal::closeFiles(uint32_t segment)
+{
+  if (_appendFile && _appendSegment == segment)
+  {
+    _appendFile.close();
+  }
+  if (_readFile && _readSegment == segment)
+  {
+    _readFile.close();
+  }
+}
+
+bool SdJournal::readState(int slot, uint8_t *buffer, size_t size)
+{
+  File file = SD.open(statePath(slot), FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+  size_t length = file.read(buffer, size);
+  file.close();
+  return length == size;
+}
+
+// Each slot is its own file, so a torn write cannot take the other slot's sector with it
+bool SdJournal::writeState(int slot, const uint8_t *buffer, size_t size)
+{
+  File file = SD.open(statePath(slot), FILE_WRITE);
+  if (!file)
+  {
+    return false;
+  }
+  size_t length = file.write(buffer, size);
+  file.close();
+  return length == size;
+}
+
+long SdJournal::segmentSize(uint32_t segment)
+{
+  if (_appendFile && _appendSegment == segment)
+  {
+    return _appendFile.size();
+  }
+  String path = segmentPath(segment);
+  if (!SD.exists(path))
+  {
+    return -1;
+  }
+  File file = SD.open(path, FILE_READ);
+  if (!file)
+  {
+    return -1;
+  }
+  long size = file.size();
+  file.close();
+  return size;
+}
+
+size_t SdJournal::readSegment(uint32_t segment, uint32_t offset, uint8_t *buffer, size_t size)
+{
+  if (!_readFile || _readSegment != segment)
+  {
+    if (_readFile)
+    {
+      _readFile.close();
+    }
+    _readFile = SD.open(segmentPath(segment), FILE_READ);
+    _readSegment = segment;
+    if (!_readFile)
+    {
+      return 0;
+    }
+  }
+  if (_readFile.position() != offset && !_readFile.seek(offset))
+  {
+    return 0;
+  }
+  return _readFile.read(buffer, size);
+}
+
+size_t SdJournal::appendSegment(uint32_t segment, const uint8_t *data, size_t length)
+{
+  if (!_appendFile || _appendSegment != segment)
+  {
+    if (_appendFile)
+    {
+      _appendFile.close();
+    }
+    _appendFile = SD.open(segmentPath(segment), FILE_APPEND);
+    _appendSegment = segment;
+    if (!_appendFile)
+    {
+      return 0;
+    }
+  }
+  size_t written = _appendFile.write(data, length);
+  _appendFile.flush(); // one directory update per group
+  if (_readFile && _readSegment == segment)
+  {
+    _readFile.close(); // an open reader does not see the new size
+  }
+  return written;
+}
+
+bool SdJournal::truncateSegment(uint32_t segment, uint32_t length)
+{
+  closeFiles(segment);
+  String path = String(SD_JOURNAL_MOUNT) + segmentPath(segment);
+  return truncate(path.c_str(), length) == 0;
+}
+
+void SdJournal::removeSegment(uint32_t segment)
+{
+  closeFiles(segment);
+  String path = segmentPath(segment);
+  if (SD.exists(path))
+  {
+    SD.remove(path);
+  }
+}
+
+#endif
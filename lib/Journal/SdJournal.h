@@ -0,0 +1,46 @@
+#ifndef SdJournal_h
+#define SdJournal_h
+
+#if defined(ESP32)
+
+#include <SD.h>
+
+#include "Journal.h"
+
+#define SD_JOURNAL_DIR "/journal"
+#define SD_JOURNAL_MOUNT "/sd" // SD.begin() default, needed for POSIX truncate()
+
+// Journal stored in a directory (SD_JOURNAL_DIR unless given) as numbered
+// segment files plus the two state slots. The current segment stays open for
+// appending, so each instance holds up to two open files.
+class SdJournal : public Journal
+{
+
+public:
+  SdJournal(size_t groupBytes, unsigned long maxDelayMs, const char *dir = SD_JOURNAL_DIR);
+  bool begin(const uint32_t *ids = nullptr, uint8_t cursors = 1);
+
+protected:
+  bool readState(int slot, uint8_t *buffer, size_t size);
+  bool writeState(int slot, const uint8_t *buffer, size_t size);
+  long segmentSize(uint32_t segment);
+  size_t readSegment(uint32_t segment, uint32_t offset, uint8_t *buffer, size_t size);
+  size_t appendSegment(uint32_t segment, const uint8_t *data, size_t length);
+  bool truncateSegment(uint32_t segment, uint32_t length);
+  void removeSegment(uint32_t segment);
+
+  File _appendFile;
+  uint32_t _appendSegment;
+  File _readFile;
+  uint32_t _readSegment;
+  char _dir[24];
+
+  String segmentPath(uint32_t segment) const;
+  String statePath(int slot) const;
+  void closeFiles(uint32_t segment);
+
+};
+
+#endif
+
+#endif
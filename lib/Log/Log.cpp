@@ -0,0 +1,349 @@
+#include "Log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Record layout: length (2) | level (1) | argument count (1) | time (4) | format pointer
+#define LOG_RECORD_HEADER (8 + sizeof(const char *))
+
+Logger logger;
+
+LogArg::LogArg(const char *v) : type(LOG_ARG_STRING), u(0), s(v ? v : "(null)")
+{
+  length = strlen(s);
+}
+
+Logger::Logger(void)
+    : _head(0), _tail(0), _used(0), _firstSeq(0), _nextSeq(0), _level(LOG_LEVEL_INFO), _clock(nullptr)
+{
+}
+
+void Logger::begin(Clock clock)
+{
+  _clock = clock;
+}
+
+void Logger::setLevel(uint8_t level)
+{
+  _level = level > LOG_LEVEL_DEBUG ? LOG_LEVEL_DEBUG : level;
+}
+
+uint8_t Logger::level(void) const
+{
+  return _level;
+}
+
+void Logger::put(uint32_t &at, const void *data, size_t length)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < length; i++)
+  {
+    _ring[at] = bytes[i];
+    at = (at + 1) % LOG_RING_SIZE;
+  }
+}
+
+void Logger::get(uint32_t at, void *data, size_t length) const
+{
+  uint8_t *bytes = (uint8_t *)data;
+  for (size_t i = 0; i < length; i++)
+  {
+    bytes[i] = _ring[(at + i) % LOG_RING_SIZE];
+  }
+}
+
+uint16_t Logger::recordLength(uint32_t at) const
+{
+  uint16_t length;
+  get(at, &length, sizeof(length));
+  return length;
+}
+
+void Logger::record(uint8_t level, const char *format, const LogArg *args, size_t count)
+{
+  if (count > LOG_MAX_ARGS)
+  {
+    count = LOG_MAX_ARGS;
+  }
+  size_t length = LOG_RECORD_HEADER;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (args[i].type == LogArg::LOG_ARG_STRING)
+    {
+      length += 2 + (args[i].length > LOG_MAX_STRING ? LOG_MAX_STRING : args[i].length);
+    }
+    else
+    {
+      length += 5;
+    }
+  }
+
+  // Overwrite the oldest records until the new one fits
+  while (LOG_RING_SIZE - _used < length)
+  {
+    uint16_t oldest = recordLength(_tail);
+    _tail = (_tail + oldest) % LOG_RING_SIZE;
+    _used -= oldest;
+    _firstSeq++;
+  }
+
+  uint16_t recordLength = length;
+  uint8_t argCount = count;
+  uint32_t time = _clock ? _clock() : 0;
+  uint32_t at = _head;
+  put(at, &recordLength, sizeof(recordLength));
+  put(at, &level, 1);
+  put(at, &argCount, 1);
+  put(at, &time, sizeof(time));
+  put(at, &format, sizeof(format));
+  for (size_t i = 0; i < count; i++)
+  {
+    put(at, &args[i].type, 1);
+    if (args[i].type == LogArg::LOG_ARG_STRING)
+    {
+      uint8_t stringLength = args[i].length > LOG_MAX_STRING ? LOG_MAX_STRING : args[i].length;
+      put(at, &stringLength, 1);
+      put(at, args[i].s, stringLength);
+    }
+    else
+    {
+      put(at, &args[i].u, 4);
+    }
+  }
+  _head = at;
+  _used += length;
+  _nextSeq++;
+}
+
+LogCursor Logger::oldest(void) const
+{
+  LogCursor cursor = {_firstSeq, _tail};
+  return cursor;
+}
+
+LogCursor Logger::end(void) const
+{
+  LogCursor cursor = {_nextSeq, _head};
+  return cursor;
+}
+
+uint32_t Logger::written(void) const
+{
+  return _nextSeq;
+}
+
+uint32_t Logger::overwritten(void) const
+{
+  return _firstSeq;
+}
+
+// Appends to line, keeping n at most size - 1 when the output is cut
+static void appendFormat(char *line, size_t size, size_t &n, const char *format, ...)
+{
+  if (n + 1 >= size)
+  {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(line + n, size - n, format, args);
+  va_end(args);
+  if (written > 0)
+  {
+    n += (size_t)written < size - n ? (size_t)written : size - n - 1;
+  }
+}
+
+int Logger::read(LogCursor &cursor, char *line, size_t size) const
+{
+  if (size == 0)
+  {
+    return -1;
+  }
+  size_t n = 0;
+  line[0] = '\0';
+  if ((int32_t)(cursor.seq - _firstSeq) < 0)
+  {
+    appendFormat(line, size, n, "-- %lu log records overwritten --", (unsigned long)(_firstSeq - cursor.seq));
+    cursor = oldest();
+    return n;
+  }
+  if ((int32_t)(cursor.seq - _nextSeq) >= 0)
+  {
+    return -1;
+  }
+
+  uint32_t at = cursor.offset;
+  uint16_t length = recordLength(at);
+  uint8_t level;
+  uint8_t argCount;
+  uint32_t time;
+  const char *format;
+  get(at + 2, &level, 1);
+  get(at + 3, &argCount, 1);
+  get(at + 4, &time, sizeof(time));
+  get(at + 8, &format, sizeof(format));
+  cursor.seq++;
+  cursor.offset = (at + length) % LOG_RING_SIZE;
+  at += LOG_RECORD_HEADER;
+
+  time_t t = time;
+  struct tm parts;
+  gmtime_r(&t, &parts);
+  appendFormat(line, size, n, "%04d-%02d-%02d %02d:%02d:%02d %c ", parts.tm_year + 1900, parts.tm_mon + 1,
+               parts.tm_mday, parts.tm_hour, parts.tm_min, parts.tm_sec, "-EWID"[level <= LOG_LEVEL_DEBUG ? level : 0]);
+
+  char text[LOG_MAX_STRING + 1];
+  const char *p = format;
+  while (*p && n + 1 < size)
+  {
+    if (*p != '%')
+    {
+      const char *run = p;
+      while (*p && *p != '%')
+      {
+        p++;
+      }
+      size_t copy = p - run < (ptrdiff_t)(size - 1 - n) ? p - run : size - 1 - n;
+      memcpy(line + n, run, copy);
+      n += copy;
+      line[n] = '\0';
+      continue;
+    }
+    if (p[1] == '%')
+    {
+      appendFormat(line, size, n, "%%");
+      p += 2;
+      continue;
+    }
+
+    // Keep flags, width and precision; the length modifier follows the stored type
+    char spec[24];
+    size_t k = 0;
+    spec[k++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p))
+    {
+      if (k < sizeof(spec) - 4)
+      {
+        spec[k++] = *p;
+      }
+      p++;
+    }
+    while (*p && strchr("hlLqjzt", *p))
+    {
+      p++;
+    }
+    char conversion = *p;
+    if (!conversion)
+    {
+      break;
+    }
+    p++;
+    if (argCount == 0)
+    {
+      continue; // more conversions than arguments
+    }
+    argCount--;
+
+    uint8_t type;
+    get(at, &type, 1);
+    at += 1;
+    LogArg value;
+    value.type = type;
+    if (type == LogArg::LOG_ARG_STRING)
+    {
+      uint8_t stringLength;
+      get(at, &stringLength, 1);
+      get(at + 1, text, stringLength);
+      text[stringLength] = '\0';
+      at += 1 + stringLength;
+    }
+    else
+    {
+      get(at, &value.u, 4);
+      at += 4;
+    }
+
+    switch (conversion)
+    {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'p':
+    {
+      if (conversion == 'p')
+      {
+        conversion = 'x';
+      }
+      spec[k++] = 'l';
+      spec[k++] = conversion;
+      spec[k] = '\0';
+      bool isSigned = conversion == 'd' || conversion == 'i';
+      long number = type == LogArg::LOG_ARG_FLOAT ? (long)value.f
+                    : type == LogArg::LOG_ARG_STRING ? atol(text)
+                    : type == LogArg::LOG_ARG_INT ? (long)value.i
+                                                   : (long)value.u;
+      if (isSigned)
+      {
+        appendFormat(line, size, n, spec, number);
+      }
+      else
+      {
+        appendFormat(line, size, n, spec, type == LogArg::LOG_ARG_INT ? (unsigned long)(uint32_t)value.i : (unsigned long)number);
+      }
+      break;
+    }
+    case 'c':
+      spec[k++] = 'c';
+      spec[k] = '\0';
+      appendFormat(line, size, n, spec, type == LogArg::LOG_ARG_STRING ? text[0] : (int)value.i);
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    {
+      spec[k++] = conversion;
+      spec[k] = '\0';
+      double number = type == LogArg::LOG_ARG_FLOAT ? value.f
+                      : type == LogArg::LOG_ARG_STRING ? atof(text)
+                      : type == LogArg::LOG_ARG_INT ? (double)value.i
+                                                     : (double)value.u;
+      appendFormat(line, size, n, spec, number);
+      break;
+    }
+    default:
+      // %s, or anything unknown: print the argument in its natural form
+      if (type == LogArg::LOG_ARG_INT)
+      {
+        snprintf(text, sizeof(text), "%ld", (long)value.i);
+      }
+      else if (type == LogArg::LOG_ARG_UINT)
+      {
+        snprintf(text, sizeof(text), "%lu", (unsigned long)value.u);
+      }
+      else if (type == LogArg::LOG_ARG_FLOAT)
+      {
+        snprintf(text, sizeof(text), "%g", value.f);
+      }
+      else if (type == LogArg::LOG_ARG_IP)
+      {
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", (unsigned)(value.u & 0xff), (unsigned)((value.u >> 8) & 0xff),
+                 (unsigned)((value.u >> 16) & 0xff), (unsigned)(value.u >> 24));
+      }
+      spec[k++] = 's';
+      spec[k] = '\0';
+      appendFormat(line, size, n, spec, text);
+      break;
+    }
+  }
+  return n;
+}
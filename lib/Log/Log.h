@@ -0,0 +1,158 @@
+#ifndef Log_h
+#define Log_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#include <IPAddress.h>
+#endif
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Calls above this level are removed by the compiler, arguments included
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SIZE 4096 // bytes of packed records kept in RAM
+#define LOG_MAX_ARGS 8     // further arguments are dropped
+#define LOG_MAX_STRING 160 // longer string arguments are cut
+#define LOG_LINE_SIZE 320  // one formatted line, NUL included
+
+// The runtime level is checked before any argument is evaluated
+#define LOG_AT(level, ...)                                       \
+  do                                                             \
+  {                                                              \
+    if ((level) <= LOG_COMPILE_LEVEL && logger.enabled(level))   \
+    {                                                            \
+      logger.log((level), __VA_ARGS__);                          \
+    }                                                            \
+  } while (0)
+
+#define LOGE(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOGW(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOGI(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOGD(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/**
+ * One captured argument. Numbers are kept by value and strings by pointer
+ * until the record is packed into the ring, which copies them.
+ */
+struct LogArg
+{
+  enum Type
+  {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_FLOAT,
+    LOG_ARG_STRING,
+    LOG_ARG_IP
+  };
+
+  uint8_t type;
+  union
+  {
+    int32_t i;
+    uint32_t u;
+    float f;
+  };
+  const char *s;
+  size_t length;
+
+  LogArg(void) : type(LOG_ARG_INT), i(0), s(nullptr), length(0) {}
+  LogArg(bool v) : type(LOG_ARG_INT), i(v), s(nullptr), length(0) {}
+  LogArg(char v) : type(LOG_ARG_INT), i(v), s(nullptr), length(0) {}
+  LogArg(int v) : type(LOG_ARG_INT), i(v), s(nullptr), length(0) {}
+  LogArg(long v) : type(LOG_ARG_INT), i((int32_t)v), s(nullptr), length(0) {}
+  LogArg(long long v) : type(LOG_ARG_INT), i((int32_t)v), s(nullptr), length(0) {}
+  LogArg(unsigned int v) : type(LOG_ARG_UINT), u(v), s(nullptr), length(0) {}
+  LogArg(unsigned long v) : type(LOG_ARG_UINT), u((uint32_t)v), s(nullptr), length(0) {}
+  LogArg(unsigned long long v) : type(LOG_ARG_UINT), u((uint32_t)v), s(nullptr), length(0) {}
+  LogArg(float v) : type(LOG_ARG_FLOAT), f(v), s(nullptr), length(0) {}
+  LogArg(double v) : type(LOG_ARG_FLOAT), f((float)v), s(nullptr), length(0) {}
+  LogArg(const char *v);
+#if defined(ARDUINO)
+  LogArg(const String &v) : type(LOG_ARG_STRING), u(0), s(v.c_str()), length(v.length()) {}
+  LogArg(const IPAddress &v) : type(LOG_ARG_IP), u((uint32_t)v), s(nullptr), length(0) {}
+#endif
+};
+
+// Position of a reader in the ring; starts from Logger::oldest()
+struct LogCursor
+{
+  uint32_t seq;
+  uint32_t offset;
+};
+
+/**
+ * Structured log kept as packed binary records in a fixed ring: level,
+ * timestamp, the address of the format string and the raw arguments. Nothing
+ * is formatted when a message is logged; readers (the serial port, /serial,
+ * the log file) format records as they consume them, each with its own
+ * cursor. When the ring is full the oldest records are overwritten and a
+ * reader that falls behind gets one line saying how many it missed.
+ *
+ * Format strings must be literals, since only their address is stored. The
+ * usual printf conversions are understood; each argument is printed with the
+ * conversion it is given, whatever its C type was.
+ */
+class Logger
+{
+
+public:
+  typedef uint32_t (*Clock)(void); // seconds, local time
+
+  Logger(void);
+
+  void begin(Clock clock);
+  void setLevel(uint8_t level);
+  uint8_t level(void) const;
+  bool enabled(uint8_t level) const { return level <= _level; }
+
+  template <typename... Args>
+  void log(uint8_t level, const char *format, const Args &...args)
+  {
+    const LogArg packed[sizeof...(Args) + 1] = {LogArg(args)...};
+    record(level, format, packed, sizeof...(Args));
+  }
+
+  void record(uint8_t level, const char *format, const LogArg *args, size_t count);
+
+  LogCursor oldest(void) const;
+  LogCursor end(void) const; // one past the newest record
+  /**
+   * Formats the record at cursor into line (NUL terminated, no newline) and
+   * moves cursor past it. Returns the line length, or -1 once cursor reaches
+   * the end. A cursor whose record was overwritten is moved to the oldest one
+   * and gets a line saying how many records were missed.
+   */
+  int read(LogCursor &cursor, char *line, size_t size) const;
+
+  uint32_t written(void) const;     // records logged since boot
+  uint32_t overwritten(void) const; // records dropped to make room
+
+protected:
+  uint8_t _ring[LOG_RING_SIZE];
+  uint32_t _head; // next byte to write
+  uint32_t _tail; // first byte of the oldest record
+  uint32_t _used;
+  uint32_t _firstSeq;
+  uint32_t _nextSeq;
+  uint8_t _level;
+  Clock _clock;
+
+  void put(uint32_t &at, const void *data, size_t length);
+  void get(uint32_t at, void *data, size_t length) const;
+  uint16_t recordLength(uint32_t at) const;
+
+};
+
+extern Logger logger;
+
+#endif
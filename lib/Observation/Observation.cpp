@@ -0,0 +1,123 @@
+#include "Observation.h"
+
+size_t formatFixed(char *out, int32_t value, uint8_t decimals)
+{
+  char digits[12];
+  size_t count = 0;
+  uint32_t magnitude = value < 0 ? -(uint32_t)value : value;
+  do
+  {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0 || count <= decimals);
+
+  size_t length = 0;
+  if (value < 0)
+  {
+    out[length++] = '-';
+  }
+  while (count > 0)
+  {
+    if (count == decimals)
+    {
+      out[length++] = '.';
+    }
+    out[length++] = digits[--count];
+  }
+  return length;
+}
+
+// Civil date from days since 1970-01-01 (H. Hinnant's algorithm)
+void formatDateTime(char *out, uint32_t time)
+{
+  uint32_t days = time / 86400;
+  uint32_t seconds = time % 86400;
+
+  int32_t z = days + 719468;
+  int32_t era = z / 146097;
+  uint32_t doe = z - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+  uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+  uint32_t year = yoe + era * 400 + (month <= 2);
+
+  uint32_t parts[6] = {year, month, day, seconds / 3600, seconds / 60 % 60, seconds % 60};
+  static const char separators[] = "-- ::";
+  size_t length = 0;
+  for (int i = 0; i < 6; i++)
+  {
+    if (i > 0)
+    {
+      out[length++] = separators[i - 1];
+    }
+    uint32_t width = i == 0 ? 4 : 2;
+    for (uint32_t w = width; w > 0; w--)
+    {
+      out[length + w - 1] = '0' + parts[i] % 10;
+      parts[i] /= 10;
+    }
+    length += width;
+  }
+  out[length] = '\0';
+}
+
+static uint32_t digitsAt(const char *text, int count)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++)
+  {
+    value = value * 10 + (text[i] - '0');
+  }
+  return value;
+}
+
+// Seconds since 1970 from a civil date and time, the inverse of the above
+bool parseDateTime(CsvSpan span, uint32_t *time)
+{
+  if (!csvIsDateTime(span))
+  {
+    return false;
+  }
+  const char *text = span.data;
+  uint32_t year = digitsAt(text, 4);
+  uint32_t month = digitsAt(text + 5, 2);
+  uint32_t day = digitsAt(text + 8, 2);
+  uint32_t hour = digitsAt(text + 11, 2);
+  uint32_t minute = digitsAt(text + 14, 2);
+  uint32_t second = digitsAt(text + 17, 2);
+
+  static const uint8_t monthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+  if (year < 1970 || year > 2106 || month < 1 || month > 12 || day < 1 || day > monthDays[month - 1] ||
+      (month == 2 && day == 29 && !leap) || hour > 23 || minute > 59 || second > 59)
+  {
+    return false;
+  }
+
+  year -= month <= 2;
+  uint32_t era = year / 400;
+  uint32_t yoe = year - era * 400;
+  uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  uint64_t seconds = ((uint64_t)(era * 146097 + doe) - 719468) * 86400 + hour * 3600 + minute * 60 + second;
+  if (seconds > UINT32_MAX)
+  {
+    return false;
+  }
+  *time = (uint32_t)seconds;
+  return true;
+}
+
+int observationFieldIndex(const char *key)
+{
+  for (int i = 0; i < OBSERVATION_FIELD_COUNT; i++)
+  {
+    if (strcmp(observationFields[i].key, key) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
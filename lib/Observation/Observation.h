@@ -0,0 +1,311 @@
+#ifndef Observation_h
+#define Observation_h
+
+#include <inttypes.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <CsvRecord.h>
+
+typedef float (*FieldConvert)(float);
+
+inline float asSent(float value)
+{
+  return value;
+}
+
+inline float fahrenheitToCelsius(float value)
+{
+  return (5.0f / 9.0f) * (value - 32.0f);
+}
+
+inline float mphToKmh(float value)
+{
+  return value * 1.60934f;
+}
+
+struct FieldDescriptor
+{
+  const char *arg;         // argument posted by the console
+  const char *key;         // CSV header and upload JSON key
+  FieldConvert convert;    // console unit to stored unit
+  uint8_t decimals;        // stored as a fixed-point integer with this many decimals
+  uint8_t historyDecimals; // decimals kept in the 16-bit history, at most decimals
+};
+
+/**
+ * The observation fields, in CSV column order after the date. Ingest,
+ * storage, CSV and JSON are all generated from this table; adding a sensor is
+ * one line here.
+ */
+constexpr FieldDescriptor observationFields[] = {
+    {"windspeedmph", "windspeedkmh", mphToKmh, 2, 2},
+    {"winddir", "winddir", asSent, 0, 0},
+    {"rainratein", "rain_rate", asSent, 3, 3},
+    {"tempinf", "temp_in", fahrenheitToCelsius, 2, 2},
+    {"tempf", "temp_out", fahrenheitToCelsius, 2, 2},
+    {"humidityin", "hum_in", asSent, 0, 0},
+    {"humidity", "hum_out", asSent, 0, 0},
+    {"uv", "uv", asSent, 0, 0},
+    {"windgustmph", "wind_gust", mphToKmh, 2, 2},
+    {"baromrelin", "air_press_rel", asSent, 3, 3},
+    {"baromabsin", "air_press_abs", asSent, 3, 3},
+    {"solarradiation", "solar_radiation", asSent, 2, 1},
+    {"dailyrainin", "dailyrainin", asSent, 3, 3},
+    {"raintodayin", "raintodayin", asSent, 3, 3},
+    {"totalrainin", "totalrainin", asSent, 3, 2},
+    {"weeklyrainin", "weeklyrainin", asSent, 3, 2},
+    {"monthlyrainin", "monthlyrainin", asSent, 3, 2},
+    {"yearlyrainin", "yearlyrainin", asSent, 3, 2},
+    {"maxdailygust", "maxdailygust", asSent, 2, 2},
+    {"wh65batt", "wh65batt", asSent, 0, 0},
+};
+
+#define OBSERVATION_FIELD_COUNT ((int)(sizeof(observationFields) / sizeof(observationFields[0])))
+#define OBSERVATION_COLUMN_COUNT (OBSERVATION_FIELD_COUNT + 1) // date first
+#define OBSERVATION_DATE_KEY "date"
+
+static_assert(OBSERVATION_FIELD_COUNT <= 32, "Observation::present has one bit per field");
+
+constexpr int32_t fieldScale(uint8_t decimals)
+{
+  return decimals == 0 ? 1 : 10 * fieldScale(decimals - 1);
+}
+
+// One sample, packed: every reading as a scaled integer
+struct Observation
+{
+  uint32_t time;    // local time in seconds since 1970, 0 if the console sent no usable date
+  uint32_t present; // bit i set when values[i] holds a reading
+  int32_t values[OBSERVATION_FIELD_COUNT];
+};
+
+// Writes value / 10^decimals without going through floating point; returns the length
+size_t formatFixed(char *out, int32_t value, uint8_t decimals);
+// "YYYY-MM-DD HH:MM:SS", 19 characters plus the terminator
+void formatDateTime(char *out, uint32_t time);
+// The inverse of formatDateTime(); false unless every part is in range
+bool parseDateTime(CsvSpan span, uint32_t *time);
+// Position of the field with this CSV/JSON key in observationFields, -1 if none
+int observationFieldIndex(const char *key);
+
+/**
+ * Compile-time loop over the field table: Visitor::template apply<I>() is
+ * instantiated once per field, with observationFields[I] a constant, so every
+ * conversion is a direct inlined call and nothing is looked up at run time.
+ */
+template <int I, int N>
+struct FieldLoop
+{
+  template <typename Visitor>
+  static inline void run(Visitor &visitor)
+  {
+    visitor.template apply<I>();
+    FieldLoop<I + 1, N>::run(visitor);
+  }
+};
+
+template <int N>
+struct FieldLoop<N, N>
+{
+  template <typename Visitor>
+  static inline void run(Visitor &)
+  {
+  }
+};
+
+template <typename Visitor>
+inline void forEachField(Visitor &visitor)
+{
+  FieldLoop<0, OBSERVATION_FIELD_COUNT>::run(visitor);
+}
+
+// Fills the readings from request arguments. Args needs
+// const char *argValue(const char *name), returning "" when absent.
+template <typename Args>
+struct ObservationParser
+{
+  const Args &args;
+  Observation &observation;
+
+  template <int I>
+  inline void apply(void)
+  {
+    const char *text = args.argValue(observationFields[I].arg);
+    CsvSpan span = {text, strlen(text)};
+    float value;
+    if (!csvParseFloat(span, &value))
+    {
+      return; // missing or not a number: stored empty rather than as a made-up reading
+    }
+    float scaled = observationFields[I].convert(value) * fieldScale(observationFields[I].decimals);
+    if (!(fabsf(scaled) < 2.0e9f))
+    {
+      return; // does not fit the packed value
+    }
+    observation.values[I] = lroundf(scaled);
+    observation.present |= 1UL << I;
+  }
+};
+
+template <typename Args>
+inline void observationParse(const Args &args, Observation &observation)
+{
+  observation.present = 0;
+  ObservationParser<Args> parser = {args, observation};
+  forEachField(parser);
+}
+
+struct ObservationCsvReader
+{
+  const CsvSpan *columns;
+  Observation &observation;
+  bool valid;
+
+  template <int I>
+  inline void apply(void)
+  {
+    const CsvSpan &column = columns[I + 1];
+    if (csvIsNull(column))
+    {
+      return;
+    }
+    float value;
+    if (!csvParseFloat(column, &value))
+    {
+      valid = false; // damaged column
+      return;
+    }
+    float scaled = value * fieldScale(observationFields[I].decimals);
+    if (!(fabsf(scaled) < 2.0e9f))
+    {
+      valid = false;
+      return;
+    }
+    observation.values[I] = lroundf(scaled);
+    observation.present |= 1UL << I;
+  }
+};
+
+// Reads a stored line, split into OBSERVATION_COLUMN_COUNT columns, back into
+// an observation; the values are already in stored units. An empty date gives
+// time 0. False if the date or any non-empty column does not parse.
+inline bool observationFromCsv(const CsvSpan *columns, Observation &observation)
+{
+  observation.time = 0;
+  observation.present = 0;
+  if (!csvIsNull(columns[0]) && !parseDateTime(columns[0], &observation.time))
+  {
+    return false;
+  }
+  ObservationCsvReader reader = {columns, observation, true};
+  forEachField(reader);
+  return reader.valid;
+}
+
+struct ObservationCsvWriter
+{
+  const Observation &observation;
+  char *out;
+  size_t length;
+
+  template <int I>
+  inline void apply(void)
+  {
+    out[length++] = ',';
+    if (observation.present & (1UL << I))
+    {
+      length += formatFixed(out + length, observation.values[I], observationFields[I].decimals);
+    }
+  }
+};
+
+// Longest line observationToCsv() can produce, terminator included
+#define OBSERVATION_CSV_SIZE (20 + OBSERVATION_FIELD_COUNT * 13)
+
+// The stored line: date, then every field in table order. out must hold
+// OBSERVATION_CSV_SIZE bytes. Returns the length.
+inline size_t observationToCsv(const Observation &observation, char *out)
+{
+  size_t length = 0;
+  if (observation.time != 0)
+  {
+    formatDateTime(out, observation.time);
+    length = 19;
+  }
+  ObservationCsvWriter writer = {observation, out, length};
+  forEachField(writer);
+  out[writer.length] = '\0';
+  return writer.length;
+}
+
+struct ObservationHeaderWriter
+{
+  char *out;
+  size_t length;
+
+  template <int I>
+  inline void apply(void)
+  {
+    out[length++] = ',';
+    size_t n = strlen(observationFields[I].key);
+    memcpy(out + length, observationFields[I].key, n);
+    length += n;
+  }
+};
+
+// Header line for CSV exports, in the same column order as observationToCsv()
+inline size_t observationCsvHeader(char *out)
+{
+  size_t length = strlen(OBSERVATION_DATE_KEY);
+  memcpy(out, OBSERVATION_DATE_KEY, length);
+  ObservationHeaderWriter writer = {out, length};
+  forEachField(writer);
+  out[writer.length] = '\0';
+  return writer.length;
+}
+
+// Writes each column of a stored line under its key: numbers as written on
+// the card, empty or NULL columns as null, anything else as a string.
+struct ObservationJsonWriter
+{
+  JsonWriter &json;
+  const CsvSpan *columns;
+
+  template <int I>
+  inline void apply(void)
+  {
+    const CsvSpan &value = columns[I + 1];
+    json.key(observationFields[I].key);
+    if (csvIsNull(value))
+    {
+      json.valueNull();
+    }
+    else if (csvIsNumber(value))
+    {
+      json.valueRaw(value);
+    }
+    else
+    {
+      json.valueString(value);
+    }
+  }
+};
+
+inline void observationJson(JsonWriter &json, const CsvSpan *columns)
+{
+  json.key(OBSERVATION_DATE_KEY);
+  if (csvIsNull(columns[0]))
+  {
+    json.valueNull();
+  }
+  else
+  {
+    json.valueString(columns[0]);
+  }
+  ObservationJsonWriter writer = {json, columns};
+  forEachField(writer);
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include <Crc32.h>
+
+#include "SampleFilter.h"
+
+uint32_t sampleStationKey(const char *station)
+{
+  uint32_t hash = 2166136261u;
+  while (*station)
+  {
+    hash ^= (uint8_t)*station++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+SampleFilter::SampleFilter(void)
+{
+  clear();
+}
+
+void SampleFilter::clear(void)
+{
+  memset(&_state, 0, sizeof(_state));
+  _dirty = false;
+}
+
+SampleFilter::Key *SampleFilter::newestFor(uint32_t station)
+{
+  Key *oldest = &_state.newest[0];
+  for (int i = 0; i < SAMPLE_FILTER_STATIONS; i++)
+  {
+    Key &entry = _state.newest[i];
+    if (entry.epoch != 0 && entry.station == station)
+    {
+      return &entry;
+    }
+    if (entry.epoch < oldest->epoch)
+    {
+      oldest = &entry;
+    }
+  }
+  // Unknown station: take over the slot that went quiet longest
+  oldest->station = station;
+  oldest->epoch = 0;
+  return oldest;
+}
+
+// Spreads the whole key over the bucket index. Consoles post on fixed
+// intervals, so the low bits of the epoch alone would keep each station in a
+// few buckets; the murmur3 finalizer makes every input bit reach the low bits.
+static uint32_t bucketIndex(uint32_t station, uint32_t epoch)
+{
+  uint32_t hash = station ^ (epoch * 2654435761u);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash % SAMPLE_FILTER_BUCKETS;
+}
+
+SampleVerdict SampleFilter::check(uint32_t station, uint32_t epoch)
+{
+  Bucket &bucket = _state.buckets[bucketIndex(station, epoch)];
+  for (int i = 0; i < SAMPLE_FILTER_WAYS; i++)
+  {
+    if (bucket.ways[i].epoch == epoch && bucket.ways[i].station == station)
+    {
+      return SAMPLE_DUPLICATE;
+    }
+  }
+
+  Key &way = bucket.ways[bucket.next];
+  way.station = station;
+  way.epoch = epoch;
+  bucket.next = (bucket.next + 1) % SAMPLE_FILTER_WAYS;
+  _dirty = true;
+
+  Key *newest = newestFor(station);
+  if (epoch < newest->epoch)
+  {
+    return SAMPLE_OUT_OF_ORDER;
+  }
+  newest->epoch = epoch;
+  return SAMPLE_NEW;
+}
+
+bool SampleFilter::isDirty(void) const
+{
+  return _dirty;
+}
+
+size_t SampleFilter::snapshotSize(void)
+{
+  return sizeof(Header) + sizeof(State);
+}
+
+void SampleFilter::snapshot(uint8_t *buffer)
+{
+  Header header;
+  header.magic = SAMPLE_FILTER_MAGIC;
+  header.version = SAMPLE_FILTER_VERSION;
+  header.crc = crc32Update(0, &_state, sizeof(_state));
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), &_state, sizeof(_state));
+  _dirty = false;
+}
+
+bool SampleFilter::restore(const uint8_t *buffer, size_t length)
+{
+  clear();
+  if (length != snapshotSize())
+  {
+    return false;
+  }
+  Header header;
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != SAMPLE_FILTER_MAGIC || header.version != SAMPLE_FILTER_VERSION ||
+      header.crc != crc32Update(0, buffer + sizeof(header), sizeof(_state)))
+  {
+    return false;
+  }
+  memcpy(&_state, buffer + sizeof(header), sizeof(_state));
+  for (int i = 0; i < SAMPLE_FILTER_BUCKETS; i++)
+  {
+    _state.buckets[i].next %= SAMPLE_FILTER_WAYS;
+  }
+  return true;
+}
@@ -0,0 +1,80 @@
+#ifndef SampleFilter_h
+#define SampleFilter_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define SAMPLE_FILTER_BUCKETS 32
+#define SAMPLE_FILTER_WAYS 4 // keys remembered per bucket, oldest replaced first
+#define SAMPLE_FILTER_STATIONS 8
+#define SAMPLE_FILTER_MAGIC 0x544c4653 // "SFLT"
+#define SAMPLE_FILTER_VERSION 2        // bump whenever the snapshot layout or the bucket hash changes
+
+enum SampleVerdict
+{
+  SAMPLE_NEW,
+  SAMPLE_DUPLICATE,
+  SAMPLE_OUT_OF_ORDER // not seen before, but older than the newest sample from its station
+};
+
+// FNV-1a hash of a station identifier such as the console PASSKEY.
+uint32_t sampleStationKey(const char *station);
+
+/**
+ * Remembers recent (station, dateutc epoch) keys so retransmitted samples can
+ * be dropped at ingest. Keys live in a fixed hash table whose buckets are
+ * small rings; the newest epoch seen per station is kept to spot samples that
+ * arrive out of order. The whole state can be snapshotted to the card and
+ * restored after a reboot.
+ */
+class SampleFilter
+{
+
+public:
+  SampleFilter(void);
+
+  void clear(void);
+  // Classifies the sample and, unless it is a duplicate, remembers it.
+  SampleVerdict check(uint32_t station, uint32_t epoch);
+  bool isDirty(void) const; // changed since the last snapshot
+
+  static size_t snapshotSize(void);
+  // Serializes the state, with a CRC, into buffer of snapshotSize() bytes.
+  void snapshot(uint8_t *buffer);
+  // Loads a snapshot; returns false, leaving the filter empty, if it is not valid.
+  bool restore(const uint8_t *buffer, size_t length);
+
+protected:
+  struct Key
+  {
+    uint32_t station;
+    uint32_t epoch; // 0 marks an empty way
+  };
+
+  struct Bucket
+  {
+    Key ways[SAMPLE_FILTER_WAYS];
+    uint32_t next;
+  };
+
+  struct State
+  {
+    Bucket buckets[SAMPLE_FILTER_BUCKETS];
+    Key newest[SAMPLE_FILTER_STATIONS];
+  };
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t crc;
+  };
+
+  State _state;
+  bool _dirty;
+
+  Key *newestFor(uint32_t station);
+
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "TarStream.h"
+
+static void writeOctal(char *field, size_t width, uint32_t value)
+{
+  // width includes the terminating NUL, as produced by GNU tar
+  snprintf(field, width, "%0*lo", (int)(width - 1), (unsigned long)value);
+}
+
+bool tarBuildHeader(uint8_t *header, const char *name, uint32_t size, uint32_t mtime)
+{
+  size_t nameLength = strlen(name);
+  if (nameLength == 0 || nameLength >= TAR_NAME_SIZE)
+  {
+    return false;
+  }
+
+  memset(header, 0, TAR_BLOCK_SIZE);
+  char *h = (char *)header;
+
+  memcpy(h, name, nameLength);  // name
+  writeOctal(h + 100, 8, 0644); // mode
+  writeOctal(h + 108, 8, 0);    // uid
+  writeOctal(h + 116, 8, 0);    // gid
+  writeOctal(h + 124, 12, size);
+  writeOctal(h + 136, 12, mtime);
+  memset(h + 148, ' ', 8); // checksum is computed with its own field as spaces
+  h[156] = '0';            // regular file
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+
+  uint32_t checksum = 0;
+  for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+  {
+    checksum += header[i];
+  }
+  snprintf(h + 148, 7, "%06lo", (unsigned long)checksum);
+  h[154] = '\0';
+  h[155] = ' ';
+  return true;
+}
+
+uint32_t tarPaddingSize(uint32_t size)
+{
+  uint32_t remainder = size % TAR_BLOCK_SIZE;
+  return remainder == 0 ? 0 : TAR_BLOCK_SIZE - remainder;
+}
+
+uint32_t tarEntrySize(uint32_t size)
+{
+  return TAR_BLOCK_SIZE + size + tarPaddingSize(size);
+}
@@ -0,0 +1,28 @@
+#ifndef TarStream_h
+#define TarStream_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_SIZE 100
+
+/**
+ * Helpers for writing a POSIX ustar archive as a stream. Nothing is staged:
+ * the caller writes tarBuildHeader() followed by the file body, then
+ * tarPaddingSize() zero bytes, and finally TAR_TRAILER_SIZE zero bytes once
+ * all entries are written.
+ */
+#define TAR_TRAILER_SIZE (2 * TAR_BLOCK_SIZE)
+
+// Fills a 512 byte header block for a regular file. Returns false if the name
+// does not fit in the ustar name field.
+bool tarBuildHeader(uint8_t *header, const char *name, uint32_t size, uint32_t mtime);
+
+// Zero bytes needed after a body of the given size to reach a block boundary.
+uint32_t tarPaddingSize(uint32_t size);
+
+// Bytes one entry occupies in the archive: header, body and padding.
+uint32_t tarEntrySize(uint32_t size);
+
+#endif
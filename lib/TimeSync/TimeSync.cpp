@@ -0,0 +1,237 @@
+#include "TimeSync.h"
+
+#include <string.h>
+
+#define NTP_UNIX_OFFSET 2208988800UL // seconds from 1900 to 1970
+
+static uint32_t readBigEndian(const uint8_t *in)
+{
+  return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static void writeBigEndian(uint8_t *out, uint32_t value)
+{
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+// NTP timestamp (seconds since 1900 and a 32-bit fraction) to Unix milliseconds
+static int64_t readTimestamp(const uint8_t *in)
+{
+  uint32_t seconds = readBigEndian(in);
+  uint32_t fraction = readBigEndian(in + 4);
+  int64_t unixSeconds = (int64_t)seconds - NTP_UNIX_OFFSET;
+  if (seconds < 0x80000000UL)
+  {
+    unixSeconds += 0x100000000LL; // era 1, from February 2036
+  }
+  return unixSeconds * 1000 + (int64_t)(((uint64_t)fraction * 1000) >> 32);
+}
+
+static void writeTimestamp(uint8_t *out, int64_t unixMs)
+{
+  writeBigEndian(out, (uint32_t)(unixMs / 1000 + NTP_UNIX_OFFSET));
+  writeBigEndian(out + 4, (uint32_t)(((uint64_t)(unixMs % 1000) << 32) / 1000));
+}
+
+TimeSync::TimeSync(void)
+    : _source(TIME_SOURCE_NONE), _baseEpochMs(0), _baseMillis(0), _slewRemaining(0), _waiting(false), _sentAt(0),
+      _nextRequestAt(0), _retryInterval(TIMESYNC_RETRY_INTERVAL)
+{
+  memset(_nonce, 0, sizeof(_nonce));
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+TimeSync::~TimeSync(void)
+{
+}
+
+int32_t TimeSync::slewFor(uint32_t elapsed) const
+{
+  int32_t limit = (int64_t)elapsed * TIMESYNC_SLEW_PPM / 1000000;
+  if (_slewRemaining > limit)
+  {
+    return limit;
+  }
+  if (_slewRemaining < -limit)
+  {
+    return -limit;
+  }
+  return _slewRemaining;
+}
+
+int64_t TimeSync::clockMillis(unsigned long now) const
+{
+  uint32_t elapsed = now - _baseMillis;
+  return _baseEpochMs + elapsed + slewFor(elapsed);
+}
+
+// Moves the base to now so the slew limit is measured over short spans
+void TimeSync::fold(unsigned long now)
+{
+  uint32_t elapsed = now - _baseMillis;
+  int32_t applied = slewFor(elapsed);
+  _baseEpochMs += (int64_t)elapsed + applied;
+  _slewRemaining -= applied;
+  _baseMillis = now;
+}
+
+void TimeSync::correct(int64_t offset, unsigned long now, bool step)
+{
+  fold(now);
+  if (step || offset > TIMESYNC_STEP_THRESHOLD || offset < -TIMESYNC_STEP_THRESHOLD)
+  {
+    _baseEpochMs += offset;
+    _slewRemaining = 0;
+    _stats.steps++;
+  }
+  else
+  {
+    _slewRemaining = offset; // measured against the clock as corrected so far
+  }
+  _stats.updates++;
+}
+
+void TimeSync::request(unsigned long now)
+{
+  if (_waiting || (long)(now - _nextRequestAt) < 0)
+  {
+    return;
+  }
+  uint8_t packet[TIMESYNC_PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  packet[0] = 0x23; // no leap warning, version 4, client
+  writeTimestamp(packet + 40, clockMillis(now));
+  if (!sendRequest(packet, sizeof(packet)))
+  {
+    return; // no network or server address yet, tried again on the next call
+  }
+  memcpy(_nonce, packet + 40, sizeof(_nonce));
+  _waiting = true;
+  _sentAt = now;
+  _stats.requests++;
+}
+
+void TimeSync::update(unsigned long now)
+{
+  uint8_t packet[TIMESYNC_PACKET_SIZE];
+  int length = receiveResponse(packet, sizeof(packet));
+  if (_waiting)
+  {
+    if (length > 0)
+    {
+      handleResponse(packet, length, now);
+    }
+    if (_waiting && now - _sentAt > TIMESYNC_TIMEOUT)
+    {
+      fail(now);
+    }
+  }
+  if (now - _baseMillis >= TIMESYNC_FOLD_INTERVAL)
+  {
+    fold(now);
+  }
+}
+
+void TimeSync::handleResponse(const uint8_t *packet, int length, unsigned long now)
+{
+  if (length < TIMESYNC_PACKET_SIZE || memcmp(packet + 24, _nonce, sizeof(_nonce)) != 0)
+  {
+    return; // late answer to an earlier request, or not an answer at all
+  }
+  _waiting = false;
+
+  uint8_t leap = packet[0] >> 6;
+  uint8_t version = (packet[0] >> 3) & 7;
+  uint8_t mode = packet[0] & 7;
+  uint8_t stratum = packet[1];
+  if (mode != 4 || version < 3 || leap == 3 || stratum == 0 || stratum > 15 || readBigEndian(packet + 40) == 0)
+  {
+    fail(now); // not a server reply, or the server is not synchronized itself
+    return;
+  }
+
+  int64_t sent = readTimestamp(packet + 24);
+  int64_t received = readTimestamp(packet + 32);
+  int64_t transmitted = readTimestamp(packet + 40);
+  int64_t arrived = clockMillis(now);
+  int64_t delay = (arrived - sent) - (transmitted - received);
+  if (delay < 0)
+  {
+    delay = 0;
+  }
+  if (delay > TIMESYNC_MAX_DELAY)
+  {
+    fail(now);
+    return;
+  }
+  int64_t offset = ((received - sent) + (transmitted - arrived)) / 2;
+
+  _stats.responses++;
+  _stats.lastOffsetMs = offset > INT32_MAX ? INT32_MAX : offset < INT32_MIN ? INT32_MIN : (int32_t)offset;
+  _stats.lastDelayMs = delay;
+  _stats.lastSyncAt = now;
+  correct(offset, now, _source != TIME_SOURCE_NTP);
+  _source = TIME_SOURCE_NTP;
+  _retryInterval = TIMESYNC_RETRY_INTERVAL;
+  _nextRequestAt = now + TIMESYNC_POLL_INTERVAL;
+}
+
+void TimeSync::fail(unsigned long now)
+{
+  _waiting = false;
+  _stats.failures++;
+  _nextRequestAt = now + _retryInterval;
+  _retryInterval = _retryInterval * 2 < TIMESYNC_POLL_INTERVAL ? _retryInterval * 2 : TIMESYNC_POLL_INTERVAL;
+  requestFailed();
+}
+
+void TimeSync::offerConsoleTime(uint32_t epoch, unsigned long now)
+{
+  if (_source == TIME_SOURCE_NTP || epoch == 0)
+  {
+    return;
+  }
+  int64_t offset = (int64_t)epoch * 1000 - clockMillis(now);
+  if (_source == TIME_SOURCE_NONE)
+  {
+    correct(offset, now, true);
+    _source = TIME_SOURCE_CONSOLE;
+  }
+  else if (offset > TIMESYNC_STEP_THRESHOLD)
+  {
+    correct(offset, now, false); // dateutc has whole seconds, so only a clock more than that behind is corrected
+  }
+}
+
+bool TimeSync::valid(void) const
+{
+  return _source != TIME_SOURCE_NONE;
+}
+
+uint8_t TimeSync::source(void) const
+{
+  return _source;
+}
+
+int64_t TimeSync::epochMillis(unsigned long now) const
+{
+  return valid() ? clockMillis(now) : 0;
+}
+
+uint32_t TimeSync::epoch(unsigned long now) const
+{
+  return epochMillis(now) / 1000;
+}
+
+int32_t TimeSync::slewPending(void) const
+{
+  return _slewRemaining;
+}
+
+const TimeSyncStats &TimeSync::stats(void) const
+{
+  return _stats;
+}
@@ -0,0 +1,94 @@
+#ifndef TimeSync_h
+#define TimeSync_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define TIMESYNC_PACKET_SIZE 48
+#define TIMESYNC_PORT 123
+#define TIMESYNC_POLL_INTERVAL 600000UL // between requests once synchronized
+#define TIMESYNC_RETRY_INTERVAL 15000UL // first retry after a failure, doubled up to the poll interval
+#define TIMESYNC_TIMEOUT 2000UL         // a request without an answer by then has failed
+#define TIMESYNC_MAX_DELAY 1000         // round trips slower than this (ms) are not trusted
+#define TIMESYNC_STEP_THRESHOLD 1000    // larger offsets (ms) are stepped, smaller ones slewed
+#define TIMESYNC_SLEW_PPM 2000          // at most 2 ms of correction per second
+#define TIMESYNC_FOLD_INTERVAL 1000UL   // how often applied slew is folded into the base
+
+enum TimeSource
+{
+  TIME_SOURCE_NONE,
+  TIME_SOURCE_CONSOLE, // taken from a console's dateutc, NTP has not answered yet
+  TIME_SOURCE_NTP
+};
+
+struct TimeSyncStats
+{
+  uint32_t requests;
+  uint32_t responses;   // accepted NTP answers
+  uint32_t failures;    // timed out or rejected
+  uint32_t steps;       // corrections too large to slew
+  uint32_t updates;     // times the clock was set or corrected, from any source
+  int32_t lastOffsetMs; // of the last accepted answer, before correction
+  uint32_t lastDelayMs; // round trip of the last accepted answer
+  unsigned long lastSyncAt;
+};
+
+/**
+ * Epoch clock disciplined by SNTP without ever blocking. request() sends one
+ * query when it is due and update() picks up the answer on a later pass, so
+ * the caller never waits on the network.
+ *
+ * The clock runs from millis(). Offsets below TIMESYNC_STEP_THRESHOLD are
+ * slewed in at TIMESYNC_SLEW_PPM, so the clock never jumps or runs backwards
+ * in normal operation; larger ones, and the first NTP answer, are stepped.
+ * Until NTP answers, a console's dateutc can set the clock; console time only
+ * ever moves it forward, since a resent sample carries an old date.
+ *
+ * The network is supplied by a subclass (UdpTimeSync on the ESP32).
+ */
+class TimeSync
+{
+
+public:
+  TimeSync(void);
+  virtual ~TimeSync(void);
+
+  void request(unsigned long now); // sends a query if one is due; call from a timer
+  void update(unsigned long now);  // reads an answer, expires a request; call every loop() pass
+  void offerConsoleTime(uint32_t epoch, unsigned long now);
+
+  bool valid(void) const;
+  uint8_t source(void) const;
+  int64_t epochMillis(unsigned long now) const; // UTC, 0 while not valid
+  uint32_t epoch(unsigned long now) const;      // UTC seconds, 0 while not valid
+  int32_t slewPending(void) const;              // ms of correction not yet applied
+  const TimeSyncStats &stats(void) const;
+
+protected:
+  // Network hooks
+  virtual bool sendRequest(const uint8_t *packet, size_t length) = 0; // false if it could not be sent yet
+  virtual int receiveResponse(uint8_t *packet, size_t size) = 0;      // bytes of a reply, 0 if none
+  virtual void requestFailed(void) {}                                 // e.g. to try another server
+
+  uint8_t _source;
+  int64_t _baseEpochMs; // clock value at _baseMillis
+  unsigned long _baseMillis;
+  int32_t _slewRemaining;
+
+  bool _waiting;
+  unsigned long _sentAt;
+  unsigned long _nextRequestAt;
+  unsigned long _retryInterval;
+  uint8_t _nonce[8]; // transmit timestamp of the request, echoed by the server
+  TimeSyncStats _stats;
+
+  int64_t clockMillis(unsigned long now) const; // as epochMillis(), whether valid or not
+  int32_t slewFor(uint32_t elapsed) const;
+  void fold(unsigned long now);
+  void correct(int64_t offset, unsigned long now, bool step);
+  void handleResponse(const uint8_t *packet, int length, unsigned long now);
+  void fail(unsigned long now);
+
+};
+
+#endif
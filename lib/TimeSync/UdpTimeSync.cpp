@@ -0,0 +1,90 @@
+#if defined(ESP32)
+
+#include "UdpTimeSync.h"
+
+UdpTimeSync::UdpTimeSync(const char *server) : _server(server), _open(false), _address(0), _resolving(false)
+{
+}
+
+// Runs in the lwIP thread once the lookup completes
+void UdpTimeSync::dnsFound(const char *name, const ip_addr_t *address, void *arg)
+{
+  (void)name;
+  UdpTimeSync *self = (UdpTimeSync *)arg;
+  if (address != nullptr)
+  {
+    self->_address = ip_addr_get_ip4_u32(address);
+  }
+  self->_resolving = false;
+}
+
+bool UdpTimeSync::sendRequest(const uint8_t *packet, size_t length)
+{
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    return false;
+  }
+  if (!_open)
+  {
+    _open = _udp.begin(UDP_TIMESYNC_LOCAL_PORT);
+    if (!_open)
+    {
+      return false;
+    }
+  }
+  if (_address == 0)
+  {
+    if (!_resolving)
+    {
+      ip_addr_t address;
+      _resolving = true;
+      err_t err = dns_gethostbyname(_server, &address, dnsFound, this);
+      if (err == ERR_OK)
+      {
+        _address = ip_addr_get_ip4_u32(&address); // cached, no callback follows
+      }
+      if (err != ERR_INPROGRESS)
+      {
+        _resolving = false;
+      }
+    }
+    if (_address == 0)
+    {
+      return false;
+    }
+  }
+  if (!_udp.beginPacket(IPAddress(_address), TIMESYNC_PORT))
+  {
+    return false;
+  }
+  _udp.write(packet, length);
+  return _udp.endPacket();
+}
+
+int UdpTimeSync::receiveResponse(uint8_t *packet, size_t size)
+{
+  if (!_open)
+  {
+    return 0;
+  }
+  int available = _udp.parsePacket();
+  if (available <= 0)
+  {
+    return 0;
+  }
+  if ((uint32_t)_udp.remoteIP() != _address)
+  {
+    return 0; // the rest of the datagram is dropped by the next parsePacket()
+  }
+  return _udp.read(packet, size);
+}
+
+void UdpTimeSync::requestFailed(void)
+{
+  if (!_resolving)
+  {
+    _address = 0;
+  }
+}
+
+#endif
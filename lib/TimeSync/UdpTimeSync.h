@@ -0,0 +1,40 @@
+#ifndef UdpTimeSync_h
+#define UdpTimeSync_h
+
+#if defined(ESP32)
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <lwip/dns.h>
+
+#include "TimeSync.h"
+
+#define UDP_TIMESYNC_LOCAL_PORT 2390
+
+// SNTP over WiFiUDP. The server name is resolved with lwIP's asynchronous
+// resolver and resolved again after a failed request, so a pool name moves
+// on to another server.
+class UdpTimeSync : public TimeSync
+{
+
+public:
+  explicit UdpTimeSync(const char *server);
+
+protected:
+  bool sendRequest(const uint8_t *packet, size_t length);
+  int receiveResponse(uint8_t *packet, size_t size);
+  void requestFailed(void);
+
+  const char *_server;
+  WiFiUDP _udp;
+  bool _open;
+  volatile uint32_t _address; // 0 until resolved
+  volatile bool _resolving;
+
+  static void dnsFound(const char *name, const ip_addr_t *address, void *arg);
+
+};
+
+#endif
+
+#endif
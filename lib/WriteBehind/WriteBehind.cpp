@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "WriteBehind.h"
+
+WriteBehind::WriteBehind(size_t groupBytes, unsigned long maxDelayMs)
+{
+  _length = 0;
+  _groupBytes = groupBytes;
+  _maxDelayMs = maxDelayMs;
+  _oldest = 0;
+}
+
+bool WriteBehind::append(const void *data, size_t length, unsigned long now)
+{
+  if (length > room())
+  {
+    return false;
+  }
+  if (_length == 0)
+  {
+    _oldest = now;
+  }
+  memcpy(_buffer + _length, data, length);
+  _length += length;
+  return true;
+}
+
+size_t WriteBehind::buffered(void) const
+{
+  return _length;
+}
+
+size_t WriteBehind::room(void) const
+{
+  return WRITE_BEHIND_BUFFER_SIZE - _length;
+}
+
+size_t WriteBehind::pending(uint32_t fileSize, unsigned long now, bool force) const
+{
+  if (_length == 0)
+  {
+    return 0;
+  }
+  if (force || now - _oldest >= _maxDelayMs)
+  {
+    return _length;
+  }
+
+  // Fill the file's partial last sector, then whole sectors only
+  size_t head = (WRITE_BEHIND_SECTOR_SIZE - fileSize % WRITE_BEHIND_SECTOR_SIZE) % WRITE_BEHIND_SECTOR_SIZE;
+  if (_length < head)
+  {
+    return 0;
+  }
+  size_t aligned = head + (_length - head) / WRITE_BEHIND_SECTOR_SIZE * WRITE_BEHIND_SECTOR_SIZE;
+  return aligned >= _groupBytes ? aligned : 0;
+}
+
+const uint8_t *WriteBehind::data(void) const
+{
+  return _buffer;
+}
+
+void WriteBehind::consume(size_t length)
+{
+  if (length >= _length)
+  {
+    _length = 0;
+    return;
+  }
+  // The remainder keeps the arrival time of the oldest record, so its
+  // deadline is not pushed back
+  memmove(_buffer, _buffer + length, _length - length);
+  _length -= length;
+}
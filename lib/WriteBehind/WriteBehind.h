@@ -0,0 +1,43 @@
+#ifndef WriteBehind_h
+#define WriteBehind_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define WRITE_BEHIND_BUFFER_SIZE 4096
+#define WRITE_BEHIND_SECTOR_SIZE 512
+
+/**
+ * RAM buffer in front of an append-only file. Records collect here and are
+ * handed to the file in groups that end on a sector boundary of the file, so
+ * the card rewrites each sector once instead of once per record. Whatever is
+ * buffered goes out regardless of alignment once the oldest byte has waited
+ * maxDelayMs, which bounds how much a power cut can lose.
+ */
+class WriteBehind
+{
+
+public:
+  WriteBehind(size_t groupBytes, unsigned long maxDelayMs);
+
+  bool append(const void *data, size_t length, unsigned long now); // false when it does not fit
+  size_t buffered(void) const;
+  size_t room(void) const;
+
+  // Number of bytes from data() that should be written now, given the size of
+  // the file they are appended to. force writes everything regardless.
+  size_t pending(uint32_t fileSize, unsigned long now, bool force) const;
+  const uint8_t *data(void) const;
+  // Drops length bytes from the front once they were written.
+  void consume(size_t length);
+
+protected:
+  uint8_t _buffer[WRITE_BEHIND_BUFFER_SIZE];
+  size_t _length;
+  size_t _groupBytes;
+  unsigned long _maxDelayMs;
+  unsigned long _oldest; // when the oldest buffered byte arrived
+
+};
+
+#endif
@@ -10,15 +10,13 @@ ESP8266WebServer server(80);
 int csPin = 0;
 #elif defined(ESP32)
 #include <WiFi.h>
-#include <WebServer.h>
+#include <WiFiHttpMux.h>
 #include <WiFiClient.h>
 #include <HTTPClient.h>
 #include <Ticker.h>
 #include <TimeLib.h>
-#include <NTPClient.h>
-#include <WiFiUdp.h>
 
-WebServer server(80);
+WiFiHttpMux server(80);
 int csPin = 5;
 const int relayPin = 13;
 #endif
@@ -26,10 +24,33 @@ const int relayPin = 13;
 #include <SD.h>
 #include <RTClib.h>
 #include <Timer.h>
-
-// Define NTP Client to get time
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org");
+#include <Preferences.h>
+#include <Crc32.h>
+#include <TarStream.h>
+#include <FileIndex.h>
+#include <IngestPipeline.h>
+#include <IngestQueue.h>
+#include <RateLimiter.h>
+#include <SampleFilter.h>
+#include <SdJournal.h>
+#include <StationMap.h>
+#include <FairScheduler.h>
+#include <CsvRecord.h>
+#include <Observation.h>
+#include <Log.h>
+#include <History.h>
+#include <UdpTimeSync.h>
+#include <Arena.h>
+#include <ArenaJson.h>
+#include <Backfill.h>
+#include <sys/time.h>
+
+#define TIME_SYNC_SERVER "pool.ntp.org"
+#define TIME_SYNC_TICK 1000 // how often the timer checks whether an NTP request is due
+
+// Epoch clock disciplined by SNTP, or by the console's dateutc until NTP answers
+UdpTimeSync timeSync(TIME_SYNC_SERVER);
+uint32_t timeSyncUpdates = 0; // clock corrections already passed on to the system clock
 
 // ESP32 Access Point credentials
 const char *ap_ssid = "weather_station"; // SSID for the AP
@@ -43,36 +64,158 @@ IPAddress ap_subnet(255, 255, 255, 0);
 #define WATCHDOG_TIMEOUT 60
 volatile int watchdogMin = 0;
 
-#define SERIAL_BUFFER_SIZE 20
-String serialBuffer[SERIAL_BUFFER_SIZE];
-int serialBufferIndex = 0;
+#define EXPORT_FILES_SIZE 512 // longest ?files= list an export keeps for its walk
+#define EXPORT_MAX_DIRS (GATEWAY_MAX_STATIONS + 8) // /, /journal, /stations and its station journals, /logs, /import, ...
+
+#define FILE_LIST_PAGE_SIZE 20
+#define FILE_LIST_MAX_PAGE_SIZE 50
+
+#define INGEST_BURST 6            // posts a single source may send back to back
+#define INGEST_REFILL_MS 5000     // then one more every 5 seconds; consoles post every 16 s or slower
+#define INGEST_DRAIN_PER_PASS 2   // queued records written to SD per loop() pass
+
+#define JOURNAL_GROUP_BYTES 2048  // commit once this many sector aligned bytes are buffered
+#define JOURNAL_MAX_LOSS_MS 30000 // or once the oldest buffered record is this old
+
+#define GATEWAY_CONFIG_PATH "/stations.json"
+#define GATEWAY_JOURNAL_DIR "/stations"                         // one journal directory per gateway station
+#define INGEST_STATION_SHARE_MIN 2                              // queue slots a station may hold however many there are
+#define SD_MAX_OPEN_FILES (6 + 2 * (GATEWAY_MAX_STATIONS - 1)) // each station journal keeps two files open
+
+#define UPLINK_CONFIG_PATH "/uplinks.json"
+#define UPLINK_URL_SIZE 160
+#define UPLINK_RETRY_MIN 5000   // first wait after a failed post to a destination
+#define UPLINK_RETRY_MAX 300000 // doubled per failure up to this
+
+#define UPLOAD_JSON_SIZE 768
+#define LOCAL_TIME_OFFSET 25200 // GMT+7, applied to dateutc before storing
+
+static_assert(OBSERVATION_CSV_SIZE <= INGEST_RECORD_SIZE && INGEST_RECORD_SIZE <= JOURNAL_MAX_RECORD,
+              "a stored line must fit the ingest queue and a journal record");
+
+#define LEGACY_DATA_PATH "/data.txt" // pre-journal backlog, imported once
+#define LEGACY_DATA_DONE_PATH "/data.imported.txt"
+#define LEGACY_OFFSET_KEY "legacyOffset" // left by firmware that imported it line by line
+
+#define IMPORT_DIR "/import"            // CSV files dropped here are imported at boot
+#define IMPORT_DONE_SUFFIX ".imported"  // appended to a file once it is in the journal
+#define IMPORT_PATH_KEY "importPath"    // the running import, kept in NVS to resume after a reset
+#define IMPORT_STATION_KEY "importStation"
+#define IMPORT_OFFSET_KEY "importOffset" // left by firmware that kept the offset in NVS
+#define IMPORT_PASS_BUDGET 20           // ms of import work per loop() pass
+
+static_assert(BACKFILL_MAX_LINE == JOURNAL_MAX_RECORD, "an imported line must fit a journal record");
+
+#define UPLOAD_PASS_BUDGET 50     // ms of uploads per loop() pass while there is a backlog
+#define UPLINK_HTTP_TIMEOUT 5000  // ms to connect and to wait for an answer; shorter would count slow servers as failed and resend
+
+#define DEDUP_FILE "/dedup.bin"
+#define DEDUP_SAVE_INTERVAL 60000 // how often a changed filter is written to the card
+
+#define LOG_LEVEL_KEY "logLevel"       // runtime level kept in NVS
+#define LOG_SERIAL_TX_BUFFER 1024     // log lines are only sent when the UART buffer has room
+#define LOG_FILE_DIR "/logs"
+#define LOG_FILE_LIMIT 65536          // log.txt is rotated past this size
+#define LOG_FILE_KEEP 3               // log.txt, log.1.txt and log.2.txt
+#define LOG_FLUSH_INTERVAL 5000       // most a watchdog reset can lose from the log file
+
+#define REQUEST_ARENA_SIZE 16384   // scratch for one handler's text and JSON, reset when it returns
+#define HEAP_SAMPLE_INTERVAL 60000 // how often free heap and fragmentation are sampled
+
+// Handlers build their responses here instead of in heap Strings
+alignas(ARENA_ALIGN) uint8_t requestArenaBuffer[REQUEST_ARENA_SIZE];
+Arena requestArena(requestArenaBuffer, sizeof(requestArenaBuffer));
+ArenaJsonAllocator requestJsonAllocator(requestArena);
 
-void addToSerialBuffer(const String &message);
+// Responses built in the request arena are sent from it: the arena stays
+// pinned until the last such response has gone out
+class RequestArenaKeeper : public HttpBodyKeeper
+{
+public:
+  bool keep(const void *content)
+  {
+    if (!requestArena.owns(content))
+    {
+      return false;
+    }
+    requestArena.pin();
+    return true;
+  }
+
+  void release(const void *content)
+  {
+    (void)content;
+    requestArena.unpin();
+  }
+};
+RequestArenaKeeper requestBodyKeeper;
+
+struct HeapStats
+{
+  uint32_t freeBytes;
+  uint32_t minFree;         // lowest free heap since boot, as tracked by the allocator
+  uint32_t largestBlock;    // largest single allocation that would succeed
+  uint32_t minLargestBlock; // lowest of the samples
+  uint8_t fragmentation;    // percent of free heap outside the largest block
+  uint8_t maxFragmentation;
+  unsigned long sampledAt;
+};
+HeapStats heapStats = {};
 
-String zeroDate(int zero);
-void appendFile(fs::FS &fs, const char *path, String message);
-String constructJsonData(const String values[], int size);
+LogCursor serialLogCursor;
+LogCursor fileLogCursor;
+bool logFileReady = false;
+unsigned long logFlushedAt = 0;
+
+void drainSerialLog();
+void flushLogFile(bool force);
+
+size_t buildUploadJson(char *out, size_t size, int32_t stationId, const CsvSpan *values);
 void connectWiFi();
+void updateWiFi();
+void rollBackWiFiTrial();
 void sendData();
-void deleteTopLine();
+bool sendToUplink(int uplink);
+void loadUplinks();
+void handleUplinks();
 void loadSettings();
 void saveSettings();
 void handleRoot();
 void handleSaveSettings();
 void handleDownload();
 void handleDelete();
-String getFormattedTimestamp();
-unsigned long getTime();
-void setInternalClock();
-String getFormattedTimestamp();
+void handleExport();
+void handleFileList();
+void ensureFileIndex();
+void fileIndexPut(const char *path, uint32_t size);
+void fileIndexRemove(const char *path);
+void requestTimeSync();
+void applyTimeSync();
 void handleRestart();
+void handleMetrics();
+void handleLatest();
+void handleHistory();
+void updateLatestObservation(int slot, const Observation &observation, const char *line, size_t length);
+void loadStations();
+void handleStations();
+void commitJournals(bool force);
+void drainIngestQueue(int limit);
+bool startImport(const char *path, int slot, uint32_t offset);
+void resumeImport();
+void importBackfill();
+void handleImport();
+bool importAllowed(const char *path);
+void handleJournalCsv();
+void loadSampleFilter();
+void saveSampleFilter();
+void sendJson(JsonDocument &doc);
+void sampleHeap();
 
 int watchdogTimer = 11;
 int delayMill = 3000;
 
-File myFile;
-
 int id, testLoop = 0;
+bool uploadBacklog = false; // the last upload pass stopped at its budget, not for want of records
 
 Timer sendTimer;
 
@@ -80,42 +223,215 @@ IPAddress staticIP, gateway, subnet, dnsServer;
 
 Ticker watchdogTicker;
 
+FileIndex fileIndex;
+
+// /post admission control: records wait in RAM until loop() writes them out
+IngestQueue ingestQueue;
+RateLimiter ingestLimiter(INGEST_BURST, INGEST_REFILL_MS);
+
+// Newest sample, serialized once when it arrives and served as-is by /api/latest
+struct LatestObservation
+{
+  Observation observation;
+  char json[UPLOAD_JSON_SIZE];
+  size_t jsonLength; // 0 until the first sample
+  char etag[12];     // quoted CRC32 of json
+  unsigned long receivedAt;
+};
+
+// Last 24 hours of every field for /api/history; HISTORY_BYTES of RAM
+History history;
+int16_t historyColumn[HISTORY_SLOTS]; // one column of a /api/history response
+
+// Stored samples, uploaded in order from the journal's cursor
+SdJournal journal(JOURNAL_GROUP_BYTES, JOURNAL_MAX_LOSS_MS);
+unsigned long journalRecoveryMs = 0;
+
+// One slot per station, each with its own journal. Slot 0 is the device's own
+// station (settings.id, the journal above); gateway stations from
+// /stations.json follow, each journaled in GATEWAY_JOURNAL_DIR/<id>.
+struct Station
+{
+  int32_t id; // slot 0 follows settings.id instead
+  Journal *journal;
+  LatestObservation latest;
+  uint32_t accepted;
+  uint32_t uploaded;
+};
+Station stations[GATEWAY_MAX_STATIONS] = {};
+int stationCount = 1;
+StationMap stationMap; // empty unless gateway mode is configured
+
+// Upload destinations. Each reads the shared journals through its own cursor
+// and has its own station turns and backoff, so a dead mirror never holds up
+// the others. Uplink 0 posts to settings.postUrl; mirrors come from /uplinks.json.
+struct Uplink
+{
+  char name[24];
+  char url[UPLINK_URL_SIZE]; // unused for uplink 0
+  FairScheduler scheduler;
+  unsigned long retryAt;
+  unsigned long backoffMs; // 0 while posts succeed
+  uint32_t sent;
+  uint32_t failures;
+  int lastStatus;
+  WiFiClient client; // kept alive across passes
+  HTTPClient http;
+  uint32_t connectedTo; // CRC of the URL the kept connection goes to
+};
+Uplink uplinks[JOURNAL_MAX_CURSORS];
+int uplinkTurn = 0; // destination the next upload pass starts with
+uint32_t uplinkIds[JOURNAL_MAX_CURSORS] = {0}; // journal cursor ids: 0 for the primary, a CRC of the URL for mirrors
+int uplinkCount = 1;
+
+SampleFilter sampleFilter;
+unsigned long sampleFilterSavedAt = 0;
+
+#define WIFI_CONNECT_TIMEOUT 20000 // per attempt, as before
+#define WIFI_RETRY_INTERVAL 60000
+
+enum WiFiState
+{
+  WIFI_STATE_IDLE,
+  WIFI_STATE_CONNECTING,
+  WIFI_STATE_CONNECTED,
+  WIFI_STATE_WAITING
+};
+
+WiFiState wifiState = WIFI_STATE_IDLE;
+unsigned long wifiStateSince = 0;
+bool wifiAttemptStaticIP = false;
+bool uploadAttached = false;
+
+#define BOOT_STAGE_COUNT 8
+
+struct BootStage
+{
+  const char *name;
+  unsigned long at;
+};
+
+BootStage bootStages[BOOT_STAGE_COUNT];
+int bootStageCount = 0;
+
 String payload;
 
 bool checkSend = false;
 
-// Variable to save current epoch time
-unsigned long epochTime;
+void requestTimeSync()
+{
+  timeSync.request(millis());
+}
+
+// Passes clock corrections on to the system clock, so FAT timestamps on new files are valid
+void applyTimeSync()
+{
+  const TimeSyncStats &stats = timeSync.stats();
+  if (stats.updates == timeSyncUpdates)
+  {
+    return;
+  }
+  timeSyncUpdates = stats.updates;
+  int64_t local = timeSync.epochMillis(millis()) + (int64_t)LOCAL_TIME_OFFSET * 1000;
+  struct timeval tv = {(time_t)(local / 1000), (suseconds_t)(local % 1000) * 1000};
+  settimeofday(&tv, NULL);
+  static uint8_t lastSource = TIME_SOURCE_NONE;
+  if (timeSync.source() == TIME_SOURCE_CONSOLE && lastSource == TIME_SOURCE_NONE)
+  {
+    LOGI("Clock set from console dateutc until NTP answers");
+  }
+  else if (timeSync.source() == TIME_SOURCE_NTP && lastSource != TIME_SOURCE_NTP)
+  {
+    LOGI("Clock synchronized with NTP, offset %ld ms", stats.lastOffsetMs);
+  }
+  else
+  {
+    LOGD("Clock corrected by %ld ms, round trip %lu ms", stats.lastOffsetMs, stats.lastDelayMs);
+  }
+  lastSource = timeSync.source();
+}
+
+// Local time for log lines; seconds since boot until the clock is set
+uint32_t logClock()
+{
+  return timeSync.valid() ? timeSync.epoch(millis()) + LOCAL_TIME_OFFSET : millis() / 1000;
+}
 
-// Function that gets current epoch time
-unsigned long getTime()
+// Sends formatted log lines while the UART has room for them, so logging never waits on the serial port
+void drainSerialLog()
 {
-  timeClient.update();
-  unsigned long now = timeClient.getEpochTime();
-  return now;
+  char line[LOG_LINE_SIZE];
+  for (;;)
+  {
+    LogCursor next = serialLogCursor;
+    int length = logger.read(next, line, sizeof(line));
+    if (length < 0 || Serial.availableForWrite() < length + 2)
+    {
+      break;
+    }
+    Serial.println(line);
+    serialLogCursor = next;
+  }
 }
 
-// Function to set the ESP32's internal clock
-void setInternalClock()
+void logFilePath(char *path, size_t size, int generation)
 {
-  epochTime = getTime();
-  setTime(epochTime);
+  if (generation == 0)
+  {
+    snprintf(path, size, LOG_FILE_DIR "/log.txt");
+  }
+  else
+  {
+    snprintf(path, size, LOG_FILE_DIR "/log.%d.txt", generation);
+  }
 }
 
-String getFormattedTimestamp()
+void rotateLogFile()
 {
-  char buffer[25];
-  time_t t = now(); // Get current time
-  sprintf(buffer, "%04d-%02d-%02d %02d:%02d:%02d", year(t), month(t), day(t), hour(t), minute(t), second(t));
-  return String(buffer);
+  char from[32];
+  char to[32];
+  logFilePath(to, sizeof(to), LOG_FILE_KEEP - 1);
+  SD.remove(to);
+  for (int generation = LOG_FILE_KEEP - 1; generation > 0; generation--)
+  {
+    logFilePath(from, sizeof(from), generation - 1);
+    logFilePath(to, sizeof(to), generation);
+    SD.rename(from, to);
+  }
 }
 
-void addToSerialBuffer(const String &message)
+// Appends new log lines to the card every few seconds, or right away when forced before a restart
+void flushLogFile(bool force)
 {
-  String timestampedMessage = getFormattedTimestamp() + " - " + message;
-  Serial.println(timestampedMessage); // Print to actual serial for debugging
-  serialBuffer[serialBufferIndex] = timestampedMessage;
-  serialBufferIndex = (serialBufferIndex + 1) % SERIAL_BUFFER_SIZE;
+  if (!logFileReady || (!force && millis() - logFlushedAt < LOG_FLUSH_INTERVAL))
+  {
+    return;
+  }
+  logFlushedAt = millis();
+  if (fileLogCursor.seq == logger.end().seq)
+  {
+    return;
+  }
+  char path[32];
+  logFilePath(path, sizeof(path), 0);
+  File file = SD.open(path, FILE_APPEND);
+  if (!file)
+  {
+    return;
+  }
+  char line[LOG_LINE_SIZE + 1];
+  int length;
+  while ((length = logger.read(fileLogCursor, line, sizeof(line) - 1)) >= 0)
+  {
+    line[length] = '\n';
+    file.write((const uint8_t *)line, length + 1);
+  }
+  size_t size = file.size();
+  file.close();
+  if (size >= LOG_FILE_LIMIT)
+  {
+    rotateLogFile();
+  }
 }
 
 struct Settings
@@ -133,6 +449,38 @@ struct Settings
 
 Settings settings;
 
+// Network settings saved from the web page are tried before they are kept:
+// until the new network connects, the last working ones wait here
+bool wifiTrial = false;
+Settings wifiRollback;
+
+#define SETTINGS_CACHE_NAMESPACE "weather"
+#define SETTINGS_CACHE_KEY "settings"
+#define SETTINGS_CACHE_VERSION 1 // bump whenever SettingsCache changes layout
+
+// Validated settings as a fixed-layout blob in NVS, so a normal boot does not
+// have to parse /settings.json
+struct SettingsCache
+{
+  uint16_t version;
+  uint16_t length;
+  uint8_t hasSource;
+  uint32_t sourceSize; // fingerprint of /settings.json when the cache was written
+  uint32_t sourceMtime;
+  char ssid[33];
+  char password[65];
+  char postUrl[160];
+  int32_t id;
+  uint8_t useStaticIP;
+  uint32_t staticIP;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dnsServer;
+  uint32_t crc; // must stay last, covers everything before it
+};
+
+Preferences preferences;
+
 void resetWatchdog()
 {
   watchdogMin++;
@@ -143,57 +491,176 @@ void resetWatchdog()
   }
 }
 
+// Masks the password so it never reaches the serial log or /serial
+void logSettings()
+{
+  LOGD("SSID: %s", settings.ssid);
+  LOGD("Password: %s", settings.password.length() > 0 ? "********" : "(none)");
+  LOGD("ID: %d", settings.id);
+  LOGD("Use Static IP: %s", settings.useStaticIP ? "Yes" : "No");
+  LOGD("Static IP: %s", settings.staticIP);
+  LOGD("Gateway: %s", settings.gateway);
+  LOGD("Subnet: %s", settings.subnet);
+  LOGD("DNS Server: %s", settings.dnsServer);
+  LOGD("Post URL: %s", settings.postUrl);
+}
+
+// Size and modification time of /settings.json, used to notice edits made on a PC
+bool settingsFileFingerprint(uint32_t &size, uint32_t &mtime)
+{
+  File file = SD.open("/settings.json", FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+  size = file.size();
+  mtime = file.getLastWrite();
+  file.close();
+  return true;
+}
+
+uint32_t settingsCacheCrc(const SettingsCache &cache)
+{
+  return crc32Update(0, &cache, offsetof(SettingsCache, crc));
+}
+
+bool copySettingsString(char *dest, size_t size, const String &value)
+{
+  if (value.length() >= size)
+  {
+    return false;
+  }
+  memcpy(dest, value.c_str(), value.length() + 1);
+  return true;
+}
+
+void storeSettingsCache()
+{
+  SettingsCache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.version = SETTINGS_CACHE_VERSION;
+  cache.length = sizeof(cache);
+  cache.hasSource = settingsFileFingerprint(cache.sourceSize, cache.sourceMtime);
+  if (!copySettingsString(cache.ssid, sizeof(cache.ssid), settings.ssid) ||
+      !copySettingsString(cache.password, sizeof(cache.password), settings.password) ||
+      !copySettingsString(cache.postUrl, sizeof(cache.postUrl), settings.postUrl))
+  {
+    LOGW("Settings too long for NVS cache, JSON will be parsed on every boot");
+    preferences.remove(SETTINGS_CACHE_KEY);
+    return;
+  }
+  cache.id = settings.id;
+  cache.useStaticIP = settings.useStaticIP;
+  cache.staticIP = (uint32_t)settings.staticIP;
+  cache.gateway = (uint32_t)settings.gateway;
+  cache.subnet = (uint32_t)settings.subnet;
+  cache.dnsServer = (uint32_t)settings.dnsServer;
+  cache.crc = settingsCacheCrc(cache);
+
+  if (preferences.putBytes(SETTINGS_CACHE_KEY, &cache, sizeof(cache)) != sizeof(cache))
+  {
+    LOGW("Failed to write settings cache to NVS");
+  }
+}
+
+// Loads settings from the NVS blob if it is intact, matches this firmware's
+// layout and still describes the /settings.json on the card.
+bool loadSettingsCache()
+{
+  SettingsCache cache;
+  if (preferences.getBytesLength(SETTINGS_CACHE_KEY) != sizeof(cache) ||
+      preferences.getBytes(SETTINGS_CACHE_KEY, &cache, sizeof(cache)) != sizeof(cache))
+  {
+    return false;
+  }
+  if (cache.version != SETTINGS_CACHE_VERSION || cache.length != sizeof(cache) || cache.crc != settingsCacheCrc(cache))
+  {
+    LOGW("Settings cache in NVS is invalid, ignoring it");
+    return false;
+  }
+  if (cache.ssid[sizeof(cache.ssid) - 1] != '\0' || cache.password[sizeof(cache.password) - 1] != '\0' ||
+      cache.postUrl[sizeof(cache.postUrl) - 1] != '\0' || cache.postUrl[0] == '\0')
+  {
+    return false;
+  }
+
+  uint32_t sourceSize, sourceMtime;
+  bool hasSource = settingsFileFingerprint(sourceSize, sourceMtime);
+  if (hasSource && (!cache.hasSource || sourceSize != cache.sourceSize || sourceMtime != cache.sourceMtime))
+  {
+    LOGI("Settings file changed since it was cached");
+    return false;
+  }
+
+  settings.ssid = cache.ssid;
+  settings.password = cache.password;
+  settings.id = cache.id;
+  settings.useStaticIP = cache.useStaticIP;
+  settings.staticIP = IPAddress(cache.staticIP);
+  settings.gateway = IPAddress(cache.gateway);
+  settings.subnet = IPAddress(cache.subnet);
+  settings.dnsServer = IPAddress(cache.dnsServer);
+  settings.postUrl = cache.postUrl;
+  return true;
+}
+
+// Dotted quad into a buffer of at least 16 bytes, without a String
+void formatIP(char *text, const IPAddress &ip)
+{
+  snprintf(text, 16, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+}
+
 void loadSettings()
 {
-  addToSerialBuffer("Starting to load settings...");
+  LOGD("Starting to load settings...");
+  preferences.begin(SETTINGS_CACHE_NAMESPACE, false);
+  logger.setLevel(preferences.getUChar(LOG_LEVEL_KEY, LOG_LEVEL_INFO));
+  if (loadSettingsCache())
+  {
+    LOGI("Settings loaded from NVS cache");
+    logSettings();
+    return;
+  }
+
   if (SD.exists("/settings.json"))
   {
-    addToSerialBuffer("Settings file found. Attempting to read...");
+    LOGD("Settings file found. Attempting to read...");
     File file = SD.open("/settings.json", FILE_READ);
     if (file)
     {
-      addToSerialBuffer("Settings file opened successfully.");
-      DynamicJsonDocument doc(1024);
+      ArenaScope scope(requestArena);
+      JsonDocument doc(&requestJsonAllocator);
       DeserializationError error = deserializeJson(doc, file);
+      file.close();
       if (error)
       {
-        addToSerialBuffer("Failed to read settings file: " + String(error.c_str()));
+        LOGE("Failed to read settings file: %s", error.c_str());
       }
       else
       {
-        addToSerialBuffer("Settings file parsed successfully. Loading values...");
         settings.ssid = doc["ssid"].as<String>();
         settings.password = doc["password"].as<String>();
         settings.id = doc["id"].as<int>();
         settings.useStaticIP = doc["useStaticIP"] | true; // Default to true if not present
-        settings.staticIP.fromString(doc["staticIP"].as<String>());
-        settings.gateway.fromString(doc["gateway"].as<String>());
-        settings.subnet.fromString(doc["subnet"].as<String>());
-        settings.dnsServer.fromString(doc["dnsServer"].as<String>());
+        settings.staticIP.fromString(doc["staticIP"] | "");
+        settings.gateway.fromString(doc["gateway"] | "");
+        settings.subnet.fromString(doc["subnet"] | "");
+        settings.dnsServer.fromString(doc["dnsServer"] | "");
         settings.postUrl = doc["postUrl"].as<String>();
 
-        addToSerialBuffer("All settings loaded:");
-        addToSerialBuffer("SSID: " + settings.ssid);
-        addToSerialBuffer("Password: " + settings.password);
-        addToSerialBuffer("ID: " + String(settings.id));
-        addToSerialBuffer("Use Static IP: " + String(settings.useStaticIP ? "Yes" : "No"));
-        addToSerialBuffer("Static IP: " + settings.staticIP.toString());
-        addToSerialBuffer("Gateway: " + settings.gateway.toString());
-        addToSerialBuffer("Subnet: " + settings.subnet.toString());
-        addToSerialBuffer("DNS Server: " + settings.dnsServer.toString());
-        addToSerialBuffer("Post URL: " + settings.postUrl);
+        LOGI("Settings loaded from file");
+        logSettings();
+        storeSettingsCache();
       }
-      file.close();
-      addToSerialBuffer("Settings file closed.");
     }
     else
     {
-      addToSerialBuffer("Failed to open settings file.");
+      LOGE("Failed to open settings file.");
     }
   }
   else
   {
-    addToSerialBuffer("Settings file not found. Loading default settings...");
+    LOGW("Settings file not found. Loading default settings...");
     // Default settings
     settings.ssid = "SRS";
     settings.password = "SRS@2023";
@@ -204,22 +671,12 @@ void loadSettings()
     settings.subnet.fromString("255.255.255.0");
     settings.dnsServer.fromString("192.168.1.22");
     settings.postUrl = "http://srs-ssms.com/iot/post-aws-to-api.php";
-
-    addToSerialBuffer("Default settings loaded. Printing all settings:");
-    addToSerialBuffer("SSID: " + settings.ssid);
-    addToSerialBuffer("Password: " + settings.password);
-    addToSerialBuffer("ID: " + String(settings.id));
-    addToSerialBuffer("Use Static IP: " + String(settings.useStaticIP ? "Yes" : "No"));
-    addToSerialBuffer("Static IP: " + settings.staticIP.toString());
-    addToSerialBuffer("Gateway: " + settings.gateway.toString());
-    addToSerialBuffer("Subnet: " + settings.subnet.toString());
-    addToSerialBuffer("DNS Server: " + settings.dnsServer.toString());
-    addToSerialBuffer("Post URL: " + settings.postUrl);
+    logSettings();
 
     saveSettings();
-    addToSerialBuffer("Default settings saved to file.");
+    LOGI("Default settings saved to file.");
   }
-  addToSerialBuffer("Settings loading process completed.");
+  LOGD("Settings loading process completed.");
 }
 
 void saveSettings()
@@ -227,31 +684,47 @@ void saveSettings()
   File file = SD.open("/settings.json", FILE_WRITE);
   if (file)
   {
-    DynamicJsonDocument doc(1024);
+    ArenaScope scope(requestArena);
+    JsonDocument doc(&requestJsonAllocator);
+    char staticIP[16], gateway[16], subnet[16], dnsServer[16];
+    formatIP(staticIP, settings.staticIP);
+    formatIP(gateway, settings.gateway);
+    formatIP(subnet, settings.subnet);
+    formatIP(dnsServer, settings.dnsServer);
     doc["ssid"] = settings.ssid;
     doc["password"] = settings.password;
     doc["id"] = settings.id;
     doc["useStaticIP"] = settings.useStaticIP;
-    doc["staticIP"] = settings.staticIP.toString();
-    doc["gateway"] = settings.gateway.toString();
-    doc["subnet"] = settings.subnet.toString();
-    doc["dnsServer"] = settings.dnsServer.toString();
+    doc["staticIP"] = staticIP;
+    doc["gateway"] = gateway;
+    doc["subnet"] = subnet;
+    doc["dnsServer"] = dnsServer;
     doc["postUrl"] = settings.postUrl;
     if (serializeJson(doc, file) == 0)
     {
-      addToSerialBuffer("Failed to write settings file");
+      LOGE("Failed to write settings file");
     }
+    fileIndexPut("/settings.json", file.size());
     file.close();
   }
   else
   {
-    addToSerialBuffer("Failed to open settings file for writing");
+    LOGE("Failed to open settings file for writing");
   }
+  storeSettingsCache();
 }
 
 void handleRoot()
 {
-  String html = "<html><head>";
+  ArenaScope scope(requestArena);
+  char staticIP[16], gateway[16], subnet[16], dnsServer[16];
+  formatIP(staticIP, settings.staticIP);
+  formatIP(gateway, settings.gateway);
+  formatIP(subnet, settings.subnet);
+  formatIP(dnsServer, settings.dnsServer);
+
+  ArenaText html(requestArena);
+  html += "<html><head>";
   html += "<style>";
   html += "table { border-collapse: collapse; width: 100%; }";
   html += "th, td { text-align: left; padding: 8px; }";
@@ -264,15 +737,15 @@ void handleRoot()
   html += "<h1>Weather Station Settings</h1>";
   html += "<form action='/save' method='POST'>";
   html += "<table>";
-  html += "<tr><td>SSID:</td><td><input type='text' name='ssid' value='" + settings.ssid + "'></td></tr>";
-  html += "<tr><td>Password:</td><td><input type='text' name='password' value='" + settings.password + "'></td></tr>";
-  html += "<tr><td>ID:</td><td><input type='number' name='id' value='" + String(settings.id) + "'></td></tr>";
-  html += "<tr><td>Use Static IP:</td><td><input type='checkbox' name='useStaticIP' " + String(settings.useStaticIP ? "checked" : "") + "></td></tr>";
-  html += "<tr><td>Static IP:</td><td><input type='text' name='staticIP' value='" + settings.staticIP.toString() + "'></td></tr>";
-  html += "<tr><td>Gateway:</td><td><input type='text' name='gateway' value='" + settings.gateway.toString() + "'></td></tr>";
-  html += "<tr><td>Subnet:</td><td><input type='text' name='subnet' value='" + settings.subnet.toString() + "'></td></tr>";
-  html += "<tr><td>DNS Server:</td><td><input type='text' name='dnsServer' value='" + settings.dnsServer.toString() + "'></td></tr>";
-  html += "<tr><td>Post URL:</td><td><input type='text' name='postUrl' value='" + settings.postUrl + "'></td></tr>";
+  html.appendf("<tr><td>SSID:</td><td><input type='text' name='ssid' value='%s'></td></tr>", settings.ssid.c_str());
+  html.appendf("<tr><td>Password:</td><td><input type='text' name='password' value='%s'></td></tr>", settings.password.c_str());
+  html.appendf("<tr><td>ID:</td><td><input type='number' name='id' value='%d'></td></tr>", settings.id);
+  html.appendf("<tr><td>Use Static IP:</td><td><input type='checkbox' name='useStaticIP' %s></td></tr>", settings.useStaticIP ? "checked" : "");
+  html.appendf("<tr><td>Static IP:</td><td><input type='text' name='staticIP' value='%s'></td></tr>", staticIP);
+  html.appendf("<tr><td>Gateway:</td><td><input type='text' name='gateway' value='%s'></td></tr>", gateway);
+  html.appendf("<tr><td>Subnet:</td><td><input type='text' name='subnet' value='%s'></td></tr>", subnet);
+  html.appendf("<tr><td>DNS Server:</td><td><input type='text' name='dnsServer' value='%s'></td></tr>", dnsServer);
+  html.appendf("<tr><td>Post URL:</td><td><input type='text' name='postUrl' value='%s'></td></tr>", settings.postUrl.c_str());
   html += "<tr><td colspan='2'><input type='submit' value='Save'></td></tr>";
   html += "</table>";
   html += "</form>";
@@ -283,25 +756,31 @@ void handleRoot()
 
   // Add SD card file listing with download and delete options
   html += "<h2>SD Card Files</h2>";
+  html += "<p><a href='/export' class='download'>DOWNLOAD ALL (TAR)</a> <a href='/journal.csv' class='download'>STORED DATA (CSV)</a></p>";
   html += "<table>";
-  html += "<tr><th>File Name</th><th>Actions</th></tr>";
-  File root = SD.open("/");
-  while (File file = root.openNextFile())
-  {
-    String fileName = String(file.name());
-    html += "<tr><td>" + fileName + "</td><td>";
-    html += "<a href='/download?file=" + fileName + "' class='download'>DOWNLOAD</a> | ";
-    html += "<a href='/delete?file=" + fileName + "' class='delete' onclick='return confirm(\"Are you sure you want to delete this file?\")'>DELETE</a>";
-    html += "</td></tr>";
-    file.close();
-  }
+  html += "<thead><tr><th onclick='sortBy(\"name\")'>File Name</th><th onclick='sortBy(\"size\")'>Size</th><th onclick='sortBy(\"mtime\")'>Modified</th><th>Actions</th></tr></thead>";
+  html += "<tbody id='files'></tbody>";
   html += "</table>";
+  html += "<p><button onclick='page(-1)'>&lt;</button> <span id='pages'></span> <button onclick='page(1)'>&gt;</button></p>";
+  // The listing is rendered from /api/files so this page never walks the card
+  html += "<script>";
+  html += "let p=0,s='name',o='asc',n=1;";
+  html += "function load(){fetch(`/api/files?page=${p}&sort=${s}&order=${o}`).then(r=>r.json()).then(d=>{";
+  html += "n=Math.max(1,Math.ceil(d.total/d.limit));";
+  html += "document.getElementById('files').innerHTML=d.files.map(f=>`<tr><td>${f.name}</td><td>${f.size}</td><td>${new Date(f.mtime*1000).toISOString().slice(0,19).replace('T',' ')}</td><td>";
+  html += "<a href='/download?file=${f.name}' class='download'>DOWNLOAD</a> | ";
+  html += "<a href='/delete?file=${f.name}' class='delete' onclick='return confirm(\"Are you sure you want to delete this file?\")'>DELETE</a></td></tr>`).join('');";
+  html += "document.getElementById('pages').textContent=`Page ${p+1} of ${n}`;});}";
+  html += "function sortBy(k){o=(s==k&&o=='asc')?'desc':'asc';s=k;p=0;load();}";
+  html += "function page(d){p=Math.min(n-1,Math.max(0,p+d));load();}";
+  html += "load();";
+  html += "</script>";
 
   html += "<h2>Serial Monitor</h2>";
   html += "<pre id='serial'></pre>";
   html += "<script>setInterval(() => fetch('/serial').then(r => r.text()).then(t => document.getElementById('serial').textContent = t), 1000);</script>";
   html += "</body></html>";
-  server.send(200, "text/html", html);
+  server.send(200, "text/html", html.c_str(), html.length());
 }
 
 void handleDelete()
@@ -311,6 +790,7 @@ void handleDelete()
   {
     if (SD.remove("/" + fileName))
     {
+      fileIndexRemove(fileName.c_str());
       server.sendHeader("Location", "/");
       server.send(303);
     }
@@ -325,6 +805,26 @@ void handleDelete()
   }
 }
 
+// Streams a file from the card in slices as the connection drains
+class SdFileStream : public HttpStream
+{
+public:
+  SdFileStream(File file) : _file(file), _remaining(file.size()) {}
+  ~SdFileStream() { _file.close(); }
+
+  size_t read(uint8_t *buffer, size_t size)
+  {
+    // Never send more than the Content-Length announced, even if the file grew
+    size_t n = _file.read(buffer, size < _remaining ? size : _remaining);
+    _remaining -= n;
+    return n;
+  }
+
+private:
+  File _file;
+  uint32_t _remaining;
+};
+
 void handleDownload()
 {
   String fileName = server.arg("file");
@@ -333,523 +833,1861 @@ void handleDownload()
     File file = SD.open("/" + fileName, FILE_READ);
     if (file)
     {
-      server.sendHeader("Content-Type", "text/plain");
       server.sendHeader("Content-Disposition", "attachment; filename=" + fileName);
-      server.streamFile(file, "text/plain");
-      file.close();
+      server.sendStream(200, "text/plain", file.size(), new SdFileStream(file));
       return;
     }
   }
   server.send(404, "text/plain", "File not found");
 }
 
-void handleSaveSettings()
+// Parses a YYYY-MM-DD query argument, returns 0 if it is missing or malformed
+time_t parseDateArg(const String &value)
 {
-  String newSSID = server.arg("ssid");
-  String newPassword = server.arg("password");
-  bool networkChanged = (newSSID != settings.ssid) || (newPassword != settings.password);
-
-  settings.ssid = newSSID;
-  settings.password = newPassword;
-  settings.id = server.arg("id").toInt();
-  settings.useStaticIP = server.hasArg("useStaticIP");
-  settings.staticIP.fromString(server.arg("staticIP"));
-  settings.gateway.fromString(server.arg("gateway"));
-  settings.subnet.fromString(server.arg("subnet"));
-  settings.dnsServer.fromString(server.arg("dnsServer"));
-  settings.postUrl = server.arg("postUrl");
-  saveSettings();
-
-  if (networkChanged || settings.useStaticIP != server.hasArg("useStaticIP"))
+  if (value.length() != 10 || value[4] != '-' || value[7] != '-')
   {
-    server.send(200, "text/html", "<html><body><h1>Settings Saved</h1><p>Reconnecting to network...</p><script>setTimeout(function(){ window.location.href = '/'; }, 10000);</script></body></html>");
-    delay(1000); // Give the server time to send the response
-    ESP.restart();
-  }
-  else
-  {
-    server.sendHeader("Location", "/");
-    server.send(303);
+    return 0;
   }
+  tmElements_t tm;
+  tm.Year = CalendarYrToTm(value.substring(0, 4).toInt());
+  tm.Month = value.substring(5, 7).toInt();
+  tm.Day = value.substring(8, 10).toInt();
+  tm.Hour = 0;
+  tm.Minute = 0;
+  tm.Second = 0;
+  return makeTime(tm);
 }
 
-void handleSerial()
+// Produces the archive piece by piece as the connection drains, walking the
+// card as it goes so there is no list of files to outgrow. Directories are
+// visited breadth first, the root and then the journals and everything else
+// below it, keeping one directory open at a time. Every part of a tar
+// file is a whole number of 512 byte blocks, so with a buffer of whole sectors
+// the file reads stay sector aligned. A file's size is taken when its header
+// is written; a file that shrinks afterwards is padded with zeros.
+class TarExportStream : public HttpStream
 {
-  String output;
-  for (int i = 0; i < SERIAL_BUFFER_SIZE; i++)
+public:
+  TarExportStream(const char *files, time_t from, time_t to) : _from(from), _to(to)
   {
-    int index = (serialBufferIndex + i) % SERIAL_BUFFER_SIZE;
-    if (serialBuffer[index].length() > 0)
-    {
-      output += serialBuffer[index] + "\n";
-    }
+    snprintf(_files, sizeof(_files), ",%s,", files);
+    queueDir("/");
   }
-  server.send(200, "text/plain", output);
-}
 
-void handlePost()
-{
-  if (server.method() == HTTP_POST)
+  ~TarExportStream()
   {
-    String dateutc, baromabsin, windgustmph, baromrelin, date_jkt, solarradiation, windgustkmh, windspeedkmh, windspeedmph, winddir, rainratein, tempf, tempinf, humidityin, uv, humidity;
-    String dailyrainin, raintodayin, totalrainin, weeklyrainin, monthlyrainin, yearlyrainin, maxdailygust, wh65batt;
-    float temp_in, temp_out = 0;
-    DateTime datetimeNow, datetimePlus;
-
-    dateutc = server.arg("dateutc");
-
-    addToSerialBuffer("DATEUTC: " + String(dateutc));
-
-    uint16_t year = 0;
-    uint8_t month, day, hour, minute, second = 0;
-    // Parse the input date-time string
-    year = dateutc.substring(0, 4).toInt();
-    month = dateutc.substring(5, 7).toInt();
-    day = dateutc.substring(8, 10).toInt();
-    hour = dateutc.substring(11, 13).toInt();
-    minute = dateutc.substring(14, 16).toInt();
-    second = dateutc.substring(17, 19).toInt();
-
-    String substr = "substr: " + String(year) + "," + String(month) + "," + String(day) + "," + String(hour) + "," + String(minute) + "," + String(second);
-
-    // Add 7 hours
-    hour += 7;
-
-    // Adjust the date and time values if necessary
-    if (hour >= 24)
+    if (_file)
     {
-      hour -= 24;
-      day += 1;
-    }
-    if (month == 2 && day > 28)
-    { // Adjust for February having 28 days
-      day = 1;
-      month += 1;
+      _file.close();
     }
-    else if ((month == 4 || month == 6 || month == 9 || month == 11) && day > 30)
-    { // Adjust for months with 30 days
-      day = 1;
-      month += 1;
-    }
-    else if (day > 31)
-    { // Adjust for months with 31 days
-      day = 1;
-      month += 1;
-    }
-    if (month > 12)
-    { // Adjust for changing years
-      month = 1;
-      year += 1;
-    }
-
-    String month_str = zeroDate(month);
-    String day_str = zeroDate(day);
-    String hour_str = zeroDate(hour);
-    String minute_str = zeroDate(minute);
-    String second_str = zeroDate(second);
-
-    // Construct the adjusted date string
-    String new_date_string = String(year) + "-" + String(month_str) + "-" + String(day_str) + " " + String(hour_str) + ":" + String(minute_str) + ":" + String(second_str);
-    // Print the adjusted date string
-    // addToSerialBuffer(new_date_string);
-
-    tempinf = server.arg("tempinf");
-    tempf = server.arg("tempf");
-    windspeedmph = server.arg("windspeedmph");
-    windgustmph = server.arg("windgustmph");
-
-    windgustmph = windgustmph.toFloat() * 1.60934;
-    windspeedkmh = windspeedmph.toFloat() * 1.60934;
-    winddir = server.arg("winddir");
-    rainratein = server.arg("rainratein");
-    temp_in = (5.0 / 9.0) * (tempinf.toFloat() - 32.0);
-    humidityin = server.arg("humidityin");
-    uv = server.arg("uv");
-    temp_out = (5.0 / 9.0) * (tempf.toFloat() - 32.0);
-    humidity = server.arg("humidity");
-    solarradiation = server.arg("solarradiation");
-    baromrelin = server.arg("baromrelin");
-    baromabsin = server.arg("baromabsin");
-
-    // New parameters
-    dailyrainin = server.arg("dailyrainin");
-    raintodayin = server.arg("raintodayin");
-    totalrainin = server.arg("totalrainin");
-    weeklyrainin = server.arg("weeklyrainin");
-    monthlyrainin = server.arg("monthlyrainin");
-    yearlyrainin = server.arg("yearlyrainin");
-    maxdailygust = server.arg("maxdailygust");
-    wh65batt = server.arg("wh65batt");
-
-    String data = new_date_string + "," + windspeedkmh + "," + winddir + "," + rainratein + "," + temp_in + "," + temp_out + "," + humidityin + "," + humidity + "," + uv + "," + windgustmph + "," + baromrelin + "," + baromabsin + "," + solarradiation + "," + dailyrainin + "," + raintodayin + "," + totalrainin + "," + weeklyrainin + "," + monthlyrainin + "," + yearlyrainin + "," + maxdailygust + "," + wh65batt;
-
-    addToSerialBuffer("SAVED DATA: " + data);
-
-    if (data != "")
+    if (_dir)
     {
-      checkSend = true;
+      _dir.close();
     }
-
-    appendFile(SD, "/data.txt", String(data));
-
-    server.send(200, "text/plain", "Data saved to SD card.");
-    digitalWrite(LED_BUILTIN, HIGH);
-    delay(200);
-    digitalWrite(LED_BUILTIN, LOW);
-    delay(200);
-    digitalWrite(LED_BUILTIN, HIGH);
-    delay(200);
-    digitalWrite(LED_BUILTIN, LOW);
-    delay(200);
-    digitalWrite(LED_BUILTIN, HIGH);
-    delay(200);
-    digitalWrite(LED_BUILTIN, LOW);
-  }
-}
-
-void setup()
-{
-  Serial.begin(115200);
-
-  watchdogTicker.attach(WATCHDOG_TIMEOUT, resetWatchdog);
-  pinMode(relayPin, OUTPUT);
-  digitalWrite(relayPin, LOW);
-  delay(4000);
-  digitalWrite(relayPin, HIGH);
-
-  if (!SD.begin(csPin))
-  {
-    addToSerialBuffer("Card failed, or not present");
   }
-  addToSerialBuffer("Card initialized successfully");
-
-  loadSettings();
-
-  connectWiFi();
-
-  // Set up ESP32 as an Access Point with the specified IP and credentials
-  WiFi.softAPConfig(ap_local_ip, ap_gateway, ap_subnet); // Configure AP with static IP
-  WiFi.softAP(ap_ssid, ap_password);                     // Start the Access Point
-
-  Serial.println("ESP32 Access Point started");
-  Serial.print("AP IP Address: ");
-  Serial.println(WiFi.softAPIP()); // Should be 192.168.8.1
-
-  server.on("/", handleRoot);
-  server.on("/save", HTTP_POST, handleSaveSettings);
-  server.on("/post", handlePost);
-  server.on("/serial", handleSerial);
-  server.on("/download", handleDownload);
-  server.on("/delete", handleDelete);
-  server.on("/restart", handleRestart); // Add this line
-
-  server.begin();
-  addToSerialBuffer("Server started");
-
-  pinMode(LED_BUILTIN, OUTPUT);
-  digitalWrite(LED_BUILTIN, LOW);
-
-  sendTimer.every(delayMill, sendData);
-}
-
-#include <ArduinoJson.h>
-
-String constructJsonData(const String values[], int size)
-{
-  DynamicJsonDocument doc(1536); // Increased size to accommodate new parameters
-  doc["idws"] = settings.id;
 
-  const char *keys[] = {"date", "windspeedkmh", "winddir", "rain_rate", "temp_in", "temp_out",
-                        "hum_in", "hum_out", "uv", "wind_gust", "air_press_rel",
-                        "air_press_abs", "solar_radiation", "dailyrainin", "raintodayin",
-                        "totalrainin", "weeklyrainin", "monthlyrainin", "yearlyrainin",
-                        "maxdailygust", "wh65batt"};
+  // One archive at a time lives in a fixed slot rather than on the heap;
+  // new gives nullptr while the slot is taken
+  static void *operator new(size_t size) noexcept;
+  static void operator delete(void *block);
 
-  for (int i = 0; i < size; i++)
+  // Opens the next selected file; false once the walk is over
+  bool nextFile()
   {
-    String value = values[i];
-    value.trim(); // Remove leading/trailing whitespace and control characters
-
-    if (value.length() > 0 && value != "NULL" && value != "null")
+    while (_dir || nextDir())
     {
-      if (i == 0)
-      {
-        doc[keys[i]] = value; // Store date as a string
-      }
-      else if (i == 1 && (value == "0" || value == "0.00"))
+      File file = _dir.openNextFile();
+      if (!file)
       {
-        doc[keys[i]] = 0.00; // Specifically handle 0 or 0.00 for windspeedkmh
+        _dir.close();
+        continue;
       }
-      else if (value.toFloat() != 0 || value == "0")
+      if (file.isDirectory())
       {
-        doc[keys[i]] = value.toFloat();
+        queueDir(file.path());
+        file.close();
+        continue;
       }
-      else
+      const char *name = file.path() + 1; // relative to the card root, as tar expects
+      time_t mtime = file.getLastWrite();
+      if (strlen(name) < TAR_NAME_SIZE && selected(name, mtime))
       {
-        doc[keys[i]] = value;
+        strcpy(_name, name);
+        _size = file.size();
+        _mtime = mtime;
+        _file = file;
+        return true;
       }
+      file.close();
     }
-    else
-    {
-      doc[keys[i]] = JsonVariant(); // This creates a null value in JSON
-    }
-  }
-
-  String output;
-  serializeJson(doc, output);
-  return output;
-}
-
-void sendData()
-{
-  if (WiFi.status() != WL_CONNECTED)
-  {
-    addToSerialBuffer("WiFi disconnected");
-    connectWiFi();
+    return false;
   }
 
-  String rawText;
-  myFile = SD.open("/data.txt");
-  if (myFile)
+  size_t read(uint8_t *buffer, size_t size)
   {
-    rawText = myFile.readStringUntil('\n');
-    myFile.close();
-
-    // Check if the data is empty or contains errors
-    if (rawText.length() == 0 || rawText.indexOf("error") != -1)
-    {
-      addToSerialBuffer("Empty or error data found. Deleting line.");
-      deleteTopLine();
-      return; // Exit the function early
-    }
-
-    if (rawText != "")
+    size_t filled = 0;
+    while (filled < size && _phase != EXPORT_DONE)
     {
-      String values[21]; // Increased array size to accommodate new parameters
-      int index = 0;
-      while (rawText.length() > 0 && index < 21)
+      if (_phase == EXPORT_HEADER)
       {
-        int separatorIndex = rawText.indexOf(",");
-        if (separatorIndex == -1)
+        if (_offset == 0)
         {
-          values[index] = rawText;
-          values[index].trim(); // Remove leading/trailing whitespace and control characters
-          index++;
-          break;
+          tarBuildHeader(_header, _name, _size, _mtime);
+        }
+        size_t n = TAR_BLOCK_SIZE - _offset < size - filled ? TAR_BLOCK_SIZE - _offset : size - filled;
+        memcpy(buffer + filled, _header + _offset, n);
+        _offset += n;
+        filled += n;
+        if (_offset == TAR_BLOCK_SIZE)
+        {
+          _offset = 0;
+          _remaining = _size;
+          _phase = EXPORT_BODY;
         }
-        values[index] = rawText.substring(0, separatorIndex);
-        values[index].trim(); // Remove leading/trailing whitespace and control characters
-        index++;
-        rawText = rawText.substring(separatorIndex + 1);
       }
-
-      // Fill remaining values with empty strings if necessary
-      while (index < 21)
+      else if (_phase == EXPORT_BODY && _remaining > 0)
       {
-        values[index++] = "NULL";
+        size_t chunk = _remaining < size - filled ? _remaining : size - filled;
+        size_t got = _file ? _file.read(buffer + filled, chunk) : 0;
+        if (got < chunk)
+        {
+          // The file shrank since its header was written; pad so the archive stays well formed
+          memset(buffer + filled + got, 0, chunk - got);
+        }
+        filled += chunk;
+        _remaining -= chunk;
       }
-
-      // Validate date format
-      if (values[0].length() != 19 || values[0][4] != '-' || values[0][7] != '-' || values[0][10] != ' ' || values[0][13] != ':' || values[0][16] != ':')
+      else if (_phase == EXPORT_BODY)
       {
-        addToSerialBuffer("Invalid date format. Expected YYYY-MM-DD HH:MM:SS");
-        return; // Exit the function if date format is invalid
+        _file.close();
+        _count++;
+        _remaining = tarPaddingSize(_size);
+        _phase = EXPORT_PADDING;
       }
-
-      WiFiClient client;
-      HTTPClient http;
-
-      String data = constructJsonData(values, 21);
-
-      addToSerialBuffer("Attempting to send data: " + data);
-      http.begin(client, settings.postUrl); // Use the new postUrl from settings
-      http.addHeader("Content-Type", "application/json");
-      int httpCode = http.POST(data);
-
-      if (httpCode == 200)
+      else if (_remaining > 0) // padding or trailer
       {
-        String response = http.getString();
-        addToSerialBuffer("HTTP response: " + response);
-        deleteTopLine();
-        addToSerialBuffer("Data sent successfully. Line deleted.");
+        size_t n = _remaining < size - filled ? _remaining : size - filled;
+        memset(buffer + filled, 0, n);
+        filled += n;
+        _remaining -= n;
       }
-      else if (httpCode > 0)
+      else if (_phase == EXPORT_PADDING)
       {
-        String response = http.getString();
-        addToSerialBuffer("HTTP error response: " + response);
+        if (nextFile())
+        {
+          _phase = EXPORT_HEADER;
+        }
+        else
+        {
+          _phase = EXPORT_TRAILER;
+          _remaining = TAR_TRAILER_SIZE;
+        }
       }
       else
       {
-        addToSerialBuffer("HTTP error: " + String(httpCode));
+        _phase = EXPORT_DONE;
+        LOGI("Exported %d files", _count);
       }
-      http.end();
     }
-    else
+    return filled;
+  }
+
+private:
+  enum
+  {
+    EXPORT_HEADER,
+    EXPORT_BODY,
+    EXPORT_PADDING,
+    EXPORT_TRAILER,
+    EXPORT_DONE
+  } _phase = EXPORT_HEADER;
+  char _files[EXPORT_FILES_SIZE + 2]; // ",a.txt,b.txt," or ",," for every file
+  time_t _from;
+  time_t _to;
+  char _dirs[EXPORT_MAX_DIRS][TAR_NAME_SIZE];
+  int _dirCount = 0;
+  int _dirNext = 0;
+  File _dir;
+  File _file;
+  char _name[TAR_NAME_SIZE];
+  uint32_t _size = 0;
+  uint32_t _mtime = 0;
+  int _count = 0;
+  uint32_t _offset = 0;
+  uint32_t _remaining = 0;
+  uint8_t _header[TAR_BLOCK_SIZE];
+
+  void queueDir(const char *path)
+  {
+    if (_dirCount == EXPORT_MAX_DIRS || strlen(path) >= TAR_NAME_SIZE)
     {
-      addToSerialBuffer("No data to send.");
+      LOGW("Export: directory %s left out", path);
+      return;
     }
+    strcpy(_dirs[_dirCount++], path);
   }
-  else
+
+  // Opens the next queued directory; false once all have been walked
+  bool nextDir()
   {
-    addToSerialBuffer("Error opening file!");
+    if (_dirNext == _dirCount)
+    {
+      return false;
+    }
+    _dir = SD.open(_dirs[_dirNext++]);
+    return true;
   }
 
-  Serial.print("loop ke ");
-  testLoop++;
-  addToSerialBuffer(String(testLoop));
+  bool selected(const char *name, time_t mtime) const
+  {
+    if ((_from != 0 && mtime < _from) || (_to != 0 && mtime >= _to))
+    {
+      return false;
+    }
+    if (_files[1] == ',')
+    {
+      return true;
+    }
+    char pattern[TAR_NAME_SIZE + 2];
+    snprintf(pattern, sizeof(pattern), ",%s,", name);
+    return strstr(_files, pattern) != nullptr;
+  }
+};
+
+alignas(TarExportStream) uint8_t exportSlot[sizeof(TarExportStream)];
+bool exportSlotTaken = false;
+
+void *TarExportStream::operator new(size_t size) noexcept
+{
+  if (exportSlotTaken || size > sizeof(exportSlot))
+  {
+    return nullptr;
+  }
+  exportSlotTaken = true;
+  return exportSlot;
 }
 
-void connectWiFi()
+void TarExportStream::operator delete(void *block)
+{
+  if (block == exportSlot)
+  {
+    exportSlotTaken = false;
+  }
+}
+
+// Streams a tar archive of the selected files straight from SD to the socket.
+// ?files=a.txt,journal/state0 picks files by path, ?from=YYYY-MM-DD&to=YYYY-MM-DD
+// picks them by modification date; without arguments every file on the card is
+// sent, the journals included.
+// The archive is walked while it is sent, so its length is not known up front.
+void handleExport()
+{
+  const char *files = server.argValue("files");
+  time_t from = parseDateArg(server.arg("from"));
+  time_t to = parseDateArg(server.arg("to"));
+  if (to != 0)
+  {
+    to += SECS_PER_DAY; // the end date is inclusive
+  }
+  if (strlen(files) > EXPORT_FILES_SIZE)
+  {
+    server.send(400, "text/plain", "File list too long.");
+    return;
+  }
+
+  TarExportStream *archive = new TarExportStream(files, from, to);
+  if (archive == nullptr)
+  {
+    char retryAfter[12];
+    snprintf(retryAfter, sizeof(retryAfter), "%d", HTTP_RETRY_AFTER);
+    server.sendHeader("Retry-After", retryAfter);
+    server.send(503, "text/plain", "Another export is in progress.");
+    return;
+  }
+  if (!archive->nextFile())
+  {
+    delete archive;
+    server.send(404, "text/plain", "No matching files");
+    return;
+  }
+
+  server.sendHeader("Content-Disposition", "attachment; filename=station_" + String(settings.id) + ".tar");
+  server.sendStream(200, "application/x-tar", HTTP_LENGTH_UNKNOWN, archive);
+}
+
+// Index names are relative to the card root, paths passed around the code are not
+const char *fileIndexName(const char *path)
+{
+  return path[0] == '/' ? path + 1 : path;
+}
+
+void fileIndexPut(const char *path, uint32_t size)
+{
+  if (fileIndex.isValid())
+  {
+    fileIndex.put(fileIndexName(path), size, time(nullptr));
+  }
+}
+
+void fileIndexRemove(const char *path)
+{
+  if (fileIndex.isValid())
+  {
+    fileIndex.remove(fileIndexName(path));
+  }
+}
+
+// Walks the card root once after mount; afterwards the index is kept current by
+// the code paths that create, grow or delete files.
+void ensureFileIndex()
 {
-  if (settings.useStaticIP)
+  if (fileIndex.isValid())
+  {
+    return;
+  }
+  fileIndex.clear();
+  File root = SD.open("/");
+  if (root)
   {
-    if (!WiFi.config(settings.staticIP, settings.gateway, settings.subnet, settings.dnsServer))
+    while (File file = root.openNextFile())
     {
-      addToSerialBuffer("Failed to configure static IP. Falling back to dynamic IP.");
-      settings.useStaticIP = false;
+      if (!file.isDirectory())
+      {
+        fileIndex.put(file.name(), file.size(), file.getLastWrite());
+      }
+      file.close();
     }
+    root.close();
   }
+  fileIndex.setValid(true);
+  LOGI("File index rebuilt: %u files", fileIndex.count());
+}
 
-  WiFi.begin(settings.ssid.c_str(), settings.password.c_str());
-  addToSerialBuffer("Connecting to " + settings.ssid);
+// JSON listing of the card: ?page=0&limit=20&sort=name|size|mtime&order=asc|desc
+void handleFileList()
+{
+  ArenaScope scope(requestArena);
+  ensureFileIndex();
 
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20)
-  { // Try for about 20 seconds
-    delay(1000);
-    Serial.print(".");
-    attempts++;
+  int limit = server.hasArg("limit") ? atoi(server.argValue("limit")) : FILE_LIST_PAGE_SIZE;
+  if (limit < 1 || limit > FILE_LIST_MAX_PAGE_SIZE)
+  {
+    limit = FILE_LIST_PAGE_SIZE;
+  }
+  char *end;
+  long page = strtol(server.argValue("page"), &end, 10);
+  if (*end != '\0' || page < 0)
+  {
+    server.send(400, "text/plain", "page must be a number from 0 up.");
+    return;
+  }
+  if (page > fileIndex.count() / limit)
+  {
+    page = fileIndex.count() / limit; // past the end; keeps page * limit from overflowing
   }
 
-  if (WiFi.status() != WL_CONNECTED)
+  const char *sortArg = server.argValue("sort");
+  FileIndexSort sort = FILE_INDEX_SORT_NAME;
+  if (strcmp(sortArg, "size") == 0)
+  {
+    sort = FILE_INDEX_SORT_SIZE;
+  }
+  else if (strcmp(sortArg, "mtime") == 0)
+  {
+    sort = FILE_INDEX_SORT_MTIME;
+  }
+  bool descending = strcmp(server.argValue("order"), "desc") == 0;
+
+  const FileIndexEntry *rows[FILE_LIST_MAX_PAGE_SIZE];
+  int count = fileIndex.page(sort, descending, page * limit, limit, rows);
+
+  JsonDocument doc(&requestJsonAllocator);
+  doc["total"] = fileIndex.count();
+  doc["page"] = page;
+  doc["limit"] = limit;
+  doc["truncated"] = fileIndex.isTruncated();
+  JsonArray files = doc["files"].to<JsonArray>();
+  for (int i = 0; i < count; i++)
+  {
+    JsonObject file = files.add<JsonObject>();
+    file["name"] = rows[i]->name;
+    file["size"] = rows[i]->size;
+    file["mtime"] = rows[i]->mtime;
+  }
+  sendJson(doc);
+}
+
+bool networkSettingsDiffer(const Settings &a, const Settings &b)
+{
+  return a.ssid != b.ssid || a.password != b.password || a.useStaticIP != b.useStaticIP ||
+         (b.useStaticIP && (a.staticIP != b.staticIP || a.gateway != b.gateway || a.subnet != b.subnet || a.dnsServer != b.dnsServer));
+}
+
+void copyNetworkSettings(Settings &to, const Settings &from)
+{
+  to.ssid = from.ssid;
+  to.password = from.password;
+  to.useStaticIP = from.useStaticIP;
+  to.staticIP = from.staticIP;
+  to.gateway = from.gateway;
+  to.subnet = from.subnet;
+  to.dnsServer = from.dnsServer;
+}
+
+// Applies the settings form without a restart. Everything is validated first
+// and nothing changes if any field is rejected. The ID and Post URL are saved
+// and used from the next upload on; a network change reconnects in place and
+// is only saved once the new network connects (see updateWiFi()).
+void handleSaveSettings()
+{
+  Settings next = settings;
+  next.ssid = server.argValue("ssid");
+  next.password = server.argValue("password");
+  next.id = atoi(server.argValue("id"));
+  next.useStaticIP = server.hasArg("useStaticIP");
+  next.postUrl = server.argValue("postUrl");
+  bool addressesValid = next.staticIP.fromString(server.argValue("staticIP")) &&
+                        next.gateway.fromString(server.argValue("gateway")) &&
+                        next.subnet.fromString(server.argValue("subnet")) &&
+                        next.dnsServer.fromString(server.argValue("dnsServer"));
+
+  const char *error = nullptr;
+  if (next.ssid.length() == 0 || next.ssid.length() >= sizeof(SettingsCache::ssid))
+  {
+    error = "SSID must be 1 to 32 characters.";
+  }
+  else if (next.password.length() >= sizeof(SettingsCache::password))
+  {
+    error = "Password must be at most 64 characters.";
+  }
+  else if (next.id <= 0)
+  {
+    error = "ID must be a positive number.";
+  }
+  else if (next.useStaticIP && !addressesValid)
+  {
+    error = "Static IP, gateway, subnet and DNS server must be IPv4 addresses.";
+  }
+  else if (!next.postUrl.startsWith("http://") && !next.postUrl.startsWith("https://"))
+  {
+    error = "Post URL must start with http:// or https://.";
+  }
+  else if (next.postUrl.length() >= sizeof(SettingsCache::postUrl))
+  {
+    error = "Post URL is too long.";
+  }
+  if (error)
+  {
+    server.send(400, "text/plain", error);
+    return;
+  }
+  if (!next.useStaticIP && !addressesValid)
+  {
+    // Unused while on DHCP; keep the stored addresses
+    next.staticIP = settings.staticIP;
+    next.gateway = settings.gateway;
+    next.subnet = settings.subnet;
+    next.dnsServer = settings.dnsServer;
+  }
+
+  // A trial still running is settled in favour of the network last known to work
+  Settings working = settings;
+  bool abandonedTrial = wifiTrial;
+  if (wifiTrial)
+  {
+    copyNetworkSettings(working, wifiRollback);
+    wifiTrial = false;
+  }
+  bool networkChanged = networkSettingsDiffer(working, next);
+
+  // Save everything but the network now
+  settings = next;
+  copyNetworkSettings(settings, working);
+  saveSettings();
+  LOGI("Settings applied: ID %d, Post URL %s", settings.id, settings.postUrl);
+
+  if (!networkChanged)
   {
-    if (settings.useStaticIP)
+    if (abandonedTrial)
     {
-      addToSerialBuffer("Failed to connect with static IP. Trying dynamic IP.");
-      settings.useStaticIP = false;
       WiFi.disconnect();
-      delay(1000);
-      WiFi.begin(settings.ssid.c_str(), settings.password.c_str());
-      attempts = 0;
-      while (WiFi.status() != WL_CONNECTED && attempts < 20)
+      connectWiFi(); // back to the saved network
+    }
+    server.sendHeader("Location", "/");
+    server.send(303);
+    return;
+  }
+
+  wifiRollback = working;
+  copyNetworkSettings(settings, next);
+  wifiTrial = true;
+  LOGI("Trying network %s; the previous settings come back if it fails", settings.ssid);
+  server.send(200, "text/html", "<html><body><h1>Settings Saved</h1><p>Connecting to the new network. Data keeps being collected; if the network cannot be joined, the previous settings are restored.</p><script>setTimeout(function(){ window.location.href = '/'; }, 10000);</script></body></html>");
+  server.flush(1000); // the page goes out before the station interface drops
+  WiFi.disconnect();
+  connectWiFi();
+}
+
+// Formats the log ring on request; ?level=error|warn|info|debug also changes the runtime level
+void handleSerial()
+{
+  ArenaScope scope(requestArena);
+  if (server.hasArg("level"))
+  {
+    static const char *const levelNames[] = {"none", "error", "warn", "info", "debug"};
+    const char *requested = server.argValue("level");
+    for (uint8_t level = LOG_LEVEL_NONE; level <= LOG_LEVEL_DEBUG; level++)
+    {
+      if (strcasecmp(requested, levelNames[level]) == 0)
       {
-        delay(1000);
-        Serial.print(".");
-        attempts++;
+        logger.setLevel(level);
+        preferences.putUChar(LOG_LEVEL_KEY, level);
+        LOGI("Log level set to %s", levelNames[level]);
       }
     }
   }
 
-  if (WiFi.status() == WL_CONNECTED)
+  ArenaText output(requestArena);
+  char line[LOG_LINE_SIZE];
+  LogCursor cursor = logger.oldest();
+  int length;
+  while ((length = logger.read(cursor, line, sizeof(line))) >= 0)
   {
-    addToSerialBuffer("Connected to SSID: " + String(settings.ssid));
-    addToSerialBuffer("IP Address: " + WiFi.localIP().toString());
-    addToSerialBuffer("Gateway: " + WiFi.gatewayIP().toString());
-    addToSerialBuffer("Subnet mask: " + WiFi.subnetMask().toString());
+    output.append(line, length);
+    output += '\n';
   }
-  else
+  server.send(200, "text/plain", output.c_str(), output.length());
+}
+
+int32_t stationId(int slot)
+{
+  return slot == 0 ? settings.id : stations[slot].id;
+}
+
+// Slot of a station ID, -1 if it has none
+int stationSlot(int32_t id)
+{
+  for (int slot = 0; slot < stationCount; slot++)
   {
-    addToSerialBuffer("Failed to connect to WiFi. Please check your settings.");
+    if (stationId(slot) == id)
+    {
+      return slot;
+    }
   }
+  return -1;
+}
 
-  // Initialize and sync NTP Client
-  timeClient.begin();
-  timeClient.setTimeOffset(25200); // Set time zone offset to GMT+7 (25200 seconds)
-  setInternalClock();
-  addToSerialBuffer("Time synchronized with NTP server");
+// Slot for ?station=<id>, the device's own station when absent, -1 if unknown
+int requestedStation()
+{
+  return server.hasArg("station") ? stationSlot(atol(server.argValue("station"))) : 0;
 }
 
-void handleRestart()
+// Queue slots one station may hold, so a flood from one console leaves room for the rest
+int stationQueueShare()
 {
-  server.send(200, "text/html", "<html><body><h1>Restarting ESP32...</h1><script>setTimeout(function(){ window.location.href = '/'; }, 10000);</script></body></html>");
-  delay(1000); // Give the server time to send the response
-  ESP.restart();
+  int share = INGEST_QUEUE_DEPTH / stationCount;
+  return share > INGEST_STATION_SHARE_MIN ? share : INGEST_STATION_SHARE_MIN;
 }
 
-void deleteTopLine()
+void commitJournals(bool force)
 {
-  File originalFile = SD.open("/data.txt", FILE_READ);
-  File newFile = SD.open("/new_file.txt", FILE_WRITE);
+  for (int slot = 0; slot < stationCount; slot++)
+  {
+    stations[slot].journal->commit(force, millis());
+  }
+}
 
-  if (!originalFile || !newFile)
+// Gives a gateway station its slot and journal; returns the slot, -1 when all are taken
+int addStation(int32_t id)
+{
+  int slot = stationSlot(id);
+  if (slot >= 0 || stationCount >= GATEWAY_MAX_STATIONS)
   {
-    addToSerialBuffer("Error opening files for deletion process");
-    return;
+    return slot;
+  }
+  if (!SD.exists(GATEWAY_JOURNAL_DIR))
+  {
+    SD.mkdir(GATEWAY_JOURNAL_DIR);
   }
+  char dir[24];
+  snprintf(dir, sizeof(dir), GATEWAY_JOURNAL_DIR "/%ld", (long)id);
+  SdJournal *stationJournal = new SdJournal(JOURNAL_GROUP_BYTES, JOURNAL_MAX_LOSS_MS, dir); // lives until restart
+  stationJournal->begin(uplinkIds, uplinkCount);
+  slot = stationCount++;
+  stations[slot].id = id;
+  stations[slot].journal = stationJournal;
+  LOGI("Station %ld: journal %s, %u records pending", (long)id, dir, stationJournal->pendingRecords());
+  return slot;
+}
 
-  originalFile.readStringUntil('\n'); // Skip the first line
+// Reads the gateway table, e.g.
+//   {"stations":[{"id":12,"passkey":"A1B2..."},{"id":13,"ip":"192.168.8.20","weight":2}]}
+// with any of passkey, ip and stationtype per entry. Without the file every
+// console belongs to the device's own station, as before gateway mode.
+void loadStations()
+{
+  File file = SD.open(GATEWAY_CONFIG_PATH, FILE_READ);
+  if (!file)
+  {
+    return;
+  }
+  ArenaScope scope(requestArena);
+  JsonDocument doc(&requestJsonAllocator);
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error)
+  {
+    LOGE("Failed to read " GATEWAY_CONFIG_PATH ": %s", error.c_str());
+    return;
+  }
 
-  while (originalFile.available())
+  static const char *const matchNames[] = {"passkey", "ip", "stationtype"};
+  for (JsonObject entry : doc["stations"].as<JsonArray>())
   {
-    String line = originalFile.readStringUntil('\n');
-    if (line.length() > 0)
+    int32_t id = entry["id"] | 0;
+    int slot = id > 0 ? addStation(id) : -1;
+    if (slot < 0)
+    {
+      LOGW("Gateway: station %ld skipped, bad ID or no free slot", (long)id);
+      continue;
+    }
+    for (int uplink = 0; uplink < uplinkCount; uplink++)
     {
-      newFile.println(line);
+      uplinks[uplink].scheduler.setWeight(slot, entry["weight"] | 1);
+    }
+    for (uint8_t match = STATION_MATCH_PASSKEY; match <= STATION_MATCH_TYPE; match++)
+    {
+      const char *key = entry[matchNames[match]] | "";
+      if (*key && !stationMap.add(match, key, id))
+      {
+        LOGW("Gateway: mapping %s=%s for station %ld dropped", matchNames[match], key, (long)id);
+      }
     }
   }
+  LOGI("Gateway mode: %d mappings over %d stations", stationMap.count(), stationCount);
+}
 
-  originalFile.close();
-  newFile.close();
+// Reads the mirror destinations, e.g.
+//   {"uplinks":[{"name":"historian","url":"http://10.9.116.20/ingest"}]}
+// Uplink 0 is always settings.postUrl. A mirror's journal cursor is kept under
+// a CRC of its URL, so reordering or removing entries does not move records
+// from one destination to another.
+void loadUplinks()
+{
+  snprintf(uplinks[0].name, sizeof(uplinks[0].name), "primary");
+  File file = SD.open(UPLINK_CONFIG_PATH, FILE_READ);
+  if (!file)
+  {
+    return;
+  }
+  ArenaScope scope(requestArena);
+  JsonDocument doc(&requestJsonAllocator);
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error)
+  {
+    LOGE("Failed to read " UPLINK_CONFIG_PATH ": %s", error.c_str());
+    return;
+  }
+  for (JsonObject entry : doc["uplinks"].as<JsonArray>())
+  {
+    const char *url = entry["url"] | "";
+    if (uplinkCount >= JOURNAL_MAX_CURSORS || strlen(url) == 0 || strlen(url) >= UPLINK_URL_SIZE)
+    {
+      LOGW("Uplink %s skipped, bad URL or no free cursor", url);
+      continue;
+    }
+    uint32_t cursorId = crc32Update(0, url, strlen(url));
+    cursorId = cursorId == 0 ? 1 : cursorId; // 0 is the primary's
+    bool listed = false;
+    for (int i = 1; i < uplinkCount; i++)
+    {
+      listed = listed || uplinkIds[i] == cursorId;
+    }
+    if (listed)
+    {
+      LOGW("Uplink %s skipped, listed twice", url);
+      continue;
+    }
+    uplinkIds[uplinkCount] = cursorId;
+    Uplink &uplink = uplinks[uplinkCount];
+    snprintf(uplink.url, sizeof(uplink.url), "%s", url);
+    snprintf(uplink.name, sizeof(uplink.name), "%s", entry["name"] | "mirror");
+    LOGI("Uplink %d: %s -> %s", uplinkCount, uplink.name, uplink.url);
+    uplinkCount++;
+  }
+}
 
-  if (SD.remove("/data.txt"))
+// GET shows the destinations; POST stores a new mirror list, applied at the next restart
+void handleUplinks()
+{
+  ArenaScope scope(requestArena);
+  if (server.method() == HTTP_METHOD_POST)
   {
-    if (SD.rename("/new_file.txt", "/data.txt"))
+    JsonDocument doc(&requestJsonAllocator);
+    if (deserializeJson(doc, (const char *)server.body(), server.bodyLength()) || !doc["uplinks"].is<JsonArray>())
     {
-      addToSerialBuffer("Top line deleted successfully");
+      server.send(400, "text/plain", "Expected {\"uplinks\":[...]}.");
+      return;
     }
-    else
+    File file = SD.open(UPLINK_CONFIG_PATH, FILE_WRITE);
+    if (!file || serializeJson(doc, file) == 0)
     {
-      addToSerialBuffer("Error renaming file");
+      server.send(500, "text/plain", "Failed to write " UPLINK_CONFIG_PATH ".");
+      return;
     }
+    fileIndexPut(UPLINK_CONFIG_PATH, file.size());
+    file.close();
+    LOGI("Uplinks saved, applied at the next restart");
+    server.send(200, "text/plain", "Saved. Restart to apply.");
+    return;
   }
-  else
+
+  JsonDocument doc(&requestJsonAllocator);
+  JsonArray list = doc["uplinks"].to<JsonArray>();
+  for (int uplink = 0; uplink < uplinkCount; uplink++)
   {
-    addToSerialBuffer("Error removing original file");
-    SD.remove("/new_file.txt"); // Clean up the new file if we couldn't remove the original
+    JsonObject destination = list.add<JsonObject>();
+    destination["name"] = uplinks[uplink].name;
+    destination["url"] = uplink == 0 ? settings.postUrl.c_str() : uplinks[uplink].url;
   }
+  sendJson(doc);
 }
 
-void loop()
+// GET shows the station table; POST stores a new one, applied at the next restart
+void handleStations()
 {
-  server.handleClient();
-  sendTimer.update();
-  watchdogMin = 0;
+  ArenaScope scope(requestArena);
+  if (server.method() == HTTP_METHOD_POST)
+  {
+    JsonDocument doc(&requestJsonAllocator);
+    if (deserializeJson(doc, (const char *)server.body(), server.bodyLength()) || !doc["stations"].is<JsonArray>())
+    {
+      server.send(400, "text/plain", "Expected {\"stations\":[...]}.");
+      return;
+    }
+    File file = SD.open(GATEWAY_CONFIG_PATH, FILE_WRITE);
+    if (!file || serializeJson(doc, file) == 0)
+    {
+      server.send(500, "text/plain", "Failed to write " GATEWAY_CONFIG_PATH ".");
+      return;
+    }
+    fileIndexPut(GATEWAY_CONFIG_PATH, file.size());
+    file.close();
+    LOGI("Gateway table saved, applied at the next restart");
+    server.send(200, "text/plain", "Saved. Restart to apply.");
+    return;
+  }
 
-  // Periodically sync time
-  if (millis() % 600000 == 0)
-  { // Sync every hour
-    setInternalClock();
-    addToSerialBuffer("Time re-synchronized with NTP server");
+  static const char *const matchNames[] = {"passkey", "ip", "stationtype"};
+  JsonDocument doc(&requestJsonAllocator);
+  JsonArray list = doc["stations"].to<JsonArray>();
+  for (int slot = 0; slot < stationCount; slot++)
+  {
+    JsonObject station = list.add<JsonObject>();
+    station["id"] = stationId(slot);
+    station["weight"] = uplinks[0].scheduler.weight(slot);
+    JsonArray matches = station["match"].to<JsonArray>();
+    for (int i = 0; i < stationMap.count(); i++)
+    {
+      const StationMapping &mapping = stationMap.mapping(i);
+      if (mapping.id == stationId(slot))
+      {
+        JsonObject match = matches.add<JsonObject>();
+        match[matchNames[mapping.match]] = mapping.key;
+      }
+    }
   }
+  doc["gateway"] = stationMap.count() > 0;
+  sendJson(doc);
 }
 
-void appendFile(fs::FS &fs, const char *path, String message)
+// handlePost() on the device: gateway stations, console time, history and /api/latest
+class DevicePipeline : public IngestPipeline
 {
-  Serial.printf("Appending to file: %s\r\n", path);
+public:
+  DevicePipeline(void) : IngestPipeline(ingestQueue, &ingestLimiter, sampleFilter, LOCAL_TIME_OFFSET)
+  {
+  }
 
-  File file = fs.open(path, FILE_APPEND);
-  if (!file)
+protected:
+  // In gateway mode every console must map to a station
+  int station(HttpMux &request)
   {
-    addToSerialBuffer("- failed to open file for appending");
-    return;
+    if (stationMap.count() == 0)
+    {
+      return 0;
+    }
+    int32_t id;
+    int slot = -1;
+    if (!stationMap.lookup(request.argValue("PASSKEY"), request.argValue("stationtype"), request.remoteIP(), id) ||
+        (slot = stationSlot(id)) < 0)
+    {
+      LOGW("Post from unmapped station %s (%s)", request.argValue("stationtype"), IPAddress(request.remoteIP()));
+    }
+    return slot;
   }
-  if (file.println(message))
+
+  int stationShare(void)
   {
-    addToSerialBuffer("- message appended");
+    return stationQueueShare();
   }
-  else
+
+  void sampleSeen(uint32_t epoch, unsigned long now)
   {
-    addToSerialBuffer("- append failed");
+    timeSync.offerConsoleTime(epoch, now); // only until NTP answers; never waits on the network
+  }
+
+  void queued(int slot, const Observation &observation, const char *line, size_t length, bool outOfOrder)
+  {
+    stations[slot].accepted++;
+    checkSend = true;
+    if (slot == 0)
+    {
+      history.add(observation); // /api/history covers the device's own station
+    }
+    if (!outOfOrder)
+    {
+      updateLatestObservation(slot, observation, line, length);
+    }
+    sendTimer.oscillate(LED_BUILTIN, 200, LOW, 3); // three blinks without holding up the loop
+  }
+};
+
+DevicePipeline postPipeline;
+
+void handlePost()
+{
+  if (server.method() == HTTP_METHOD_POST)
+  {
+    postPipeline.handle(server, millis());
   }
-  file.close();
 }
 
-String zeroDate(int zero)
+// Serializes the sample once, so /api/latest costs one copy per request
+void updateLatestObservation(int slot, const Observation &observation, const char *line, size_t length)
 {
-  String month_str = String(zero);
-  if (month_str.length() == 1)
+  LatestObservation &latestObservation = stations[slot].latest;
+  CsvSpan columns[OBSERVATION_COLUMN_COUNT];
+  csvSplit(line, length, columns, OBSERVATION_COLUMN_COUNT);
+  latestObservation.observation = observation;
+  latestObservation.receivedAt = millis();
+  latestObservation.jsonLength = buildUploadJson(latestObservation.json, sizeof(latestObservation.json), stationId(slot), columns);
+  snprintf(latestObservation.etag, sizeof(latestObservation.etag), "\"%08lx\"",
+           (unsigned long)crc32Update(0, latestObservation.json, latestObservation.jsonLength));
+}
+
+// Answers 304 when the client already has the current sample (If-None-Match);
+// ?station=<id> picks a gateway station
+void handleLatest()
+{
+  int slot = requestedStation();
+  if (slot < 0)
+  {
+    server.send(404, "text/plain", "Unknown station.");
+    return;
+  }
+  const LatestObservation &latestObservation = stations[slot].latest;
+  if (latestObservation.jsonLength == 0)
   {
-    month_str = "0" + month_str;
+    server.send(404, "text/plain", "No observation received yet.");
+    return;
   }
-  return month_str;
-}
\ No newline at end of file
+  server.sendHeader("ETag", latestObservation.etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  const char *ifNoneMatch = server.headerValue("If-None-Match");
+  if (strstr(ifNoneMatch, latestObservation.etag) != nullptr || strcmp(ifNoneMatch, "*") == 0)
+  {
+    server.send(304);
+    return;
+  }
+  server.send(200, "application/json", latestObservation.json, latestObservation.jsonLength);
+}
+
+// One field as a little-endian int16 array, one element per HISTORY_INTERVAL
+// from X-History-Start; divide by 10^X-History-Decimals, HISTORY_MISSING means
+// no reading. since is local time in seconds, or negative for seconds before
+// the newest sample; the default is the whole window.
+void handleHistory()
+{
+  int field = observationFieldIndex(server.argValue("field"));
+  if (field < 0)
+  {
+    server.send(400, "text/plain", "Unknown field.");
+    return;
+  }
+  long since = atol(server.argValue("since"));
+  if (since < 0)
+  {
+    since = (long)history.newest() + since > 0 ? (long)history.newest() + since : 0;
+  }
+  uint32_t start;
+  size_t count = history.copyColumn(field, since, historyColumn, HISTORY_SLOTS, &start);
+
+  char value[12];
+  snprintf(value, sizeof(value), "%lu", (unsigned long)start);
+  server.sendHeader("X-History-Start", value);
+  snprintf(value, sizeof(value), "%d", HISTORY_INTERVAL);
+  server.sendHeader("X-History-Interval", value);
+  snprintf(value, sizeof(value), "%d", observationFields[field].historyDecimals);
+  server.sendHeader("X-History-Decimals", value);
+  snprintf(value, sizeof(value), "%d", HISTORY_MISSING);
+  server.sendHeader("X-History-Missing", value);
+  server.send(200, "application/octet-stream", (const char *)historyColumn, count * sizeof(int16_t));
+}
+
+// dateutc as sent by the console, "YYYY-MM-DD HH:MM:SS"; 0 if malformed
+void loadSampleFilter()
+{
+  File file = SD.open(DEDUP_FILE, FILE_READ);
+  if (!file)
+  {
+    return;
+  }
+  size_t size = SampleFilter::snapshotSize();
+  uint8_t *buffer = new uint8_t[size];
+  size_t length = file.read(buffer, size);
+  file.close();
+  if (sampleFilter.restore(buffer, length))
+  {
+    LOGI("Dedup filter restored from card");
+  }
+  else
+  {
+    LOGW("Dedup filter on card is invalid, starting empty");
+  }
+  delete[] buffer;
+}
+
+// The snapshot is about 1 KB and written at most once a minute, so samples
+// accepted just before a power cut may be stored again if the console resends.
+void saveSampleFilter()
+{
+  if (!sampleFilter.isDirty())
+  {
+    return;
+  }
+  size_t size = SampleFilter::snapshotSize();
+  uint8_t *buffer = new uint8_t[size];
+  sampleFilter.snapshot(buffer);
+  File file = SD.open(DEDUP_FILE, FILE_WRITE);
+  if (file)
+  {
+    file.write(buffer, size);
+    fileIndexPut(DEDUP_FILE, file.size());
+    file.close();
+  }
+  delete[] buffer;
+  sampleFilterSavedAt = millis();
+}
+
+// Writes up to limit queued records to the SD card, oldest first. A record
+// that cannot be written stays queued and is retried on the next pass.
+void drainIngestQueue(int limit)
+{
+  for (int i = 0; i < limit && ingestQueue.depth() > 0; i++)
+  {
+    if (!stations[ingestQueue.frontStation()].journal->append(ingestQueue.front(), ingestQueue.frontLength(), millis()))
+    {
+      postPipeline.counters().writeErrors++;
+      return;
+    }
+    ingestQueue.pop();
+    postPipeline.counters().written++;
+  }
+}
+
+// Feeds a CSV file on the card into a station's journal
+class JournalBackfill : public Backfill
+{
+public:
+  File file;
+  char path[64];
+  int slot;
+  uint32_t tag;        // names this import in the journal mark
+  uint32_t stationKey; // sample filter key of the imported rows
+  uint32_t duplicates; // rows the sample filter had already seen
+  bool retrying;       // the last row was checked but could not be appended
+
+protected:
+  int readAt(uint32_t offset, uint8_t *buffer, size_t size)
+  {
+    if (file.position() != offset && !file.seek(offset))
+    {
+      return -1;
+    }
+    return file.read(buffer, size);
+  }
+
+  bool accept(const Observation &observation, const char *line, size_t length)
+  {
+    // A row stored by an interrupted run, or twice in the file, is dropped like a resent post
+    if (!retrying && sampleFilter.check(stationKey, observation.time - LOCAL_TIME_OFFSET) == SAMPLE_DUPLICATE)
+    {
+      duplicates++;
+      return true;
+    }
+    retrying = !stations[slot].journal->append(line, length, millis());
+    return !retrying;
+  }
+};
+
+JournalBackfill backfill;
+bool importScanPending = false; // look for the next file to import once the current one is done
+
+uint32_t importTag(const char *path)
+{
+  uint32_t tag = crc32Update(0, path, strlen(path));
+  return tag == 0 ? 1 : tag; // 0 is no import
+}
+
+// Starts importing a file into a station's journal from offset. The path is
+// kept in NVS and the offset reached in the journal's mark, so a reset resumes
+// the job. False if an import is already running.
+bool startImport(const char *path, int slot, uint32_t offset)
+{
+  if (backfill.active() || strlen(path) >= sizeof(backfill.path))
+  {
+    return false;
+  }
+  backfill.file = SD.open(path, FILE_READ);
+  if (!backfill.file || backfill.file.isDirectory())
+  {
+    backfill.file.close();
+    return false;
+  }
+  strcpy(backfill.path, path);
+  backfill.slot = slot;
+  backfill.tag = importTag(path);
+  char stationName[16];
+  snprintf(stationName, sizeof(stationName), "import@%ld", (long)stationId(slot));
+  backfill.stationKey = sampleStationKey(stationName);
+  backfill.duplicates = 0;
+  backfill.retrying = false;
+  backfill.start(backfill.file.size(), offset, millis());
+  stations[slot].journal->setMark({backfill.tag, offset});
+  preferences.putString(IMPORT_PATH_KEY, path);
+  preferences.putInt(IMPORT_STATION_KEY, stationId(slot));
+  LOGI("Importing %s into station %ld from byte %lu of %lu", path, stationId(slot), offset, backfill.file.size());
+  return true;
+}
+
+// Picks up an interrupted import first, then the old /data.txt backlog, then
+// the next CSV file in the drop folder (for the device's own station)
+void resumeImport()
+{
+  String path = preferences.getString(IMPORT_PATH_KEY, "");
+  if (path.length() > 0)
+  {
+    int slot = stationSlot(preferences.getInt(IMPORT_STATION_KEY, stationId(0)));
+    if (slot >= 0)
+    {
+      const JournalMark &mark = stations[slot].journal->mark();
+      uint32_t offset = mark.tag == importTag(path.c_str()) ? mark.value : preferences.getUInt(IMPORT_OFFSET_KEY, 0);
+      if (startImport(path.c_str(), slot, offset))
+      {
+        return;
+      }
+    }
+    LOGW("Dropped the import of %s: file or station gone", path);
+    preferences.remove(IMPORT_PATH_KEY);
+  }
+
+  if (SD.exists(LEGACY_DATA_PATH))
+  {
+    uint32_t offset = preferences.getUInt(LEGACY_OFFSET_KEY, 0);
+    preferences.remove(LEGACY_OFFSET_KEY);
+    if (startImport(LEGACY_DATA_PATH, 0, offset))
+    {
+      return;
+    }
+  }
+
+  File dir = SD.open(IMPORT_DIR);
+  if (!dir || !dir.isDirectory())
+  {
+    return;
+  }
+  while (File entry = dir.openNextFile())
+  {
+    String name = entry.name();
+    bool isCsv = !entry.isDirectory() && name.endsWith(".csv");
+    entry.close();
+    if (isCsv && startImport((IMPORT_DIR "/" + name).c_str(), 0, 0))
+    {
+      break;
+    }
+  }
+  dir.close();
+}
+
+void finishImport()
+{
+  const BackfillProgress &progress = backfill.progress();
+  LOGI("Imported %s: %lu records, %lu duplicates, %lu lines rejected, %lu bytes/s", backfill.path,
+       progress.records - backfill.duplicates, backfill.duplicates, progress.rejected, backfill.bytesPerSecond(millis()));
+  backfill.file.close();
+  backfill.stop();
+  stations[backfill.slot].journal->setMark({0, 0});
+  stations[backfill.slot].journal->commit(true, millis());
+
+  // Renamed so it is never imported twice
+  String done = strcmp(backfill.path, LEGACY_DATA_PATH) == 0 ? String(LEGACY_DATA_DONE_PATH)
+                                                              : String(backfill.path) + IMPORT_DONE_SUFFIX;
+  SD.remove(done);
+  SD.rename(backfill.path, done);
+  preferences.remove(IMPORT_PATH_KEY);
+  preferences.remove(IMPORT_OFFSET_KEY);
+  fileIndex.setValid(false);
+  importScanPending = true; // the drop folder may hold more
+}
+
+// Moves an imported file into the journal in whole blocks for up to
+// IMPORT_PASS_BUDGET ms, but only while live samples are not waiting. The
+// journal batches the appends into large writes. The offset reached is set
+// as the journal's mark, which is saved with the state write that makes those
+// rows durable, so a reset resumes right after the last row on the card; the
+// few rows a crash inside a write can repeat are caught by the sample filter.
+void importBackfill()
+{
+  if (!backfill.active())
+  {
+    if (importScanPending)
+    {
+      importScanPending = false;
+      resumeImport();
+    }
+    return;
+  }
+  if (ingestQueue.depth() > 0)
+  {
+    return;
+  }
+
+  unsigned long started = millis();
+  while (!backfill.done() && millis() - started < IMPORT_PASS_BUDGET)
+  {
+    if (backfill.step() < 0)
+    {
+      break; // read or journal failure, retried on the next pass
+    }
+  }
+  if (backfill.done())
+  {
+    finishImport();
+    return;
+  }
+  Journal *journal = stations[backfill.slot].journal;
+  if (!journal->markPending())
+  {
+    journal->setMark({backfill.tag, backfill.progress().offset});
+  }
+}
+
+// GET reports the running import; POST ?file=<path>&station=<id> starts one
+// Only data files may be imported, because a finished import renames its
+// file: the old backlog and CSV files in the root or the drop folder, never
+// journal segments, settings or logs
+bool importAllowed(const char *path)
+{
+  if (strcmp(path, LEGACY_DATA_PATH) == 0)
+  {
+    return true;
+  }
+  size_t length = strlen(path);
+  if (length < 5 || strcmp(path + length - 4, ".csv") != 0 || strstr(path, "..") != nullptr)
+  {
+    return false;
+  }
+  const char *name = strrchr(path, '/') + 1;
+  if (name == path + length - 4)
+  {
+    return false; // no name before .csv
+  }
+  if (name == path + 1)
+  {
+    return true;
+  }
+  return (size_t)(name - path) == sizeof(IMPORT_DIR) && strncmp(path, IMPORT_DIR "/", sizeof(IMPORT_DIR)) == 0;
+}
+
+void handleImport()
+{
+  ArenaScope scope(requestArena);
+  if (server.method() == HTTP_METHOD_POST)
+  {
+    String fileName = server.arg("file");
+    String path = fileName.startsWith("/") ? fileName : "/" + fileName;
+    if (!importAllowed(path.c_str()))
+    {
+      server.send(400, "text/plain", "Only " LEGACY_DATA_PATH " and .csv files in / or " IMPORT_DIR " can be imported.");
+      return;
+    }
+    int slot = requestedStation();
+    if (slot < 0)
+    {
+      server.send(404, "text/plain", "Unknown station.");
+      return;
+    }
+    if (backfill.active())
+    {
+      server.send(409, "text/plain", "An import is already running.");
+      return;
+    }
+    if (!startImport(path.c_str(), slot, 0))
+    {
+      server.send(404, "text/plain", "File not found");
+      return;
+    }
+  }
+
+  const BackfillProgress &progress = backfill.progress();
+  JsonDocument doc(&requestJsonAllocator);
+  doc["active"] = backfill.active();
+  if (backfill.path[0] != '\0')
+  {
+    doc["file"] = backfill.path;
+    doc["station"] = stationId(backfill.slot);
+    doc["size"] = progress.size;
+    doc["offset"] = progress.offset;
+    doc["records"] = progress.records - backfill.duplicates;
+    doc["duplicates"] = backfill.duplicates;
+    doc["rejected"] = progress.rejected;
+    doc["bytesPerSecond"] = backfill.bytesPerSecond(millis());
+    doc["pending"] = stations[backfill.slot].journal->pendingRecords();
+  }
+  sendJson(doc);
+}
+
+// Renders journal records as the CSV lines /data.txt used to hold
+class JournalCsvStream : public HttpStream
+{
+public:
+  JournalCsvStream(Journal &journal, JournalPosition start) : _journal(journal), _pos(start)
+  {
+    _length = observationCsvHeader(_line);
+    _line[_length++] = '\r';
+    _line[_length++] = '\n';
+  }
+
+  size_t read(uint8_t *buffer, size_t size)
+  {
+    size_t total = 0;
+    while (total < size)
+    {
+      if (_sent == _length)
+      {
+        int length = _journal.read(_pos, _line, sizeof(_line) - 2);
+        if (length < 0)
+        {
+          break;
+        }
+        _line[length] = '\r';
+        _line[length + 1] = '\n';
+        _length = length + 2;
+        _sent = 0;
+      }
+      size_t n = _length - _sent < size - total ? _length - _sent : size - total;
+      memcpy(buffer + total, _line + _sent, n);
+      _sent += n;
+      total += n;
+    }
+    return total;
+  }
+
+private:
+  Journal &_journal;
+  JournalPosition _pos;
+  char _line[JOURNAL_MAX_RECORD + 3]; // also holds the header line
+  size_t _length = 0;
+  size_t _sent = 0;
+};
+
+// All records still on the card, or with pending=1 only those not yet uploaded
+// (to uplink=<n>, the primary by default); ?station=<id> picks a gateway station
+void handleJournalCsv()
+{
+  int slot = requestedStation();
+  if (slot < 0)
+  {
+    server.send(404, "text/plain", "Unknown station.");
+    return;
+  }
+  Journal &stationJournal = *stations[slot].journal;
+  stationJournal.commit(true, millis()); // include records still in RAM
+  JournalPosition start = server.hasArg("pending") ? stationJournal.cursor(atoi(server.argValue("uplink"))) : stationJournal.oldest();
+  server.sendHeader("Content-Disposition", "attachment; filename=journal.csv");
+  server.sendStream(200, "text/csv", HTTP_LENGTH_UNKNOWN, new JournalCsvStream(stationJournal, start));
+}
+
+void handleMetrics()
+{
+  ArenaScope scope(requestArena);
+  JsonDocument doc(&requestJsonAllocator);
+  JsonObject ingest = doc["ingest"].to<JsonObject>();
+  ingest["accepted"] = postPipeline.counters().accepted;
+  ingest["shed"] = postPipeline.counters().shed;
+  ingest["rateLimited"] = postPipeline.counters().rateLimited;
+  ingest["written"] = postPipeline.counters().written;
+  ingest["writeErrors"] = postPipeline.counters().writeErrors;
+  ingest["duplicates"] = postPipeline.counters().duplicates;
+  ingest["outOfOrder"] = postPipeline.counters().outOfOrder;
+  ingest["unknownStation"] = postPipeline.counters().unknownStation;
+  ingest["queued"] = ingestQueue.depth();
+  ingest["maxQueued"] = postPipeline.counters().maxDepth;
+  ingest["capacity"] = ingestQueue.capacity();
+  JsonObject log = doc["journal"].to<JsonObject>();
+  log["pending"] = journal.pendingRecords();
+  log["buffered"] = journal.bufferedBytes();
+  log["segment"] = journal.checkpoint().segment;
+  log["cursorSegment"] = journal.cursor().segment;
+  log["recoveryMs"] = journalRecoveryMs;
+  log["recoveredBytes"] = journal.stats().scannedBytes;
+  log["truncatedBytes"] = journal.stats().truncatedBytes;
+  log["corruptSkips"] = journal.stats().corruptSkips;
+  log["importing"] = backfill.active();
+  JsonArray uplinkList = doc["uplinks"].to<JsonArray>();
+  for (int uplink = 0; uplink < uplinkCount; uplink++)
+  {
+    uint32_t pending = 0;
+    uint32_t dropped = 0;
+    for (int slot = 0; slot < stationCount; slot++)
+    {
+      pending += stations[slot].journal->pendingRecords(uplink);
+      dropped += stations[slot].journal->stats().dropped[uplink];
+    }
+    JsonObject destination = uplinkList.add<JsonObject>();
+    destination["name"] = uplinks[uplink].name;
+    destination["pending"] = pending;
+    destination["sent"] = uplinks[uplink].sent;
+    destination["failures"] = uplinks[uplink].failures;
+    destination["lastStatus"] = uplinks[uplink].lastStatus;
+    destination["backoffMs"] = uplinks[uplink].backoffMs;
+    destination["dropped"] = dropped;
+  }
+  JsonArray stationList = doc["stations"].to<JsonArray>();
+  for (int slot = 0; slot < stationCount; slot++)
+  {
+    JsonObject station = stationList.add<JsonObject>();
+    station["id"] = stationId(slot);
+    station["weight"] = uplinks[0].scheduler.weight(slot);
+    station["accepted"] = stations[slot].accepted;
+    station["queued"] = ingestQueue.depthOf(slot);
+    station["pending"] = stations[slot].journal->pendingRecords();
+    station["uploaded"] = stations[slot].uploaded;
+  }
+  static const char *const timeSources[] = {"none", "console", "ntp"};
+  JsonObject clock = doc["time"].to<JsonObject>();
+  clock["source"] = timeSources[timeSync.source()];
+  clock["epoch"] = timeSync.epoch(millis());
+  clock["offsetMs"] = timeSync.stats().lastOffsetMs;
+  clock["roundTripMs"] = timeSync.stats().lastDelayMs;
+  clock["slewPendingMs"] = timeSync.slewPending();
+  clock["syncAgeMs"] = timeSync.stats().responses > 0 ? millis() - timeSync.stats().lastSyncAt : 0;
+  clock["requests"] = timeSync.stats().requests;
+  clock["responses"] = timeSync.stats().responses;
+  clock["failures"] = timeSync.stats().failures;
+  clock["steps"] = timeSync.stats().steps;
+  JsonObject heap = doc["heap"].to<JsonObject>();
+  heap["free"] = ESP.getFreeHeap();
+  heap["minFree"] = ESP.getMinFreeHeap();
+  heap["largestBlock"] = ESP.getMaxAllocHeap();
+  heap["minLargestBlock"] = heapStats.minLargestBlock;
+  heap["fragmentation"] = heapStats.fragmentation;
+  heap["maxFragmentation"] = heapStats.maxFragmentation;
+  heap["sampleAgeMs"] = millis() - heapStats.sampledAt;
+  JsonObject arena = doc["arena"].to<JsonObject>();
+  arena["size"] = requestArena.capacity();
+  arena["highWater"] = requestArena.highWater();
+  arena["fallbacks"] = requestArena.fallbacks();
+  doc["uptime"] = millis();
+  sendJson(doc);
+}
+
+// Serializes into the request arena, so the body is sent with a known length and no String
+void sendJson(JsonDocument &doc)
+{
+  size_t length = measureJson(doc);
+  char *output = (char *)requestArena.allocate(length + 1);
+  if (!output)
+  {
+    server.send(500, "text/plain", "Out of memory.");
+    return;
+  }
+  serializeJson(doc, output, length + 1);
+  server.send(200, "application/json", output, length);
+  requestArena.deallocate(output);
+}
+
+// Samples the heap; fragmentation is the share of free memory not usable for one large block
+void sampleHeap()
+{
+  heapStats.freeBytes = ESP.getFreeHeap();
+  heapStats.minFree = ESP.getMinFreeHeap();
+  heapStats.largestBlock = ESP.getMaxAllocHeap();
+  if (heapStats.sampledAt == 0 || heapStats.largestBlock < heapStats.minLargestBlock)
+  {
+    heapStats.minLargestBlock = heapStats.largestBlock;
+  }
+  heapStats.fragmentation = heapStats.freeBytes > 0 ? 100 - (uint64_t)heapStats.largestBlock * 100 / heapStats.freeBytes : 0;
+  if (heapStats.fragmentation > heapStats.maxFragmentation)
+  {
+    heapStats.maxFragmentation = heapStats.fragmentation;
+  }
+  heapStats.sampledAt = millis();
+  LOGD("Heap: %u free, %u min free, %u largest block, %u%% fragmented, arena high water %u of %u, %u fallbacks",
+       heapStats.freeBytes, heapStats.minFree, heapStats.largestBlock, heapStats.fragmentation,
+       requestArena.highWater(), requestArena.capacity(), requestArena.fallbacks());
+}
+
+void markBootStage(const char *name)
+{
+  if (bootStageCount < BOOT_STAGE_COUNT)
+  {
+    bootStages[bootStageCount].name = name;
+    bootStages[bootStageCount].at = millis();
+    bootStageCount++;
+  }
+}
+
+void logBootReport()
+{
+  char report[LOG_MAX_STRING + 1];
+  size_t length = 0;
+  report[0] = '\0';
+  for (int i = 0; i < bootStageCount && length < sizeof(report); i++)
+  {
+    length += snprintf(report + length, sizeof(report) - length, " %s=%lums", bootStages[i].name, bootStages[i].at);
+  }
+  LOGI("Boot timing:%s", report);
+}
+
+void handleBootReport()
+{
+  ArenaScope scope(requestArena);
+  JsonDocument doc(&requestJsonAllocator);
+  JsonArray stages = doc["stages"].to<JsonArray>();
+  for (int i = 0; i < bootStageCount; i++)
+  {
+    JsonObject stage = stages.add<JsonObject>();
+    stage["name"] = bootStages[i].name;
+    stage["ms"] = bootStages[i].at;
+  }
+  doc["complete"] = uploadAttached;
+  doc["uptime"] = millis();
+  sendJson(doc);
+}
+
+// Boot runs in stages so that the access point, the web server and /post
+// ingest are up within a second or two. The relay pulse, Wi-Fi, NTP and the
+// uploader complete afterwards from loop() as they become ready.
+void setup()
+{
+  Serial.setTxBufferSize(LOG_SERIAL_TX_BUFFER);
+  Serial.begin(115200);
+  logger.begin(logClock);
+  markBootStage("start");
+
+  watchdogTicker.attach(WATCHDOG_TIMEOUT, resetWatchdog);
+  pinMode(relayPin, OUTPUT);
+  sendTimer.pulseImmediate(relayPin, 4000, LOW); // relay low for 4 s, then high, without blocking boot
+  sendTimer.every(TIME_SYNC_TICK, requestTimeSync); // sends only once Wi-Fi is up and a request is due
+
+  if (!SD.begin(csPin, SPI, 4000000, SD_JOURNAL_MOUNT, SD_MAX_OPEN_FILES))
+  {
+    LOGE("Card failed, or not present");
+  }
+  else
+  {
+    LOGI("Card initialized successfully");
+    SD.mkdir(LOG_FILE_DIR);
+    logFileReady = true;
+  }
+  fileIndex.setValid(false); // rebuilt on first listing
+  loadSampleFilter();
+  unsigned long journalStart = millis();
+  loadUplinks();
+  journal.begin(uplinkIds, uplinkCount);
+  journalRecoveryMs = millis() - journalStart;
+  LOGI("Journal recovered in %lu ms, %u records pending", journalRecoveryMs, journal.pendingRecords());
+  if (journal.stats().truncatedBytes > 0)
+  {
+    LOGW("Journal: cut %u bytes of torn record", journal.stats().truncatedBytes);
+  }
+  markBootStage("sd");
+
+  loadSettings();
+  stations[0].journal = &journal;
+  loadStations();
+  importScanPending = true; // an interrupted import, /data.txt or the drop folder
+  markBootStage("settings");
+
+  // Set up ESP32 as an Access Point with the specified IP and credentials
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.softAPConfig(ap_local_ip, ap_gateway, ap_subnet); // Configure AP with static IP
+  WiFi.softAP(ap_ssid, ap_password);                     // Start the Access Point
+
+  LOGI("Access point started, IP address %s", WiFi.softAPIP()); // Should be 192.168.8.1
+
+  server.setBodyKeeper(&requestBodyKeeper);
+  server.on("/", handleRoot);
+  server.on("/save", HTTP_METHOD_POST, handleSaveSettings);
+  server.on("/post", HTTP_METHOD_ANY, handlePost, HTTP_ROUTE_PRIORITY); // never queued behind downloads
+  server.on("/serial", handleSerial);
+  server.on("/download", handleDownload);
+  server.on("/delete", handleDelete);
+  server.on("/export", handleExport);
+  server.on("/journal.csv", handleJournalCsv);
+  server.on("/api/files", handleFileList);
+  server.on("/api/boot", handleBootReport);
+  server.on("/api/metrics", handleMetrics);
+  server.on("/api/latest", handleLatest);
+  server.on("/api/history", handleHistory);
+  server.on("/api/stations", HTTP_METHOD_ANY, handleStations);
+  server.on("/api/uplinks", HTTP_METHOD_ANY, handleUplinks);
+  server.on("/api/import", HTTP_METHOD_ANY, handleImport);
+  server.on("/restart", handleRestart); // Add this line
+
+  server.begin();
+  LOGI("Server started");
+  markBootStage("server");
+
+  pinMode(LED_BUILTIN, OUTPUT);
+  digitalWrite(LED_BUILTIN, LOW);
+
+  connectWiFi(); // returns immediately, updateWiFi() finishes the job
+}
+
+#include <ArduinoJson.h>
+
+// Writes the upload JSON for one stored line straight from its columns.
+// Returns 0 if out is too small.
+size_t buildUploadJson(char *out, size_t size, int32_t stationId, const CsvSpan *values)
+{
+  JsonWriter json(out, size);
+  json.beginObject();
+  json.key("idws");
+  json.valueLong(stationId);
+  observationJson(json, values);
+  json.endObject();
+  return json.overflowed() ? 0 : json.length();
+}
+
+// Uploads over each destination's kept-alive connection until the call has
+// used UPLOAD_PASS_BUDGET ms; a post already started always finishes, so a
+// pass takes at most the budget plus one round trip. Destinations take turns
+// at going first. A pass that stops with records still waiting has loop()
+// call again on its next pass, so a backlog drains at link speed in short
+// slices and the web server is served between them.
+void sendData()
+{
+  uploadBacklog = false;
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    return; // updateWiFi() is already reconnecting
+  }
+
+  unsigned long started = millis();
+  int first = uplinkTurn;
+  for (int i = 0; i < uplinkCount; i++)
+  {
+    int uplink = (first + i) % uplinkCount;
+    if (uplinks[uplink].backoffMs > 0 && (long)(millis() - uplinks[uplink].retryAt) < 0)
+    {
+      continue;
+    }
+    if (millis() - started >= UPLOAD_PASS_BUDGET)
+    {
+      uploadBacklog = true;
+      uplinkTurn = uplink; // goes first next pass
+      break;
+    }
+    bool more = sendToUplink(uplink);
+    while (more && millis() - started < UPLOAD_PASS_BUDGET)
+    {
+      more = sendToUplink(uplink);
+    }
+    if (more)
+    {
+      uploadBacklog = true;
+    }
+  }
+
+  testLoop++;
+  LOGD("loop ke %d", testLoop);
+}
+
+// Uploads or skips one record; false when there is nothing more to send now
+bool sendToUplink(int uplink)
+{
+  Uplink &destination = uplinks[uplink];
+
+  // Stations take turns by weight, so one station's backlog cannot starve the others
+  uint32_t ready = 0;
+  for (int i = 0; i < stationCount; i++)
+  {
+    if (stations[i].journal->hasCommitted(uplink))
+    {
+      ready |= 1UL << i;
+    }
+  }
+  int slot = destination.scheduler.next(ready);
+  if (slot < 0)
+  {
+    LOGD("No data to send to %s.", destination.name);
+    return false;
+  }
+  Journal &stationJournal = *stations[slot].journal;
+
+  char record[JOURNAL_MAX_RECORD + 1];
+  int length = stationJournal.peek(uplink, record, sizeof(record));
+  if (length < 0)
+  {
+    return false;
+  }
+
+  // Check if the data is empty or contains errors
+  if (length == 0 || strstr(record, "error") != nullptr)
+  {
+    LOGW("Empty or error data found. Skipping record.");
+    stationJournal.advance(uplink, millis());
+    return true;
+  }
+
+  // The fields point into record; nothing is copied
+  CsvSpan values[OBSERVATION_COLUMN_COUNT];
+  csvSplit(record, length, values, OBSERVATION_COLUMN_COUNT);
+
+  // Validate date format
+  if (!csvIsDateTime(values[0]))
+  {
+    LOGW("Invalid date format. Expected YYYY-MM-DD HH:MM:SS. Skipping record.");
+    stationJournal.advance(uplink, millis()); // it would otherwise hold up everything behind it
+    return true;
+  }
+
+  char data[UPLOAD_JSON_SIZE];
+  size_t dataLength = buildUploadJson(data, sizeof(data), stationId(slot), values);
+  if (dataLength == 0)
+  {
+    LOGW("Upload JSON too large. Skipping record.");
+    stationJournal.advance(uplink, millis());
+    return true;
+  }
+
+  LOGD("Attempting to send data to %s: %s", destination.name, data);
+  const char *url = uplink == 0 ? settings.postUrl.c_str() : destination.url;
+  uint32_t urlCrc = crc32Update(0, url, strlen(url));
+  if (destination.connectedTo != urlCrc)
+  {
+    destination.client.stop(); // a kept connection would otherwise be reused for the new host
+    destination.connectedTo = urlCrc;
+  }
+  HTTPClient &http = destination.http;
+  http.setReuse(true);
+  http.setTimeout(UPLINK_HTTP_TIMEOUT);
+#if defined(ESP32)
+  http.setConnectTimeout(UPLINK_HTTP_TIMEOUT);
+#endif
+  http.begin(destination.client, url);
+  http.addHeader("Content-Type", "application/json");
+  int httpCode = http.POST((uint8_t *)data, dataLength);
+  destination.lastStatus = httpCode;
+
+  // The response body is only read into a String when it is going to be logged
+  if (httpCode == 200)
+  {
+    LOGD("HTTP response: %s", http.getString());
+    stationJournal.advance(uplink, millis());
+    destination.sent++;
+    destination.backoffMs = 0;
+    if (uplink == 0)
+    {
+      stations[slot].uploaded++;
+    }
+    LOGI("Data sent to %s for station %ld. Record acknowledged.", destination.name, stationId(slot));
+  }
+  else
+  {
+    // Only this destination waits; the others keep their own pace
+    destination.failures++;
+    destination.backoffMs = destination.backoffMs == 0 ? UPLINK_RETRY_MIN
+                            : destination.backoffMs * 2 < UPLINK_RETRY_MAX ? destination.backoffMs * 2
+                                                                          : UPLINK_RETRY_MAX;
+    destination.retryAt = millis() + destination.backoffMs;
+    if (httpCode > 0)
+    {
+      LOGW("HTTP error response from %s: %d %s", destination.name, httpCode, http.getString());
+    }
+    else
+    {
+      LOGW("HTTP error from %s: %d", destination.name, httpCode);
+    }
+  }
+  http.end(); // with reuse on, the connection stays open for the next record
+  return httpCode == 200;
+}
+
+void setWiFiState(WiFiState state)
+{
+  wifiState = state;
+  wifiStateSince = millis();
+}
+
+void beginWiFiAttempt()
+{
+  if (wifiAttemptStaticIP && !WiFi.config(settings.staticIP, settings.gateway, settings.subnet, settings.dnsServer))
+  {
+    LOGW("Failed to configure static IP. Falling back to dynamic IP.");
+    wifiAttemptStaticIP = false;
+  }
+  if (!wifiAttemptStaticIP)
+  {
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0)); // back to DHCP
+  }
+
+  WiFi.begin(settings.ssid.c_str(), settings.password.c_str());
+  LOGI("Connecting to %s", settings.ssid);
+  setWiFiState(WIFI_STATE_CONNECTING);
+}
+
+// Starts connecting with the current settings. Never blocks: progress, the
+// static to dynamic IP fallback and retries are driven by updateWiFi().
+void connectWiFi()
+{
+  wifiAttemptStaticIP = settings.useStaticIP;
+  beginWiFiAttempt();
+}
+
+void onWiFiConnected()
+{
+  LOGI("Connected to SSID: %s", settings.ssid);
+  LOGI("IP Address: %s", WiFi.localIP());
+  LOGD("Gateway: %s", WiFi.gatewayIP());
+  LOGD("Subnet mask: %s", WiFi.subnetMask());
+
+  if (uploadAttached)
+  {
+    return;
+  }
+  markBootStage("wifi");
+
+  sendTimer.every(delayMill, sendData);
+  uploadAttached = true;
+  markBootStage("upload");
+  logBootReport();
+}
+
+// Gives up on network settings under trial and reconnects with the previous ones
+void rollBackWiFiTrial()
+{
+  wifiTrial = false;
+  copyNetworkSettings(settings, wifiRollback);
+  WiFi.disconnect();
+  connectWiFi();
+}
+
+// Connection manager, called from loop()
+void updateWiFi()
+{
+  bool connected = WiFi.status() == WL_CONNECTED;
+  unsigned long elapsed = millis() - wifiStateSince;
+
+  switch (wifiState)
+  {
+  case WIFI_STATE_CONNECTING:
+    if (connected && wifiTrial && settings.useStaticIP && !wifiAttemptStaticIP)
+    {
+      // Joined only through the DHCP fallback: the static address under trial does not work
+      LOGW("Static IP %s did not work on %s. Restoring the previous network settings.", settings.staticIP, settings.ssid);
+      rollBackWiFiTrial();
+    }
+    else if (connected)
+    {
+      setWiFiState(WIFI_STATE_CONNECTED);
+      if (wifiTrial)
+      {
+        wifiTrial = false;
+        saveSettings();
+        LOGI("New network settings confirmed and saved");
+      }
+      onWiFiConnected();
+    }
+    else if (elapsed > WIFI_CONNECT_TIMEOUT && wifiAttemptStaticIP && !wifiTrial)
+    {
+      LOGW("Failed to connect with static IP. Trying dynamic IP.");
+      wifiAttemptStaticIP = false;
+      WiFi.disconnect();
+      beginWiFiAttempt();
+    }
+    else if (elapsed > WIFI_CONNECT_TIMEOUT && wifiTrial)
+    {
+      LOGW("Could not join %s. Restoring the previous network settings.", settings.ssid);
+      rollBackWiFiTrial();
+    }
+    else if (elapsed > WIFI_CONNECT_TIMEOUT)
+    {
+      LOGE("Failed to connect to WiFi. Please check your settings.");
+      WiFi.disconnect();
+      setWiFiState(WIFI_STATE_WAITING);
+    }
+    break;
+
+  case WIFI_STATE_CONNECTED:
+    if (!connected)
+    {
+      LOGW("WiFi disconnected");
+      connectWiFi();
+    }
+    break;
+
+  case WIFI_STATE_WAITING:
+    if (elapsed > WIFI_RETRY_INTERVAL)
+    {
+      connectWiFi();
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+void handleRestart()
+{
+  server.send(200, "text/html", "<html><body><h1>Restarting ESP32...</h1><script>setTimeout(function(){ window.location.href = '/'; }, 10000);</script></body></html>");
+  server.flush(1000); // Give the server time to send the response
+  drainIngestQueue(INGEST_QUEUE_DEPTH);
+  commitJournals(true);
+  saveSampleFilter();
+  flushLogFile(true);
+  ESP.restart();
+}
+
+void loop()
+{
+  server.handleClient();
+  drainIngestQueue(INGEST_DRAIN_PER_PASS);
+  commitJournals(false);
+  importBackfill();
+  if (millis() - sampleFilterSavedAt > DEDUP_SAVE_INTERVAL)
+  {
+    saveSampleFilter();
+  }
+  sendTimer.update();
+  if (uploadBacklog)
+  {
+    sendData();
+  }
+  updateWiFi();
+  timeSync.update(millis());
+  applyTimeSync();
+  if (heapStats.sampledAt == 0 || millis() - heapStats.sampledAt > HEAP_SAMPLE_INTERVAL)
+  {
+    sampleHeap();
+  }
+  drainSerialLog();
+  flushLogFile(false);
+  watchdogMin = 0;
+}
@@ -0,0 +1,532 @@
+// Crash recovery of lib/Journal on the host: pio test -e native
+//
+// The journal runs over segment and state files kept in RAM. A test writes
+// through one journal, then damages the files as a reset or a bad card would
+// (a cut tail, a lost state write, an older state layout) and checks that a
+// fresh journal over the same files recovers the records and cursors.
+
+#include <map>
+#include <string>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include <Crc32.h>
+#include <Journal.h>
+
+#define GROUP_BYTES 2048 // JOURNAL_GROUP_BYTES in the firmware
+#define MAX_LOSS_MS 30000
+#define RECORD_BYTES 100 // payload of the records written by fill()
+
+struct Card
+{
+  std::map<uint32_t, std::string> segments;
+  std::string state[2];
+  int lastStateSlot = -1;
+};
+
+class MemJournal : public Journal
+{
+public:
+  using Journal::State;
+  using Journal::StateV1;
+  using Journal::StateV2;
+  using Journal::StateV3;
+
+  MemJournal(Card &card) : Journal(GROUP_BYTES, MAX_LOSS_MS), _card(card)
+  {
+  }
+
+  size_t headSkip(void) const
+  {
+    return _headSkip;
+  }
+
+protected:
+  bool readState(int slot, uint8_t *buffer, size_t size)
+  {
+    if (_card.state[slot].size() != size)
+    {
+      return false;
+    }
+    memcpy(buffer, _card.state[slot].data(), size);
+    return true;
+  }
+
+  bool writeState(int slot, const uint8_t *buffer, size_t size)
+  {
+    _card.state[slot].assign((const char *)buffer, size);
+    _card.lastStateSlot = slot;
+    return true;
+  }
+
+  long segmentSize(uint32_t segment)
+  {
+    auto found = _card.segments.find(segment);
+    return found == _card.segments.end() ? -1 : (long)found->second.size();
+  }
+
+  size_t readSegment(uint32_t segment, uint32_t offset, uint8_t *buffer, size_t size)
+  {
+    const std::string &data = _card.segments[segment];
+    if (offset >= data.size())
+    {
+      return 0;
+    }
+    size = size < data.size() - offset ? size : data.size() - offset;
+    memcpy(buffer, data.data() + offset, size);
+    return size;
+  }
+
+  size_t appendSegment(uint32_t segment, const uint8_t *data, size_t length)
+  {
+    _card.segments[segment].append((const char *)data, length);
+    return length;
+  }
+
+  bool truncateSegment(uint32_t segment, uint32_t length)
+  {
+    _card.segments[segment].resize(length);
+    return true;
+  }
+
+  void removeSegment(uint32_t segment)
+  {
+    _card.segments.erase(segment);
+  }
+
+  Card &_card;
+};
+
+static std::string record(int i)
+{
+  char prefix[16];
+  snprintf(prefix, sizeof(prefix), "r%d,", i);
+  std::string line(prefix);
+  line.resize(RECORD_BYTES, 'x');
+  return line;
+}
+
+static void fill(MemJournal &journal, int from, int count)
+{
+  for (int i = from; i < from + count; i++)
+  {
+    std::string line = record(i);
+    TEST_ASSERT_TRUE(journal.append(line.data(), line.size(), 0));
+  }
+}
+
+// Reads every record from the oldest on the card and checks they are records first .. first + count - 1
+static void expectRecords(MemJournal &journal, int first, int count)
+{
+  JournalPosition pos = journal.oldest();
+  char buffer[JOURNAL_MAX_RECORD + 1];
+  for (int i = first; i < first + count; i++)
+  {
+    int length = journal.read(pos, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT(RECORD_BYTES, length);
+    TEST_ASSERT_EQUAL_STRING(record(i).c_str(), buffer);
+  }
+  TEST_ASSERT_EQUAL_INT(-1, journal.read(pos, buffer, sizeof(buffer)));
+}
+
+static void acknowledge(MemJournal &journal, uint8_t cursor, int count)
+{
+  char buffer[JOURNAL_MAX_RECORD + 1];
+  for (int i = 0; i < count; i++)
+  {
+    TEST_ASSERT_TRUE(journal.peek(cursor, buffer, sizeof(buffer)) > 0);
+    journal.advance(cursor, 0);
+  }
+}
+
+// Rewrites both state slots in an older layout, as that firmware would have left them
+template <typename Older>
+static void downgradeState(Card &card, void (*convert)(const MemJournal::State &, Older &))
+{
+  for (int slot = 0; slot < 2; slot++)
+  {
+    if (card.state[slot].size() != sizeof(MemJournal::State))
+    {
+      continue;
+    }
+    MemJournal::State state;
+    memcpy(&state, card.state[slot].data(), sizeof(state));
+    Older older;
+    memset(&older, 0, sizeof(older));
+    older.magic = state.magic;
+    older.generation = state.generation;
+    older.write = state.write;
+    convert(state, older);
+    older.crc = crc32Update(0, &older, offsetof(Older, crc));
+    card.state[slot].assign((const char *)&older, sizeof(older));
+  }
+}
+
+void test_records_survive_a_restart(void)
+{
+  Card card;
+  {
+    MemJournal journal(card);
+    TEST_ASSERT_TRUE(journal.begin());
+    fill(journal, 0, 10);
+    TEST_ASSERT_TRUE(journal.commit(true, 0));
+  }
+  MemJournal journal(card);
+  TEST_ASSERT_TRUE(journal.begin());
+  TEST_ASSERT_EQUAL_UINT32(0, journal.stats().truncatedBytes);
+  TEST_ASSERT_EQUAL_UINT32(10, journal.pendingRecords());
+  expectRecords(journal, 0, 10);
+}
+
+void test_torn_tail_is_cut_off(void)
+{
+  Card card;
+  std::string savedState[2];
+  {
+    MemJournal journal(card);
+    journal.begin();
+    fill(journal, 0, 5);
+    journal.commit(true, 0);
+    savedState[0] = card.state[0];
+    savedState[1] = card.state[1];
+    fill(journal, 5, 3);
+    journal.commit(true, 0);
+  }
+  // The reset came after the records reached the card but before the state
+  // write, and the last record is only partly there
+  card.state[0] = savedState[0];
+  card.state[1] = savedState[1];
+  size_t size = card.segments[1].size();
+  card.segments[1].resize(size - 40);
+
+  MemJournal journal(card);
+  TEST_ASSERT_TRUE(journal.begin());
+  TEST_ASSERT_EQUAL_UINT32(JOURNAL_FRAME_HEADER + RECORD_BYTES - 40, journal.stats().truncatedBytes);
+  TEST_ASSERT_EQUAL_UINT32(size - (JOURNAL_FRAME_HEADER + RECORD_BYTES), card.segments[1].size());
+  TEST_ASSERT_EQUAL_UINT32(8, journal.checkpoint().seq);
+  expectRecords(journal, 0, 7);
+
+  // Appending carries on from the cut with the next sequence number
+  fill(journal, 7, 2);
+  journal.commit(true, 0);
+  expectRecords(journal, 0, 9);
+}
+
+void test_garbage_after_the_tail_is_cut_off(void)
+{
+  Card card;
+  {
+    MemJournal journal(card);
+    journal.begin();
+    fill(journal, 0, 4);
+    journal.commit(true, 0);
+  }
+  size_t size = card.segments[1].size();
+  card.segments[1].append(64, '\xa5');
+
+  MemJournal journal(card);
+  journal.begin();
+  TEST_ASSERT_EQUAL_UINT32(64, journal.stats().truncatedBytes);
+  TEST_ASSERT_EQUAL_UINT32(size, card.segments[1].size());
+  expectRecords(journal, 0, 4);
+}
+
+void test_record_split_across_group_writes(void)
+{
+  Card card;
+  MemJournal journal(card);
+  journal.begin();
+  fill(journal, 0, 30);
+  journal.commit(false, 0);
+
+  // The group ends on a sector boundary inside a record; the checkpoint stays
+  // before it and the rest of it is written first next time
+  size_t frame = JOURNAL_FRAME_HEADER + RECORD_BYTES;
+  size_t written = card.segments[1].size();
+  TEST_ASSERT_EQUAL_UINT32(0, written % WRITE_BEHIND_SECTOR_SIZE);
+  TEST_ASSERT_TRUE(written % frame != 0);
+  TEST_ASSERT_EQUAL_UINT32(frame - written % frame, journal.headSkip());
+  TEST_ASSERT_EQUAL_UINT32(written / frame * frame, journal.checkpoint().offset);
+  TEST_ASSERT_EQUAL_UINT32(1 + written / frame, journal.checkpoint().seq);
+
+  fill(journal, 30, 20);
+  journal.commit(false, 0);
+  journal.commit(true, 0);
+  TEST_ASSERT_EQUAL_UINT32(0, journal.headSkip());
+  TEST_ASSERT_EQUAL_UINT32(card.segments[1].size(), journal.checkpoint().offset);
+
+  MemJournal restarted(card);
+  restarted.begin();
+  TEST_ASSERT_EQUAL_UINT32(0, restarted.stats().truncatedBytes);
+  expectRecords(restarted, 0, 50);
+}
+
+void test_reset_inside_a_split_record(void)
+{
+  Card card;
+  int complete;
+  {
+    MemJournal journal(card);
+    journal.begin();
+    fill(journal, 0, 30);
+    journal.commit(false, 0);
+    TEST_ASSERT_TRUE(journal.headSkip() > 0);
+    complete = journal.checkpoint().seq - 1;
+  } // reset before the rest of the split record is written
+
+  size_t frame = JOURNAL_FRAME_HEADER + RECORD_BYTES;
+  size_t written = card.segments[1].size();
+  MemJournal journal(card);
+  journal.begin();
+  TEST_ASSERT_EQUAL_UINT32(written % frame, journal.stats().truncatedBytes);
+  TEST_ASSERT_EQUAL_UINT32(complete * frame, card.segments[1].size());
+  expectRecords(journal, 0, complete);
+
+  fill(journal, complete, 5);
+  journal.commit(true, 0);
+  expectRecords(journal, 0, complete + 5);
+}
+
+void test_older_state_slot_used_when_newer_is_damaged(void)
+{
+  Card card;
+  int newest;
+  {
+    MemJournal journal(card);
+    journal.begin();
+    fill(journal, 0, 10);
+    journal.commit(true, 0);
+    acknowledge(journal, 0, 2);
+    journal.commit(true, 0);
+    acknowledge(journal, 0, 3);
+    journal.commit(true, 0);
+    newest = card.lastStateSlot;
+  }
+  TEST_ASSERT_EQUAL_UINT32(sizeof(MemJournal::State), card.state[newest ^ 1].size());
+  {
+    Card intact = card;
+    MemJournal journal(intact);
+    journal.begin();
+    TEST_ASSERT_EQUAL_UINT32(5, journal.pendingRecords());
+  }
+
+  // A bit flipped in the newest copy: the previous one, two records behind, is used
+  card.state[newest][12] ^= 0x01;
+  {
+    Card damaged = card;
+    MemJournal journal(damaged);
+    TEST_ASSERT_TRUE(journal.begin());
+    TEST_ASSERT_EQUAL_UINT32(8, journal.pendingRecords());
+    expectRecords(journal, 0, 10);
+  }
+
+  // A torn write that left the newest copy short is treated the same
+  card.state[newest].resize(card.state[newest].size() / 2);
+  MemJournal journal(card);
+  TEST_ASSERT_TRUE(journal.begin());
+  TEST_ASSERT_EQUAL_UINT32(8, journal.pendingRecords());
+}
+
+void test_state_writes_alternate_slots(void)
+{
+  Card card;
+  MemJournal journal(card);
+  journal.begin();
+  int first = card.lastStateSlot;
+  fill(journal, 0, 3);
+  journal.commit(true, 0);
+  TEST_ASSERT_EQUAL_INT(first ^ 1, card.lastStateSlot);
+  fill(journal, 3, 3);
+  journal.commit(true, 0);
+  TEST_ASSERT_EQUAL_INT(first, card.lastStateSlot);
+}
+
+void test_cursors_follow_their_ids(void)
+{
+  Card card;
+  const uint32_t before[] = {0, 111, 222};
+  {
+    MemJournal journal(card);
+    journal.begin(before, 3);
+    fill(journal, 0, 10);
+    journal.commit(true, 0);
+    acknowledge(journal, 0, 1);
+    acknowledge(journal, 1, 3);
+    acknowledge(journal, 2, 6);
+    journal.commit(true, 0);
+  }
+  const uint32_t after[] = {0, 222, 333};
+  MemJournal journal(card);
+  journal.begin(after, 3);
+  TEST_ASSERT_EQUAL_UINT32(9, journal.pendingRecords(0));
+  TEST_ASSERT_EQUAL_UINT32(4, journal.pendingRecords(1));
+  TEST_ASSERT_EQUAL_UINT32(0, journal.pendingRecords(2)); // new, starts at the checkpoint
+}
+
+void test_acknowledgements_batched_until_commit(void)
+{
+  Card card;
+  {
+    MemJournal journal(card);
+    journal.begin();
+    fill(journal, 0, 10);
+    journal.commit(true, 0);
+    acknowledge(journal, 0, 4);
+  } // reset before the acknowledgements were saved
+  {
+    MemJournal journal(card);
+    journal.begin();
+    TEST_ASSERT_EQUAL_UINT32(10, journal.pendingRecords());
+    acknowledge(journal, 0, 4);
+    journal.commit(false, JOURNAL_ACK_DELAY_MS);
+  }
+  MemJournal journal(card);
+  journal.begin();
+  TEST_ASSERT_EQUAL_UINT32(6, journal.pendingRecords());
+}
+
+void test_mark_saved_with_the_records_it_covers(void)
+{
+  Card card;
+  {
+    MemJournal journal(card);
+    journal.begin();
+    fill(journal, 0, 3);
+    journal.setMark({7, 300});
+    TEST_ASSERT_TRUE(journal.markPending());
+  } // the records were still buffered: both are lost
+  {
+    MemJournal journal(card);
+    journal.begin();
+    TEST_ASSERT_EQUAL_UINT32(0, journal.mark().tag);
+    fill(journal, 0, 3);
+    journal.setMark({7, 300});
+    journal.commit(true, 0);
+    TEST_ASSERT_FALSE(journal.markPending());
+  }
+  MemJournal journal(card);
+  journal.begin();
+  TEST_ASSERT_EQUAL_UINT32(7, journal.mark().tag);
+  TEST_ASSERT_EQUAL_UINT32(300, journal.mark().value);
+  expectRecords(journal, 0, 3);
+}
+
+static void toV3(const MemJournal::State &state, MemJournal::StateV3 &older)
+{
+  older.version = 3;
+  memcpy(older.read, state.read, sizeof(older.read));
+  memcpy(older.cursorId, state.cursorId, sizeof(older.cursorId));
+  older.cursorMask = state.cursorMask;
+}
+
+static void toV2(const MemJournal::State &state, MemJournal::StateV2 &older)
+{
+  older.version = 2;
+  memcpy(older.read, state.read, sizeof(older.read));
+  older.cursorMask = state.cursorMask;
+}
+
+static void toV1(const MemJournal::State &state, MemJournal::StateV1 &older)
+{
+  older.version = 1;
+  older.read = state.read[0];
+}
+
+// Ten records; cursor 0 has acknowledged one, cursor 1 (id 111) three, cursor 2 (id 222) six
+static void writeThreeCursors(Card &card)
+{
+  const uint32_t ids[] = {0, 111, 222};
+  MemJournal journal(card);
+  journal.begin(ids, 3);
+  fill(journal, 0, 10);
+  journal.commit(true, 0);
+  acknowledge(journal, 0, 1);
+  acknowledge(journal, 1, 3);
+  acknowledge(journal, 2, 6);
+  journal.setMark({5, 5});
+  journal.commit(true, 0);
+}
+
+void test_migration_from_v3_keeps_ids(void)
+{
+  Card card;
+  writeThreeCursors(card);
+  downgradeState<MemJournal::StateV3>(card, toV3);
+
+  const uint32_t ids[] = {0, 222, 111};
+  MemJournal journal(card);
+  TEST_ASSERT_TRUE(journal.begin(ids, 3));
+  TEST_ASSERT_EQUAL_UINT32(9, journal.pendingRecords(0));
+  TEST_ASSERT_EQUAL_UINT32(4, journal.pendingRecords(1));
+  TEST_ASSERT_EQUAL_UINT32(7, journal.pendingRecords(2));
+  TEST_ASSERT_EQUAL_UINT32(0, journal.mark().tag);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(MemJournal::State), card.state[card.lastStateSlot].size());
+  expectRecords(journal, 0, 10);
+}
+
+void test_migration_from_v2_names_cursors_by_index(void)
+{
+  Card card;
+  writeThreeCursors(card);
+  downgradeState<MemJournal::StateV2>(card, toV2);
+
+  // Version 2 knew cursors by index: they take the ids given at that index now
+  const uint32_t ids[] = {0, 222, 111};
+  {
+    MemJournal journal(card);
+    TEST_ASSERT_TRUE(journal.begin(ids, 3));
+    TEST_ASSERT_EQUAL_UINT32(9, journal.pendingRecords(0));
+    TEST_ASSERT_EQUAL_UINT32(7, journal.pendingRecords(1));
+    TEST_ASSERT_EQUAL_UINT32(4, journal.pendingRecords(2));
+  }
+  // and keep them from then on
+  const uint32_t reordered[] = {0, 111, 222};
+  MemJournal journal(card);
+  journal.begin(reordered, 3);
+  TEST_ASSERT_EQUAL_UINT32(4, journal.pendingRecords(1));
+  TEST_ASSERT_EQUAL_UINT32(7, journal.pendingRecords(2));
+}
+
+void test_migration_from_v1_keeps_cursor_0(void)
+{
+  Card card;
+  writeThreeCursors(card);
+  downgradeState<MemJournal::StateV1>(card, toV1);
+
+  const uint32_t ids[] = {0, 111};
+  MemJournal journal(card);
+  TEST_ASSERT_TRUE(journal.begin(ids, 2));
+  TEST_ASSERT_EQUAL_UINT32(9, journal.pendingRecords(0));
+  TEST_ASSERT_EQUAL_UINT32(0, journal.pendingRecords(1)); // version 1 had only cursor 0
+  expectRecords(journal, 0, 10);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+int main(int, char **)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_records_survive_a_restart);
+  RUN_TEST(test_torn_tail_is_cut_off);
+  RUN_TEST(test_garbage_after_the_tail_is_cut_off);
+  RUN_TEST(test_record_split_across_group_writes);
+  RUN_TEST(test_reset_inside_a_split_record);
+  RUN_TEST(test_older_state_slot_used_when_newer_is_damaged);
+  RUN_TEST(test_state_writes_alternate_slots);
+  RUN_TEST(test_cursors_follow_their_ids);
+  RUN_TEST(test_acknowledgements_batched_until_commit);
+  RUN_TEST(test_mark_saved_with_the_records_it_covers);
+  RUN_TEST(test_migration_from_v3_keeps_ids);
+  RUN_TEST(test_migration_from_v2_names_cursors_by_index);
+  RUN_TEST(test_migration_from_v1_keeps_cursor_0);
+  return UNITY_END();
+}
@@ -0,0 +1,120 @@
+/*
+ * HttpMux on a POSIX socket bound to the loopback address, for host tools
+ * that run the firmware's HTTP layer in-process. Call handleClient() from a
+ * loop thread, as the firmware does from loop().
+ */
+
+#ifndef PosixHttpMux_h
+#define PosixHttpMux_h
+
+#include <chrono>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HttpMux.h"
+
+inline unsigned long nowMillis(void)
+{
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+class PosixHttpMux : public HttpMux
+{
+
+public:
+  bool begin(uint16_t port)
+  {
+    _listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(_listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(_listener, 16) != 0)
+    {
+      return false;
+    }
+    fcntl(_listener, F_SETFL, O_NONBLOCK);
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+    {
+      _fds[i] = -1;
+    }
+    return true;
+  }
+
+protected:
+  bool acceptConnection(int slot)
+  {
+    int fd = accept(_listener, nullptr, nullptr);
+    if (fd < 0)
+    {
+      return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // A small send buffer stands in for the ESP32's few KB of lwIP buffering
+    int sendBuffer = 8192;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    _fds[slot] = fd;
+    return true;
+  }
+
+  int readConnection(int slot, uint8_t *buffer, size_t size)
+  {
+    ssize_t n = recv(_fds[slot], buffer, size, 0);
+    if (n > 0)
+    {
+      return n;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    return -1;
+  }
+
+  int writeConnection(int slot, const uint8_t *buffer, size_t size)
+  {
+    ssize_t n = ::send(_fds[slot], buffer, size, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    return n;
+  }
+
+  void closeConnection(int slot)
+  {
+    if (_fds[slot] >= 0)
+    {
+      close(_fds[slot]);
+      _fds[slot] = -1;
+    }
+  }
+
+  uint32_t connectionIP(int slot)
+  {
+    (void)slot;
+    return htonl(INADDR_LOOPBACK);
+  }
+
+  unsigned long clockMillis(void)
+  {
+    return nowMillis();
+  }
+
+  int _listener = -1;
+  int _fds[HTTP_MAX_CONNECTIONS];
+
+};
+
+#endif
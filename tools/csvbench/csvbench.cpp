@@ -0,0 +1,172 @@
+/*
+ * Host microbenchmark for the uploader's line parsing.
+ *
+ * Compares the substring loop sendData() used to split a stored line (with
+ * std::string standing in for Arduino String, which copies the same way) to
+ * csvSplit() spans, and times building the upload JSON from the spans.
+ *
+ *   pio run -e csvbench -t exec
+ *   g++ -std=gnu++17 -O2 -Ilib/CsvRecord tools/csvbench/csvbench.cpp lib/CsvRecord/CsvRecord.cpp -o csvbench
+ */
+
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "CsvRecord.h"
+
+#define FIELD_COUNT 21
+#define ITERATIONS 200000
+
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  allocatedBytes += size;
+  void *p = malloc(size);
+  if (!p)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+static const char *keys[FIELD_COUNT] = {"date", "windspeedkmh", "winddir", "rain_rate", "temp_in", "temp_out",
+                                        "hum_in", "hum_out", "uv", "wind_gust", "air_press_rel",
+                                        "air_press_abs", "solar_radiation", "dailyrainin", "raintodayin",
+                                        "totalrainin", "weeklyrainin", "monthlyrainin", "yearlyrainin",
+                                        "maxdailygust", "wh65batt"};
+
+static void trim(std::string &s)
+{
+  size_t first = s.find_first_not_of(" \t\r\n");
+  size_t last = s.find_last_not_of(" \t\r\n");
+  s = first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+}
+
+// The loop sendData() used, value for value
+static float oldPath(const char *line)
+{
+  std::string rawText = line;
+  std::string values[FIELD_COUNT];
+  int index = 0;
+  while (rawText.length() > 0 && index < FIELD_COUNT)
+  {
+    size_t separatorIndex = rawText.find(',');
+    if (separatorIndex == std::string::npos)
+    {
+      values[index] = rawText;
+      trim(values[index]);
+      index++;
+      break;
+    }
+    values[index] = rawText.substr(0, separatorIndex);
+    trim(values[index]);
+    index++;
+    rawText = rawText.substr(separatorIndex + 1);
+  }
+  while (index < FIELD_COUNT)
+  {
+    values[index++] = "NULL";
+  }
+  float sum = 0;
+  for (int i = 1; i < FIELD_COUNT; i++)
+  {
+    sum += atof(values[i].c_str()); // toFloat() as constructJsonData() called it
+  }
+  return sum;
+}
+
+static float newPath(const char *line, size_t length)
+{
+  CsvSpan values[FIELD_COUNT];
+  csvSplit(line, length, values, FIELD_COUNT);
+  float sum = 0;
+  for (int i = 1; i < FIELD_COUNT; i++)
+  {
+    float value;
+    if (csvParseFloat(values[i], &value))
+    {
+      sum += value;
+    }
+  }
+  return sum;
+}
+
+static size_t buildJson(const char *line, size_t length, char *out, size_t size)
+{
+  CsvSpan values[FIELD_COUNT];
+  csvSplit(line, length, values, FIELD_COUNT);
+  JsonWriter json(out, size);
+  json.beginObject();
+  json.key("idws");
+  json.valueLong(1);
+  for (int i = 0; i < FIELD_COUNT; i++)
+  {
+    json.key(keys[i]);
+    if (csvIsNull(values[i]))
+    {
+      json.valueNull();
+    }
+    else if (i == 0)
+    {
+      json.valueString(values[i]);
+    }
+    else if (csvIsNumber(values[i]))
+    {
+      json.valueRaw(values[i]);
+    }
+    else
+    {
+      json.valueString(values[i]);
+    }
+  }
+  json.endObject();
+  return json.length();
+}
+
+template <typename F>
+static void measure(const char *name, F body)
+{
+  size_t startAllocations = allocations;
+  size_t startBytes = allocatedBytes;
+  auto start = std::chrono::steady_clock::now();
+  volatile float sink = 0;
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    sink = sink + body();
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+  printf("%-24s %8.1f ns/line  %6.1f allocations/line  %8.1f bytes allocated/line\n", name, ns,
+         (double)(allocations - startAllocations) / ITERATIONS, (double)(allocatedBytes - startBytes) / ITERATIONS);
+}
+
+int main(void)
+{
+  const char *line = "2024-01-01 08:00:00,5.47,180,0.000,22.28,27.50,55,60,5,7.24,29.92,29.80,700.00,0.000,0.000,12.345,0.000,1.200,30.100,8.10,0";
+  size_t length = strlen(line);
+  char json[768];
+
+  printf("line of %zu bytes, %d fields, %d iterations\n", length, FIELD_COUNT, ITERATIONS);
+  measure("substring loop", [&] { return oldPath(line); });
+  measure("csvSplit spans", [&] { return newPath(line, length); });
+  measure("spans + JsonWriter", [&] { return (float)buildJson(line, length, json, sizeof(json)); });
+  buildJson(line, length, json, sizeof(json));
+  printf("%s\n", json);
+  return 0;
+}
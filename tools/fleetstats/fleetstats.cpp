@@ -0,0 +1,734 @@
+/*
+ * Statistics over exported station data.
+ *
+ * Reads any number of files in the stored CSV layout (date, then the fields
+ * of observationFields: /journal.csv downloads, old data.txt files), one
+ * station per file, and reports per field count, missing, invalid, min, max,
+ * mean and standard deviation; gaps between samples; duplicate and
+ * out-of-order timestamps; and a series resampled to fixed buckets.
+ *
+ *   pio run -e fleetstats && .pio/build/fleetstats/program --out=report station1.csv station2.csv
+ *   g++ -std=gnu++17 -O3 -march=native -pthread -Ilib/Observation -Ilib/CsvRecord tools/fleetstats/fleetstats.cpp \
+ *       lib/Observation/Observation.cpp lib/CsvRecord/CsvRecord.cpp -o fleetstats
+ *
+ * Options:
+ *   --threads=<n>     worker threads (default: all cores)
+ *   --gap=<s>         a longer pause between two samples is a gap (default 300)
+ *   --resample=<s>    bucket width of the resampled series (default 3600)
+ *   --out=<dir>       writes summary.csv, fields.csv, gaps.csv and one
+ *                     <station>.resampled.csv per file; without it only the
+ *                     summary is printed
+ *
+ * Files are memory-mapped and cut into chunks at line boundaries; the chunks
+ * of all files are shared out among the threads, which scan for separators
+ * 16 or 32 bytes at a time (SSE2, AVX2 or NEON, whichever the build targets).
+ * Each chunk keeps its own partial results, merged per file in order at the
+ * end, so the threads never share anything while scanning.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "Observation.h"
+
+#define CHUNK_BYTES (8u << 20) // per unit of work; a chunk ends at the first newline past this
+#define FIELDS OBSERVATION_FIELD_COUNT
+#define COLUMNS OBSERVATION_COLUMN_COUNT
+
+/**
+ * Calls visit(position, isNewline) for every ',' and '\n' in data, in order.
+ * Whole blocks are compared at once and only the hits are visited, so the
+ * bytes inside fields cost a compare each rather than a branch each.
+ */
+template <typename Visitor>
+inline void scanSeparators(const char *data, size_t length, Visitor &visit)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+    uint32_t newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+    uint32_t hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, comma)) | newlines;
+    while (hits)
+    {
+      int bit = __builtin_ctz(hits);
+      visit(i + bit, (newlines >> bit) & 1);
+      hits &= hits - 1;
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+    uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+    uint32_t hits = _mm_movemask_epi8(_mm_cmpeq_epi8(block, comma)) | newlines;
+    while (hits)
+    {
+      int bit = __builtin_ctz(hits);
+      visit(i + bit, (newlines >> bit) & 1);
+      hits &= hits - 1;
+    }
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t comma = vdupq_n_u8(',');
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  for (; i + 16 <= length; i += 16)
+  {
+    uint8x16_t block = vld1q_u8((const uint8_t *)data + i);
+    uint8x16_t matches = vorrq_u8(vceqq_u8(block, comma), vceqq_u8(block, newline));
+    // Narrowing shift: four bits per byte, so a 16-byte compare fits one 64-bit mask
+    uint64_t hits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+    while (hits)
+    {
+      int byte = __builtin_ctzll(hits) >> 2;
+      visit(i + byte, data[i + byte] == '\n');
+      hits &= ~(0xfULL << (byte * 4));
+    }
+  }
+#endif
+  for (; i < length; i++)
+  {
+    if (data[i] == ',' || data[i] == '\n')
+    {
+      visit(i, data[i] == '\n');
+    }
+  }
+}
+
+static const double powersOfTen[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+// Decimal numbers as the firmware writes them; anything else is refused
+static bool parseNumber(const char *p, const char *end, double &value)
+{
+  bool negative = p < end && *p == '-';
+  p += negative;
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int decimals = 0;
+  for (; p < end && *p >= '0' && *p <= '9' && digits < 18; p++, digits++)
+  {
+    mantissa = mantissa * 10 + (*p - '0');
+  }
+  if (p < end && *p == '.')
+  {
+    for (p++; p < end && *p >= '0' && *p <= '9' && digits < 18 && decimals < 9; p++, digits++, decimals++)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+  }
+  if (p != end || digits == 0)
+  {
+    return false;
+  }
+  value = (negative ? -(double)mantissa : (double)mantissa) / powersOfTen[decimals];
+  return true;
+}
+
+static int twoDigits(const char *p)
+{
+  return (p[0] >= '0' && p[0] <= '9' && p[1] >= '0' && p[1] <= '9') ? (p[0] - '0') * 10 + (p[1] - '0') : -1;
+}
+
+// "YYYY-MM-DD HH:MM:SS" to seconds since 1970 in the same (local) time, 0 if not a date
+static uint32_t parseDate(const char *p, const char *end)
+{
+  if (end - p != 19 || p[4] != '-' || p[7] != '-' || p[10] != ' ' || p[13] != ':' || p[16] != ':')
+  {
+    return 0;
+  }
+  int century = twoDigits(p), yy = twoDigits(p + 2), month = twoDigits(p + 5), day = twoDigits(p + 8);
+  int hour = twoDigits(p + 11), minute = twoDigits(p + 14), second = twoDigits(p + 17);
+  if (century < 19 || yy < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 ||
+      minute < 0 || minute > 59 || second < 0 || second > 60)
+  {
+    return 0;
+  }
+  // Days from civil (H. Hinnant), the inverse of formatDateTime()
+  int year = century * 100 + yy - (month <= 2);
+  int era = year / 400;
+  int yoe = year - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = (int64_t)era * 146097 + doe - 719468;
+  return days < 0 ? 0 : (uint32_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+}
+
+struct FieldStats
+{
+  uint64_t count = 0;
+  uint64_t missing = 0; // empty or NULL, or the column is absent
+  uint64_t invalid = 0; // present but not a number
+  double min = INFINITY;
+  double max = -INFINITY;
+  double sum = 0;
+  double sumSquares = 0;
+
+  void add(double value)
+  {
+    count++;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    sum += value;
+    sumSquares += value * value;
+  }
+
+  void merge(const FieldStats &other)
+  {
+    count += other.count;
+    missing += other.missing;
+    invalid += other.invalid;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    sum += other.sum;
+    sumSquares += other.sumSquares;
+  }
+};
+
+struct Bucket
+{
+  uint32_t count[FIELDS] = {};
+  double sum[FIELDS] = {};
+};
+
+struct InputFile
+{
+  std::string path;
+  std::string station; // file name without directory and extension
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+// One unit of work and everything found in it
+struct Chunk
+{
+  int file;
+  size_t begin;
+  size_t end;
+
+  uint64_t lines = 0;
+  uint64_t rejected = 0; // no usable date: headers, damaged lines
+  FieldStats fields[FIELDS];
+  std::vector<uint32_t> times; // in file order, for gaps and duplicates
+  std::unordered_map<uint32_t, Bucket> buckets;
+};
+
+struct Options
+{
+  int threads = 0;
+  uint32_t gap = 300;
+  uint32_t resample = 3600;
+  const char *out = nullptr;
+};
+
+// Splits the lines of a chunk at the separators the scanner reports
+class ChunkParser
+{
+
+public:
+  ChunkParser(Chunk &chunk, const char *data, uint32_t resample)
+      : _chunk(chunk), _data(data), _resample(resample), _lineStart(0), _column(0)
+  {
+  }
+
+  void operator()(size_t position, bool newline)
+  {
+    if (_column < COLUMNS)
+    {
+      _ends[_column] = position;
+    }
+    _column++;
+    if (newline)
+    {
+      endLine();
+      _lineStart = position + 1;
+      _column = 0;
+    }
+  }
+
+  void finish(size_t length)
+  {
+    if (_lineStart < length)
+    {
+      (*this)(length, true); // last line of the file without a newline
+    }
+  }
+
+private:
+  void endLine(void)
+  {
+    size_t start = _lineStart;
+    size_t columns = std::min(_column, (size_t)COLUMNS);
+    size_t lineEnd = _ends[columns - 1];
+    if (lineEnd > start && _data[lineEnd - 1] == '\r')
+    {
+      _ends[columns - 1] = --lineEnd;
+    }
+    if (lineEnd == start)
+    {
+      return; // blank line
+    }
+    _chunk.lines++;
+
+    uint32_t time = parseDate(_data + start, _data + _ends[0]);
+    if (time == 0)
+    {
+      _chunk.rejected++;
+      return;
+    }
+    _chunk.times.push_back(time);
+    Bucket &bucket = _chunk.buckets[time / _resample];
+
+    for (size_t column = 1; column < COLUMNS; column++)
+    {
+      FieldStats &stats = _chunk.fields[column - 1];
+      if (column >= columns)
+      {
+        stats.missing++;
+        continue;
+      }
+      const char *p = _data + _ends[column - 1] + 1;
+      const char *end = _data + _ends[column];
+      while (p < end && *p == ' ')
+      {
+        p++;
+      }
+      while (end > p && end[-1] == ' ')
+      {
+        end--;
+      }
+      double value;
+      if (p == end || (end - p == 4 && (memcmp(p, "NULL", 4) == 0 || memcmp(p, "null", 4) == 0)))
+      {
+        stats.missing++;
+      }
+      else if (parseNumber(p, end, value))
+      {
+        stats.add(value);
+        bucket.count[column - 1]++;
+        bucket.sum[column - 1] += value;
+      }
+      else
+      {
+        stats.invalid++;
+      }
+    }
+  }
+
+  Chunk &_chunk;
+  const char *_data; // start of the chunk
+  uint32_t _resample;
+  size_t _lineStart;
+  size_t _column;
+  size_t _ends[COLUMNS]; // offset of the separator after each column
+};
+
+static void parseChunk(Chunk &chunk, const InputFile &file, uint32_t resample)
+{
+  const char *data = file.data + chunk.begin;
+  size_t length = chunk.end - chunk.begin;
+  chunk.times.reserve(length / 100);
+  ChunkParser parser(chunk, data, resample);
+  scanSeparators(data, length, parser);
+  parser.finish(length);
+}
+
+static bool mapFile(InputFile &file)
+{
+  int fd = open(file.path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  file.size = info.st_size;
+  if (file.size > 0)
+  {
+    void *data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      return false;
+    }
+    madvise(data, file.size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    file.data = (const char *)data;
+  }
+  close(fd); // the mapping stays valid
+  return true;
+}
+
+// Cuts a file into chunks that each start at a line and end after a newline
+static void addChunks(std::vector<Chunk> &chunks, int index, const InputFile &file)
+{
+  size_t begin = 0;
+  while (begin < file.size)
+  {
+    size_t end = std::min(file.size, begin + CHUNK_BYTES);
+    if (end < file.size)
+    {
+      const char *newline = (const char *)memchr(file.data + end, '\n', file.size - end);
+      end = newline ? newline - file.data + 1 : file.size;
+    }
+    Chunk chunk;
+    chunk.file = index;
+    chunk.begin = begin;
+    chunk.end = end;
+    chunks.push_back(std::move(chunk));
+    begin = end;
+  }
+}
+
+struct Gap
+{
+  uint32_t from;
+  uint32_t to;
+};
+
+// Everything known about one file once its chunks are merged
+struct StationReport
+{
+  uint64_t lines = 0;
+  uint64_t samples = 0;
+  uint64_t rejected = 0;
+  uint64_t duplicates = 0; // timestamps seen before in the file
+  uint64_t outOfOrder = 0; // older than the sample before
+  uint32_t first = 0;
+  uint32_t last = 0;
+  uint64_t gapSeconds = 0;
+  std::vector<Gap> gaps;
+  FieldStats fields[FIELDS];
+  std::map<uint32_t, Bucket> buckets;
+};
+
+static void mergeFile(StationReport &report, std::vector<Chunk *> &parts, uint32_t gap)
+{
+  std::vector<uint32_t> times;
+  for (Chunk *chunk : parts)
+  {
+    report.lines += chunk->lines;
+    report.rejected += chunk->rejected;
+    for (int i = 0; i < FIELDS; i++)
+    {
+      report.fields[i].merge(chunk->fields[i]);
+    }
+    for (auto &entry : chunk->buckets)
+    {
+      Bucket &bucket = report.buckets[entry.first];
+      for (int i = 0; i < FIELDS; i++)
+      {
+        bucket.count[i] += entry.second.count[i];
+        bucket.sum[i] += entry.second.sum[i];
+      }
+    }
+    times.insert(times.end(), chunk->times.begin(), chunk->times.end());
+    std::vector<uint32_t>().swap(chunk->times);
+    chunk->buckets.clear();
+  }
+  report.samples = times.size();
+  if (times.empty())
+  {
+    return;
+  }
+
+  for (size_t i = 1; i < times.size(); i++)
+  {
+    if (times[i] < times[i - 1])
+    {
+      report.outOfOrder++;
+    }
+  }
+
+  // Gaps and the time span are taken over the distinct timestamps in time order
+  std::sort(times.begin(), times.end());
+  report.first = times.front();
+  report.last = times.back();
+  for (size_t i = 1; i < times.size(); i++)
+  {
+    if (times[i] == times[i - 1])
+    {
+      report.duplicates++;
+    }
+    else if (times[i] - times[i - 1] > gap)
+    {
+      report.gaps.push_back({times[i - 1], times[i]});
+      report.gapSeconds += times[i] - times[i - 1];
+    }
+  }
+}
+
+static std::string formatTime(uint32_t time)
+{
+  char out[20];
+  formatDateTime(out, time);
+  return std::string(out, 19);
+}
+
+static void writeField(FILE *out, const FieldStats &stats)
+{
+  double mean = stats.count ? stats.sum / stats.count : 0;
+  double deviation = stats.count ? sqrt(std::max(0.0, stats.sumSquares / stats.count - mean * mean)) : 0;
+  if (stats.count)
+  {
+    fprintf(out, "%llu,%llu,%llu,%.6g,%.6g,%.6g,%.6g\n", (unsigned long long)stats.count,
+            (unsigned long long)stats.missing, (unsigned long long)stats.invalid, stats.min, stats.max, mean, deviation);
+  }
+  else
+  {
+    fprintf(out, "0,%llu,%llu,,,,\n", (unsigned long long)stats.missing, (unsigned long long)stats.invalid);
+  }
+}
+
+static FILE *openOutput(const Options &options, const std::string &name)
+{
+  std::string path = std::string(options.out) + "/" + name;
+  FILE *out = fopen(path.c_str(), "w");
+  if (!out)
+  {
+    fprintf(stderr, "cannot write %s\n", path.c_str());
+  }
+  return out;
+}
+
+static void writeReports(const Options &options, const std::vector<InputFile> &files,
+                         const std::vector<StationReport> &reports)
+{
+  mkdir(options.out, 0755);
+  FILE *summary = openOutput(options, "summary.csv");
+  FILE *fields = openOutput(options, "fields.csv");
+  FILE *gaps = openOutput(options, "gaps.csv");
+  if (!summary || !fields || !gaps)
+  {
+    return;
+  }
+  fprintf(summary, "station,lines,samples,rejected,duplicates,out_of_order,first,last,gaps,gap_seconds\n");
+  fprintf(fields, "station,field,count,missing,invalid,min,max,mean,stddev\n");
+  fprintf(gaps, "station,from,to,seconds\n");
+
+  char header[OBSERVATION_CSV_SIZE * 2];
+  observationCsvHeader(header);
+
+  for (size_t f = 0; f < files.size(); f++)
+  {
+    const StationReport &report = reports[f];
+    const char *station = files[f].station.c_str();
+    fprintf(summary, "%s,%llu,%llu,%llu,%llu,%llu,%s,%s,%zu,%llu\n", station, (unsigned long long)report.lines,
+            (unsigned long long)report.samples, (unsigned long long)report.rejected,
+            (unsigned long long)report.duplicates, (unsigned long long)report.outOfOrder,
+            report.samples ? formatTime(report.first).c_str() : "", report.samples ? formatTime(report.last).c_str() : "",
+            report.gaps.size(), (unsigned long long)report.gapSeconds);
+    for (int i = 0; i < FIELDS; i++)
+    {
+      fprintf(fields, "%s,%s,", station, observationFields[i].key);
+      writeField(fields, report.fields[i]);
+    }
+    for (const Gap &gap : report.gaps)
+    {
+      fprintf(gaps, "%s,%s,%s,%u\n", station, formatTime(gap.from).c_str(), formatTime(gap.to).c_str(),
+              gap.to - gap.from);
+    }
+
+    // One row per bucket, one column per field: the bucket mean, empty without readings
+    FILE *series = openOutput(options, files[f].station + ".resampled.csv");
+    if (!series)
+    {
+      continue;
+    }
+    fprintf(series, "%s\n", header);
+    for (const auto &entry : report.buckets)
+    {
+      fputs(formatTime(entry.first * options.resample).c_str(), series);
+      for (int i = 0; i < FIELDS; i++)
+      {
+        if (entry.second.count[i])
+        {
+          fprintf(series, ",%.*f", observationFields[i].decimals, entry.second.sum[i] / entry.second.count[i]);
+        }
+        else
+        {
+          fputc(',', series);
+        }
+      }
+      fputc('\n', series);
+    }
+    fclose(series);
+  }
+  fclose(summary);
+  fclose(fields);
+  fclose(gaps);
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  std::vector<InputFile> files;
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--threads=", 10) == 0)
+    {
+      options.threads = atoi(arg + 10);
+    }
+    else if (strncmp(arg, "--gap=", 6) == 0)
+    {
+      options.gap = std::max(1, atoi(arg + 6));
+    }
+    else if (strncmp(arg, "--resample=", 11) == 0)
+    {
+      options.resample = std::max(1, atoi(arg + 11));
+    }
+    else if (strncmp(arg, "--out=", 6) == 0)
+    {
+      options.out = arg + 6;
+    }
+    else if (strncmp(arg, "--", 2) == 0)
+    {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 1;
+    }
+    else
+    {
+      InputFile file;
+      file.path = arg;
+      const char *slash = strrchr(arg, '/');
+      file.station = slash ? slash + 1 : arg;
+      size_t dot = file.station.rfind('.');
+      if (dot != std::string::npos && dot > 0)
+      {
+        file.station.resize(dot);
+      }
+      files.push_back(file);
+    }
+  }
+  if (files.empty())
+  {
+    fprintf(stderr, "usage: fleetstats [--threads=n] [--gap=s] [--resample=s] [--out=dir] file...\n");
+    return 1;
+  }
+  if (options.threads <= 0)
+  {
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Chunk> chunks;
+  size_t totalBytes = 0;
+  for (size_t f = 0; f < files.size(); f++)
+  {
+    if (!mapFile(files[f]))
+    {
+      fprintf(stderr, "cannot read %s\n", files[f].path.c_str());
+      return 1;
+    }
+    addChunks(chunks, f, files[f]);
+    totalBytes += files[f].size;
+  }
+
+  // Largest first, so a big file is not left to one thread at the end
+  std::vector<size_t> order(chunks.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return chunks[a].end - chunks[a].begin > chunks[b].end - chunks[b].begin;
+  });
+
+  std::atomic<size_t> nextChunk(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < options.threads; t++)
+  {
+    workers.emplace_back([&] {
+      for (size_t i; (i = nextChunk++) < order.size();)
+      {
+        Chunk &chunk = chunks[order[i]];
+        parseChunk(chunk, files[chunk.file], options.resample);
+      }
+    });
+  }
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+  double scanSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Chunks were created in file order, so each file's parts are already in sequence
+  std::vector<StationReport> reports(files.size());
+  std::vector<std::vector<Chunk *>> parts(files.size());
+  for (Chunk &chunk : chunks)
+  {
+    parts[chunk.file].push_back(&chunk);
+  }
+  std::atomic<size_t> nextFile(0);
+  workers.clear();
+  for (int t = 0; t < options.threads; t++)
+  {
+    workers.emplace_back([&] {
+      for (size_t f; (f = nextFile++) < files.size();)
+      {
+        mergeFile(reports[f], parts[f], options.gap);
+      }
+    });
+  }
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+
+  printf("%-16s %10s %10s %8s %8s %8s  %-19s  %-19s %6s\n", "station", "lines", "samples", "rejected", "dupes",
+         "order", "first", "last", "gaps");
+  for (size_t f = 0; f < files.size(); f++)
+  {
+    const StationReport &report = reports[f];
+    printf("%-16s %10llu %10llu %8llu %8llu %8llu  %-19s  %-19s %6zu\n", files[f].station.c_str(),
+           (unsigned long long)report.lines, (unsigned long long)report.samples, (unsigned long long)report.rejected,
+           (unsigned long long)report.duplicates, (unsigned long long)report.outOfOrder,
+           report.samples ? formatTime(report.first).c_str() : "-", report.samples ? formatTime(report.last).c_str() : "-",
+           report.gaps.size());
+  }
+  if (options.out)
+  {
+    writeReports(options, files, reports);
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%zu files, %.1f MB in %.2f s (scan %.2f s, %.0f MB/s) on %d threads\n", files.size(),
+          totalBytes / 1e6, seconds, scanSeconds, scanSeconds > 0 ? totalBytes / 1e6 / scanSeconds : 0, options.threads);
+  for (InputFile &file : files)
+  {
+    if (file.data)
+    {
+      munmap((void *)file.data, file.size);
+    }
+  }
+  return 0;
+}
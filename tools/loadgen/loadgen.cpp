@@ -0,0 +1,676 @@
+/*
+ * Load generator for /post.
+ *
+ * Plays a number of consoles posting Ecowitt/MISOL form bodies (dateutc,
+ * tempf, windspeedmph, baromrelin, ...) at a fixed total rate over several
+ * connections, with some readings left out or replaced by garbage, and
+ * records the latency of every request in an HDR-style histogram.
+ *
+ *   pio run -e loadgen -t exec                                (in-process HttpMux)
+ *   .pio/build/loadgen/program --host=192.168.8.1 --rate=5    (a device)
+ *   g++ -std=gnu++17 -O2 -pthread -Ilib/HttpMux -Ilib/Admission -Ilib/Observation -Ilib/CsvRecord \
+ *       -Ilib/SampleFilter -Ilib/Crc32 -Ilib/Log -Itools/common tools/loadgen/loadgen.cpp lib/HttpMux/HttpMux.cpp \
+ *       lib/Admission/IngestPipeline.cpp lib/Admission/IngestQueue.cpp lib/Admission/RateLimiter.cpp \
+ *       lib/SampleFilter/SampleFilter.cpp lib/Crc32/Crc32.cpp lib/Observation/Observation.cpp \
+ *       lib/CsvRecord/CsvRecord.cpp lib/Log/Log.cpp -o loadgen
+ *
+ * Options:
+ *   --host=<ip> --port=<n>   target; without --host an in-process HttpMux runs
+ *                            the firmware's admission, dedup, parse and queue
+ *                            path on loopback
+ *   --no-limit               in-process only: skips the per-source rate limit,
+ *                            which otherwise answers most requests 429 since
+ *                            every connection comes from 127.0.0.1
+ *   --rate=<n>               requests per second over all connections, 0 for
+ *                            as fast as each connection can go (default 50)
+ *   --concurrency=<n>        connections in flight (default 4)
+ *   --consoles=<n>           distinct consoles, each with its own PASSKEY and
+ *                            clock (default 8, at least one per connection)
+ *   --duration=<s>           (default 10)
+ *   --timeout=<ms>           per request, counted apart from errors (default 5000)
+ *   --missing=<pct>          readings left out of a body (default 5)
+ *   --garbage=<pct>          readings, and dates, replaced by junk (default 2)
+ *   --seed=<n>               same seed, same bodies (default 1)
+ *   --hgrm=<file>            writes the percentile distribution in
+ *                            HdrHistogram's .hgrm format for plotting
+ *
+ * With --rate, latency is measured from when a request was due rather than
+ * from when it was sent, so a stalled server is charged for the requests that
+ * queued up behind the stall (no coordinated omission).
+ *
+ * The in-process target answers /post through the firmware's own
+ * IngestPipeline, as handlePost() does for a device without gateway
+ * stations: rate limit per source, queue full, duplicate samples acknowledged
+ * without being stored, then parse and queue. It does not keep /api/latest
+ * or /api/history, and the journal writes that drain the queue are simulated
+ * with sleeps.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "IngestPipeline.h"
+#include "IngestQueue.h"
+#include "Observation.h"
+#include "PosixHttpMux.h"
+#include "RateLimiter.h"
+#include "SampleFilter.h"
+
+#define LOCAL_PORT 18081
+#define LOCAL_APPEND_US 40   // one journal append, RAM only
+#define LOCAL_COMMIT_US 3000 // one sector-aligned journal write on the card
+#define LOCAL_COMMIT_EVERY 12 // records per journal write, about 2 KB
+#define LOCAL_DRAIN_PER_PASS 2
+#define LOCAL_BURST 6         // INGEST_BURST in the firmware
+#define LOCAL_REFILL_MS 5000  // INGEST_REFILL_MS
+
+#define SAMPLE_INTERVAL 60 // seconds between a console's samples, as posted by real consoles
+
+#define HISTOGRAM_SUB_BUCKETS 1024 // about 0.1% resolution
+#define HISTOGRAM_BUCKETS 23       // up to 2^32 us, over an hour
+#define HISTOGRAM_SIZE ((HISTOGRAM_BUCKETS + 1) * (HISTOGRAM_SUB_BUCKETS / 2))
+
+/**
+ * Log-linear latency histogram in microseconds, laid out as HdrHistogram
+ * does: values below HISTOGRAM_SUB_BUCKETS are counted exactly, above that
+ * each power of two is split into HISTOGRAM_SUB_BUCKETS / 2 equal steps. One
+ * per worker, merged at the end, so recording never takes a lock.
+ */
+class LatencyHistogram
+{
+
+public:
+  LatencyHistogram(void) : _counts(HISTOGRAM_SIZE), _total(0), _max(0), _sum(0), _sumSquares(0) {}
+
+  void record(uint64_t us)
+  {
+    _counts[index(us)]++;
+    _total++;
+    _max = std::max(_max, us);
+    _sum += us;
+    _sumSquares += (double)us * us;
+  }
+
+  void add(const LatencyHistogram &other)
+  {
+    for (size_t i = 0; i < _counts.size(); i++)
+    {
+      _counts[i] += other._counts[i];
+    }
+    _total += other._total;
+    _max = std::max(_max, other._max);
+    _sum += other._sum;
+    _sumSquares += other._sumSquares;
+  }
+
+  // Highest value counted alongside the value at this percentile
+  uint64_t percentile(double p) const
+  {
+    if (_total == 0)
+    {
+      return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)ceil(p / 100.0 * _total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); i++)
+    {
+      seen += _counts[i];
+      if (seen >= rank)
+      {
+        return std::min(highest(i), _max);
+      }
+    }
+    return _max;
+  }
+
+  uint64_t total(void) const { return _total; }
+  uint64_t max(void) const { return _max; }
+  double mean(void) const { return _total ? (double)_sum / _total : 0; }
+  double deviation(void) const
+  {
+    double m = mean();
+    return _total ? sqrt(std::max(0.0, _sumSquares / _total - m * m)) : 0;
+  }
+
+  // Percentile distribution in HdrHistogram's .hgrm text format, values in ms
+  void writeDistribution(FILE *out) const
+  {
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (int step = 0;; step++)
+    {
+      double fraction = 1.0 - pow(0.5, step / 5.0); // five rows per halving of what is left
+      uint64_t value = percentile(fraction * 100.0);
+      uint64_t count = countAtOrBelow(value);
+      if (count >= _total)
+      {
+        break;
+      }
+      fprintf(out, "%12.3f %2.12f %10llu %14.2f\n", value / 1000.0, fraction, (unsigned long long)count, 1.0 / (1.0 - fraction));
+    }
+    fprintf(out, "%12.3f %2.12f %10llu\n", _max / 1000.0, 1.0, (unsigned long long)_total);
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean() / 1000.0, deviation() / 1000.0);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n", _max / 1000.0, (unsigned long long)_total);
+    fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n", HISTOGRAM_BUCKETS, HISTOGRAM_SUB_BUCKETS);
+  }
+
+private:
+  static size_t index(uint64_t us)
+  {
+    if (us < HISTOGRAM_SUB_BUCKETS)
+    {
+      return us;
+    }
+    int bucket = 63 - __builtin_clzll(us) - 9; // 1 for [1024, 2048)
+    if (bucket >= HISTOGRAM_BUCKETS)
+    {
+      return HISTOGRAM_SIZE - 1; // 2^32 us and above share the last step
+    }
+    return (bucket + 1) * (HISTOGRAM_SUB_BUCKETS / 2) + ((us >> bucket) - HISTOGRAM_SUB_BUCKETS / 2);
+  }
+
+  static uint64_t highest(size_t i)
+  {
+    if (i < HISTOGRAM_SUB_BUCKETS)
+    {
+      return i;
+    }
+    int bucket = i / (HISTOGRAM_SUB_BUCKETS / 2) - 1;
+    uint64_t sub = i % (HISTOGRAM_SUB_BUCKETS / 2) + HISTOGRAM_SUB_BUCKETS / 2;
+    return ((sub + 1) << bucket) - 1;
+  }
+
+  uint64_t countAtOrBelow(uint64_t value) const
+  {
+    uint64_t count = 0;
+    for (size_t i = 0; i <= index(value) && i < _counts.size(); i++)
+    {
+      count += _counts[i];
+    }
+    return count;
+  }
+
+  std::vector<uint64_t> _counts;
+  uint64_t _total;
+  uint64_t _max;
+  uint64_t _sum;
+  double _sumSquares;
+
+};
+
+// Plausible value ranges of what consoles post, in console units
+struct Reading
+{
+  const char *arg;
+  float low;
+  float high;
+  float step; // most a reading moves between two samples
+  int decimals;
+};
+
+static const Reading readings[] = {
+    {"tempf", -10, 110, 0.6f, 1},         {"tempinf", 55, 90, 0.2f, 1},         {"humidity", 5, 100, 2, 0},
+    {"humidityin", 20, 80, 1, 0},         {"baromrelin", 28.5f, 31, 0.01f, 3},  {"baromabsin", 28, 30.5f, 0.01f, 3},
+    {"winddir", 0, 359, 25, 0},           {"windspeedmph", 0, 40, 2, 1},        {"windgustmph", 0, 60, 3, 1},
+    {"maxdailygust", 0, 60, 0.5f, 1},     {"rainratein", 0, 4, 0.1f, 3},        {"eventrainin", 0, 6, 0.01f, 3},
+    {"hourlyrainin", 0, 3, 0.01f, 3},     {"dailyrainin", 0, 8, 0.01f, 3},      {"weeklyrainin", 0, 12, 0.01f, 3},
+    {"monthlyrainin", 0, 30, 0.01f, 3},   {"yearlyrainin", 0, 120, 0.01f, 3},   {"totalrainin", 0, 400, 0.01f, 3},
+    {"solarradiation", 0, 1200, 40, 2},   {"uv", 0, 12, 1, 0},                  {"wh65batt", 0, 1, 0, 0},
+};
+#define READING_COUNT ((int)(sizeof(readings) / sizeof(readings[0])))
+
+static const char *const garbageValues[] = {"", "abc", "NaN", "inf", "1e40", "--", "%ZZ", "12.3.4", "-", "0x1F",
+                                            "99999999999999999999"};
+
+struct Options
+{
+  const char *host = nullptr;
+  uint16_t port = 80;
+  double rate = 50;
+  int concurrency = 4;
+  int consoles = 8;
+  int duration = 10;
+  int timeoutMs = 5000;
+  double missing = 5;
+  double garbage = 2;
+  unsigned seed = 1;
+  const char *hgrm = nullptr;
+  bool limit = true;
+};
+
+// One simulated console: its own PASSKEY, clock and slowly drifting readings
+struct Console
+{
+  char passkey[33];
+  uint32_t time;
+  float values[READING_COUNT];
+};
+
+class BodyGenerator
+{
+
+public:
+  BodyGenerator(const Options &options, unsigned seed) : _options(options), _random(seed) {}
+
+  void initConsole(Console &console, int number)
+  {
+    snprintf(console.passkey, sizeof(console.passkey), "%032X", (unsigned)(0x5eed0000 + number));
+    console.time = 1704067200 + number * 7; // 2024-01-01, consoles slightly out of step
+    for (int i = 0; i < READING_COUNT; i++)
+    {
+      std::uniform_real_distribution<float> start(readings[i].low, readings[i].high);
+      console.values[i] = start(_random);
+    }
+  }
+
+  std::string next(Console &console)
+  {
+    console.time += SAMPLE_INTERVAL;
+    std::string body = "PASSKEY=";
+    body += console.passkey;
+    body += "&stationtype=EasyWeatherV1.6.4&dateutc=";
+    body += chance(_options.garbage) ? "2024-13-45+99%3A99%3A99" : date(console.time);
+    body += "&freq=868M&model=WS2900_V2.01.18";
+
+    for (int i = 0; i < READING_COUNT; i++)
+    {
+      const Reading &reading = readings[i];
+      std::uniform_real_distribution<float> move(-reading.step, reading.step);
+      console.values[i] = std::min(reading.high, std::max(reading.low, console.values[i] + move(_random)));
+      if (chance(_options.missing))
+      {
+        continue;
+      }
+      body += '&';
+      body += reading.arg;
+      body += '=';
+      if (chance(_options.garbage))
+      {
+        std::uniform_int_distribution<int> pick(0, sizeof(garbageValues) / sizeof(garbageValues[0]) - 1);
+        body += garbageValues[pick(_random)];
+      }
+      else
+      {
+        char value[24];
+        snprintf(value, sizeof(value), "%.*f", reading.decimals, console.values[i]);
+        body += value;
+      }
+    }
+    return body;
+  }
+
+private:
+  bool chance(double percent)
+  {
+    return std::uniform_real_distribution<double>(0, 100)(_random) < percent;
+  }
+
+  static std::string date(uint32_t time)
+  {
+    char out[20];
+    formatDateTime(out, time);
+    std::string encoded;
+    for (const char *p = out; *p; p++)
+    {
+      encoded += *p == ' ' ? "+" : *p == ':' ? "%3A" : std::string(1, *p);
+    }
+    return encoded;
+  }
+
+  const Options &_options;
+  std::mt19937 _random;
+
+};
+
+struct WorkerResult
+{
+  LatencyHistogram latency;
+  uint64_t statuses[6] = {}; // by hundreds, [0] for a response that could not be read
+  uint64_t status429 = 0;
+  uint64_t status503 = 0;
+  uint64_t errors = 0;   // refused, reset or closed without a response
+  uint64_t timeouts = 0; // no complete response within --timeout
+};
+
+enum ExchangeResult
+{
+  EXCHANGE_OK,
+  EXCHANGE_ERROR,
+  EXCHANGE_TIMEOUT
+};
+
+// Posts one body on its own connection, as consoles do, and reads the status
+static ExchangeResult postOnce(const Options &options, const std::string &request, int &status)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return EXCHANGE_ERROR;
+  }
+  timeval timeout = {options.timeoutMs / 1000, (options.timeoutMs % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)); // also bounds connect()
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(options.port);
+  inet_pton(AF_INET, options.host, &address.sin_addr);
+
+  ExchangeResult result = EXCHANGE_OK;
+  if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0 ||
+      ::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+  {
+    result = (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS) ? EXCHANGE_TIMEOUT : EXCHANGE_ERROR;
+  }
+
+  char response[512];
+  size_t received = 0;
+  while (result == EXCHANGE_OK)
+  {
+    ssize_t n = recv(fd, response + received, sizeof(response) - 1 - received, 0);
+    if (n == 0)
+    {
+      break;
+    }
+    if (n < 0)
+    {
+      result = (errno == EAGAIN || errno == EWOULDBLOCK) ? EXCHANGE_TIMEOUT : EXCHANGE_ERROR;
+      break;
+    }
+    received += n;
+    if (received == sizeof(response) - 1)
+    {
+      received = 12; // only the status line is kept; the rest is drained
+    }
+  }
+  close(fd);
+
+  response[received] = '\0';
+  status = 0;
+  if (result == EXCHANGE_OK && (received < 12 || sscanf(response, "HTTP/1.%*d %d", &status) != 1))
+  {
+    result = EXCHANGE_ERROR;
+  }
+  return result;
+}
+
+static void runWorker(const Options &options, int worker, std::chrono::steady_clock::time_point start,
+                      WorkerResult &result)
+{
+  using namespace std::chrono;
+  BodyGenerator generator(options, options.seed * 7919 + worker);
+  std::vector<Console> consoles;
+  for (int number = worker; number < options.consoles; number += options.concurrency)
+  {
+    consoles.emplace_back();
+    generator.initConsole(consoles.back(), number);
+  }
+  if (consoles.empty())
+  {
+    return;
+  }
+
+  // Each connection sends every concurrency-th request of the total schedule
+  steady_clock::duration interval =
+      options.rate > 0 ? duration_cast<steady_clock::duration>(duration<double>(options.concurrency / options.rate))
+                       : steady_clock::duration::zero();
+  steady_clock::time_point due = start + duration_cast<steady_clock::duration>(interval * worker / options.concurrency);
+  steady_clock::time_point end = start + seconds(options.duration);
+
+  for (size_t sent = 0; due < end; sent++)
+  {
+    if (options.rate > 0)
+    {
+      std::this_thread::sleep_until(due);
+    }
+    steady_clock::time_point sentAt = steady_clock::now();
+    if (sentAt >= end)
+    {
+      break;
+    }
+    Console &console = consoles[sent % consoles.size()];
+    std::string body = generator.next(console);
+    std::string request = "POST /post HTTP/1.1\r\nHost: " + std::string(options.host) +
+                          "\r\nContent-Type: application/x-www-form-urlencoded\r\nConnection: close\r\n"
+                          "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    int status;
+    ExchangeResult outcome = postOnce(options, request, status);
+    steady_clock::time_point done = steady_clock::now();
+    result.latency.record(duration_cast<microseconds>(done - (options.rate > 0 ? due : sentAt)).count());
+    if (outcome == EXCHANGE_TIMEOUT)
+    {
+      result.timeouts++;
+    }
+    else if (outcome == EXCHANGE_ERROR)
+    {
+      result.errors++;
+    }
+    else
+    {
+      result.statuses[status >= 100 && status < 600 ? status / 100 : 0]++;
+      result.status429 += status == 429;
+      result.status503 += status == 503;
+    }
+    due = options.rate > 0 ? due + interval : done;
+  }
+}
+
+// The firmware's /post path without the card: parse, convert, queue; the loop
+// thread writes queued records out at the cost of journal appends and commits
+static PosixHttpMux localServer;
+static IngestQueue localQueue;
+static std::atomic<bool> localRunning(true);
+static std::atomic<uint64_t> localStored(0);
+static RateLimiter localLimiter(LOCAL_BURST, LOCAL_REFILL_MS);
+static SampleFilter localFilter;
+static IngestPipeline *localPipeline; // built once --no-limit is known
+
+static void handleLocalPost(void)
+{
+  localPipeline->handle(localServer, nowMillis());
+}
+
+static void runLocalServer(void)
+{
+  int sinceCommit = 0;
+  while (localRunning)
+  {
+    localServer.handleClient();
+    for (int i = 0; i < LOCAL_DRAIN_PER_PASS && localQueue.depth() > 0; i++)
+    {
+      usleep(LOCAL_APPEND_US);
+      localQueue.pop();
+      localStored++;
+      if (++sinceCommit == LOCAL_COMMIT_EVERY)
+      {
+        usleep(LOCAL_COMMIT_US);
+        sinceCommit = 0;
+      }
+    }
+    usleep(50);
+  }
+}
+
+static void printLatency(const LatencyHistogram &latency)
+{
+  printf("latency ms   p50 %8.2f  p90 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f  mean %8.2f\n",
+         latency.percentile(50) / 1000.0, latency.percentile(90) / 1000.0, latency.percentile(99) / 1000.0,
+         latency.percentile(99.9) / 1000.0, latency.max() / 1000.0, latency.mean() / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  Options options;
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--host=", 7) == 0)
+    {
+      options.host = arg + 7;
+    }
+    else if (strncmp(arg, "--port=", 7) == 0)
+    {
+      options.port = atoi(arg + 7);
+    }
+    else if (strncmp(arg, "--rate=", 7) == 0)
+    {
+      options.rate = atof(arg + 7);
+    }
+    else if (strncmp(arg, "--concurrency=", 14) == 0)
+    {
+      options.concurrency = std::max(1, atoi(arg + 14));
+    }
+    else if (strncmp(arg, "--consoles=", 11) == 0)
+    {
+      options.consoles = std::max(1, atoi(arg + 11));
+    }
+    else if (strncmp(arg, "--duration=", 11) == 0)
+    {
+      options.duration = std::max(1, atoi(arg + 11));
+    }
+    else if (strncmp(arg, "--timeout=", 10) == 0)
+    {
+      options.timeoutMs = std::max(1, atoi(arg + 10));
+    }
+    else if (strncmp(arg, "--missing=", 10) == 0)
+    {
+      options.missing = atof(arg + 10);
+    }
+    else if (strncmp(arg, "--garbage=", 10) == 0)
+    {
+      options.garbage = atof(arg + 10);
+    }
+    else if (strncmp(arg, "--seed=", 7) == 0)
+    {
+      options.seed = strtoul(arg + 7, nullptr, 10);
+    }
+    else if (strncmp(arg, "--hgrm=", 7) == 0)
+    {
+      options.hgrm = arg + 7;
+    }
+    else if (strcmp(arg, "--no-limit") == 0)
+    {
+      options.limit = false;
+    }
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 1;
+    }
+  }
+
+  options.consoles = std::max(options.consoles, options.concurrency); // a console is never shared by two connections
+
+  std::thread localLoop;
+  bool local = options.host == nullptr;
+  IngestPipeline pipeline(localQueue, options.limit ? &localLimiter : nullptr, localFilter, 0);
+  if (local)
+  {
+    options.host = "127.0.0.1";
+    options.port = LOCAL_PORT;
+    localPipeline = &pipeline;
+    localServer.on("/post", HTTP_METHOD_POST, handleLocalPost, HTTP_ROUTE_PRIORITY);
+    if (!localServer.begin(options.port))
+    {
+      fprintf(stderr, "cannot listen on port %u\n", options.port);
+      return 1;
+    }
+    localLoop = std::thread(runLocalServer);
+  }
+  else
+  {
+    in_addr check;
+    if (inet_pton(AF_INET, options.host, &check) != 1)
+    {
+      fprintf(stderr, "--host takes an IPv4 address\n");
+      return 1;
+    }
+  }
+
+  printf("/post load test against %s:%u%s\n", options.host, options.port, local ? " (in-process HttpMux)" : "");
+  if (options.rate > 0)
+  {
+    printf("%d connections, %.1f requests/s for %d s, %d consoles, %.1f%% missing, %.1f%% garbage\n",
+           options.concurrency, options.rate, options.duration, options.consoles, options.missing, options.garbage);
+  }
+  else
+  {
+    printf("%d connections as fast as they go for %d s, %d consoles, %.1f%% missing, %.1f%% garbage\n",
+           options.concurrency, options.duration, options.consoles, options.missing, options.garbage);
+  }
+
+  std::vector<WorkerResult> results(options.concurrency);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int worker = 0; worker < options.concurrency; worker++)
+  {
+    workers.emplace_back(runWorker, std::cref(options), worker, start, std::ref(results[worker]));
+  }
+  for (auto &t : workers)
+  {
+    t.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  WorkerResult total;
+  for (const WorkerResult &result : results)
+  {
+    total.latency.add(result.latency);
+    for (int i = 0; i < 6; i++)
+    {
+      total.statuses[i] += result.statuses[i];
+    }
+    total.status429 += result.status429;
+    total.status503 += result.status503;
+    total.errors += result.errors;
+    total.timeouts += result.timeouts;
+  }
+
+  uint64_t requests = total.latency.total();
+  double scale = requests ? 100.0 / requests : 0;
+  printf("requests %llu in %.1f s, %.1f/s; 2xx %.1f/s\n", (unsigned long long)requests, seconds, requests / seconds,
+         total.statuses[2] / seconds);
+  printf("status       2xx %llu  4xx %llu (429 %llu)  5xx %llu (503 %llu)\n", (unsigned long long)total.statuses[2],
+         (unsigned long long)total.statuses[4], (unsigned long long)total.status429,
+         (unsigned long long)total.statuses[5], (unsigned long long)total.status503);
+  printf("errors       %llu (%.2f%%)  timeouts %llu (%.2f%%)\n", (unsigned long long)total.errors, total.errors * scale,
+         (unsigned long long)total.timeouts, total.timeouts * scale);
+  printLatency(total.latency);
+
+  if (options.hgrm)
+  {
+    FILE *out = fopen(options.hgrm, "w");
+    if (!out)
+    {
+      fprintf(stderr, "cannot write %s\n", options.hgrm);
+    }
+    else
+    {
+      total.latency.writeDistribution(out);
+      fclose(out);
+    }
+  }
+
+  if (local)
+  {
+    usleep(200000); // let the queue drain
+    localRunning = false;
+    localLoop.join();
+    printf("stored       %llu records, %llu duplicates acknowledged\n", (unsigned long long)localStored.load(),
+           (unsigned long long)pipeline.counters().duplicates);
+  }
+  return total.errors + total.timeouts > 0 ? 2 : 0;
+}
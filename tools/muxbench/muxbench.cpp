@@ -0,0 +1,243 @@
+/*
+ * Host load test for HttpMux.
+ *
+ * Runs the multiplexer on a POSIX socket with the same loop structure as the
+ * firmware, then measures /post latency with and without concurrent
+ * multi-megabyte downloads from slow clients.
+ *
+ *   pio run -e muxbench -t exec
+ *   g++ -std=gnu++17 -O2 -pthread -Ilib/HttpMux -Itools/common tools/muxbench/muxbench.cpp lib/HttpMux/HttpMux.cpp -o muxbench
+ *
+ * Options: --blocking streams downloads to completion inside the handler, the
+ * way the synchronous WebServer did, for comparison.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "PosixHttpMux.h"
+
+#define SD_WRITE_US 3000 // one appendFile() on the card
+#define SD_READ_US 300   // one buffer of a file read from the card
+#define INGEST_INTERVAL_MS 40
+#define INGEST_SAMPLES 250
+#define INGEST_PHASE_MS 30000 // cap per phase, blocking mode manages only a few samples
+#define DOWNLOAD_BYTES (8 * 1024 * 1024)
+#define DOWNLOAD_CLIENTS 2
+#define DOWNLOAD_LINK_BYTES_PER_MS 1500 // roughly 12 Mbit/s of Wi-Fi
+
+// Produces a file's worth of bytes at the pace of SD reads
+class SimulatedFileStream : public HttpStream
+{
+
+public:
+  explicit SimulatedFileStream(size_t length) : _remaining(length) {}
+
+  size_t read(uint8_t *buffer, size_t size)
+  {
+    size_t n = std::min(size, _remaining);
+    if (n > 0)
+    {
+      usleep(SD_READ_US);
+      memset(buffer, 'x', n);
+      _remaining -= n;
+    }
+    return n;
+  }
+
+private:
+  size_t _remaining;
+
+};
+
+static PosixHttpMux server;
+static bool blockingDownloads = false;
+static std::atomic<bool> running(true);
+static std::atomic<long> ingested(0);
+
+static void handlePost(void)
+{
+  usleep(SD_WRITE_US);
+  ingested++;
+  server.send(200, "text/plain", "Data saved to SD card.");
+}
+
+static void handleDownload(void)
+{
+  if (server.sendStream(200, "text/plain", DOWNLOAD_BYTES, new SimulatedFileStream(DOWNLOAD_BYTES)) && blockingDownloads)
+  {
+    server.flush(600000); // the old server sent the whole file before serving anyone else
+  }
+}
+
+static int connectTo(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Sends one request and reads until the server closes; returns bytes received or -1
+static long exchange(uint16_t port, const std::string &request, bool slowReader)
+{
+  int fd = connectTo(port);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  timeval timeout = {30, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+  {
+    close(fd);
+    return -1;
+  }
+  char buffer[4096];
+  long total = 0;
+  for (;;)
+  {
+    size_t want = slowReader ? DOWNLOAD_LINK_BYTES_PER_MS : sizeof(buffer);
+    ssize_t n = recv(fd, buffer, want, 0);
+    if (n <= 0)
+    {
+      break;
+    }
+    total += n;
+    if (slowReader)
+    {
+      usleep(1000);
+    }
+  }
+  close(fd);
+  return total;
+}
+
+static std::vector<double> runIngest(uint16_t port)
+{
+  const std::string body = "PASSKEY=ABC&stationtype=EasyWeatherV1.6.4&dateutc=2024-01-01+01%3A00%3A00&tempinf=72.1&humidityin=55&"
+                           "baromrelin=29.92&baromabsin=29.80&tempf=81.5&humidity=60&winddir=180&windspeedmph=3.4&windgustmph=4.5&"
+                           "maxdailygust=8.1&rainratein=0.000&dailyrainin=0.000&weeklyrainin=0.000&monthlyrainin=0.000&"
+                           "yearlyrainin=0.000&totalrainin=0.000&solarradiation=700.00&uv=5&wh65batt=0";
+  std::string request = "POST /post HTTP/1.1\r\nHost: 192.168.8.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+  std::vector<double> latencies;
+  unsigned long phaseStart = nowMillis();
+  for (int i = 0; i < INGEST_SAMPLES && nowMillis() - phaseStart < INGEST_PHASE_MS; i++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    long received = exchange(port, request, false);
+    auto end = std::chrono::steady_clock::now();
+    if (received > 0)
+    {
+      latencies.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(INGEST_INTERVAL_MS));
+  }
+  return latencies;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+  if (values.empty())
+  {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, (size_t)(p / 100.0 * values.size()));
+  return values[index];
+}
+
+static void report(const char *phase, const std::vector<double> &latencies)
+{
+  printf("%-20s n=%-4zu p50=%8.2f ms  p90=%8.2f ms  p99=%8.2f ms  max=%8.2f ms\n", phase, latencies.size(),
+         percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), percentile(latencies, 100));
+}
+
+int main(int argc, char **argv)
+{
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  uint16_t port = 18080;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--blocking") == 0)
+    {
+      blockingDownloads = true;
+    }
+    else if (strncmp(argv[i], "--port=", 7) == 0)
+    {
+      port = atoi(argv[i] + 7);
+    }
+  }
+
+  server.on("/post", HTTP_METHOD_POST, handlePost, HTTP_ROUTE_PRIORITY);
+  server.on("/download", HTTP_METHOD_GET, handleDownload);
+  if (!server.begin(port))
+  {
+    fprintf(stderr, "cannot listen on port %u\n", port);
+    return 1;
+  }
+
+  std::thread loop([] {
+    while (running)
+    {
+      server.handleClient();
+      usleep(50);
+    }
+  });
+
+  printf("HttpMux load test (%s downloads, %d x %d MB at ~%d KB/s)\n", blockingDownloads ? "blocking" : "time-sliced",
+         DOWNLOAD_CLIENTS, DOWNLOAD_BYTES >> 20, DOWNLOAD_LINK_BYTES_PER_MS);
+  report("ingest alone", runIngest(port));
+
+  std::atomic<bool> downloading(true);
+  std::atomic<long> downloaded(0);
+  std::vector<std::thread> downloaders;
+  for (int i = 0; i < DOWNLOAD_CLIENTS; i++)
+  {
+    downloaders.emplace_back([&] {
+      while (downloading)
+      {
+        long n = exchange(port, "GET /download HTTP/1.1\r\nHost: 192.168.8.1\r\n\r\n", true);
+        if (n > 0)
+        {
+          downloaded += n;
+        }
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto start = std::chrono::steady_clock::now();
+  std::vector<double> loaded = runIngest(port);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  report("ingest + downloads", loaded);
+  printf("download throughput during test: %.1f KB/s\n", downloaded / 1024.0 / seconds);
+
+  downloading = false;
+  for (auto &t : downloaders)
+  {
+    t.join();
+  }
+  running = false;
+  loop.join();
+  return 0;
+}